@@ -6,7 +6,22 @@ include $(SDK_DIR)/Android.def
 LOCAL_SRC_FILES:= \
     bsl430-platform.c \
     bsl430.c \
-    bsl430-program.c
+    bsl430-program.c \
+    bsl430-journal.c \
+    bsl430-cache.c \
+    bsl430-loader.c \
+    bsl430-trace.c \
+    bsl430-stream.c \
+    bsl430-titxt.c \
+    bsl430-uring.c \
+    bsl430-session.c \
+    bsl430-daemon.c \
+    bsl430-plan.c \
+    bsl430-audit.c \
+    bsl430-strategy.c \
+    bsl430-merge.c \
+    bsl430-patch.c \
+    bsl430-rt.c
 
 LOCAL_SHARED_LIBRARIES := \
     libcutils \
@@ -39,7 +54,22 @@ include $(SDK_DIR)/Android.def
 LOCAL_SRC_FILES:= \
     bsl430-platform.c \
     bsl430.c \
-    bsl430-program.c
+    bsl430-program.c \
+    bsl430-journal.c \
+    bsl430-cache.c \
+    bsl430-loader.c \
+    bsl430-trace.c \
+    bsl430-stream.c \
+    bsl430-titxt.c \
+    bsl430-uring.c \
+    bsl430-session.c \
+    bsl430-daemon.c \
+    bsl430-plan.c \
+    bsl430-audit.c \
+    bsl430-strategy.c \
+    bsl430-merge.c \
+    bsl430-patch.c \
+    bsl430-rt.c
 
 LOCAL_SHARED_LIBRARIES := \
     libcutils \
@@ -86,7 +116,35 @@ LOCAL_STATIC_LIBRARIES := \
 LOCAL_C_INCLUDES := \
     $(LOCAL_PATH)/../include
 
+LOCAL_CFLAGS := -DBSL430_LOG_CONSOLE
+
 LOCAL_MODULE := bsl430_test
 LOCAL_32_BIT_ONLY := true
 
 include $(BUILD_EXECUTABLE)
+
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    bsl430_loader_stub.c
+
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    liblog \
+    libhi_common \
+    libhi_msp
+
+LOCAL_STATIC_LIBRARIES := \
+    libbsl430-clog \
+    libpmrpc
+
+LOCAL_C_INCLUDES := \
+    $(LOCAL_PATH)/../include
+
+LOCAL_CFLAGS := -DBSL430_LOG_CONSOLE
+
+LOCAL_MODULE := bsl430_loader_stub
+LOCAL_32_BIT_ONLY := true
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-audit"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-session.h"
+#include "bsl430-audit.h"
+
+static uint32_t audit_ms(void);
+
+/*
+ * Check the device holds the image, by a session of its own unless one is
+ * open, see bsl430-session.h.
+ */
+int bsl430_audit(titxt_header_t *header, int flags, bsl430_audit_t *audit)
+{
+    int status = 0;
+    int owned = 0;
+    uint32_t i;
+    uint32_t start = audit_ms();
+    uint16_t crc0, crc1;
+    uint8_t password[32];
+    uint8_t id[BSL430_DEVICE_ID_SIZE];
+    titxt_segment_t *segment = NULL;
+
+    if (!header || !audit) {
+        return -1;
+    }
+
+    memset(audit, 0, sizeof(*audit));
+    audit->image = bsl430_ti_txt_hash(header);
+
+    if (bsl430_session_state() == BSL430_SESSION_CLOSED) {
+        status = bsl430_session_open(115200);
+        if (status != 0) {
+            goto error0;
+        }
+        owned = 1;
+    }
+
+    if (bsl430_session_state() != BSL430_SESSION_UNLOCKED) {
+        if (!(flags & BSL430_AUDIT_UNLOCK)) {
+            log("** BSL locked, the password may erase the device, not sent.\n");
+            audit->locked = 1;
+            status = -1;
+            goto error1;
+        }
+        bsl430_ti_txt_password(header, password);
+        status = bsl430_session_unlock(password, &audit->erased);
+        if (status != 0) {
+            goto error1;
+        }
+        if (audit->erased) {
+            log("** Device doesn't hold the vectors of the image!\n");
+            status = 1;
+            goto error1;
+        }
+    }
+
+    if (bsl430_device_id(id, sizeof(id)) == 0) {
+        for (i = 0; i < BSL430_DEVICE_ID_SIZE; i++) {
+            sprintf(&audit->device[i * 2], "%02X", id[i]);
+        }
+    }
+    bsl430_session_version(&audit->version);
+
+    for (i = 0; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+        crc0 = bsl430_crc16(segment->data, segment->size, 0xFFFF);
+
+        status = bsl430_session_crc(segment->address, (uint16_t)segment->size, &crc1);
+        if (status != 0) {
+            log("** Checking CRC failed!\n");
+            goto error1;
+        }
+
+        audit->segments++;
+        if (crc0 != crc1) {
+            log("** Segment @%04X %u Bytes, Crc %04X, device %04X!\n",
+                segment->address, segment->size, crc0, crc1);
+            audit->mismatches++;
+        }
+    }
+
+    status = (audit->mismatches)? 1: 0;
+
+error1:
+    if (owned) {
+        bsl430_session_close();
+    }
+
+error0:
+    audit->status = status;
+    audit->time_ms = audit_ms() - start;
+
+    log("Audit %s: %u segments, %u mismatches, %u ms.\n", (status == 0)? "PASS": "FAIL",
+        audit->segments, audit->mismatches, audit->time_ms);
+
+    return status;
+}
+
+/*
+ * Return the length of the report line, without a '\n'.
+ */
+int bsl430_audit_report(const char *port, const bsl430_audit_t *audit, char *buf, uint32_t size)
+{
+    return snprintf(buf, size,
+                    "{\"port\":\"%s\",\"device\":\"%s\",\"image\":\"%08X\",\"result\":\"%s\","
+                    "\"status\":%d,\"erased\":%s,\"locked\":%s,\"segments\":%u,\"mismatches\":%u,"
+                    "\"version\":\"%08X\",\"ms\":%u}",
+                    (port)? port: "", audit->device, audit->image,
+                    (audit->status == 0)? "pass": "fail", audit->status,
+                    (audit->erased)? "true": "false", (audit->locked)? "true": "false",
+                    audit->segments, audit->mismatches, audit->version, audit->time_ms);
+}
+
+static uint32_t audit_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
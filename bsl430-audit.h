@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_AUDIT_H__
+#define __BSL430_AUDIT_H__
+
+#include <stdint.h>
+
+#include "bsl430.h"
+#include "bsl430-program.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Verify-only audit
+ *
+ * bsl430_audit() checks each segment of the expected image by one CRC_CHECK
+ * against the CRC computed on the host, nothing is written or read back.
+ * It takes the entry and a frame per segment, well under a second at
+ * 115200 baud.
+ *
+ * The checks need an unlocked BSL. With BSL430_AUDIT_UNLOCK a locked BSL is
+ * unlocked by the password of the image, its vector table. A device with
+ * other vectors fails the password and is erased by the BSL, it fails the
+ * audit with <erased> set and needs programming. Without the flag no
+ * password is sent, a locked BSL fails the audit with <locked> set.
+ *
+ * bsl430_audit_report() formats the result as one line of JSON:
+ *
+ *      {"port":"/dev/ttyUSB0","device":"3382FFFF...","image":"5A3C0F12",
+ *       "result":"pass","status":0,"erased":false,"locked":false,"segments":6,
+ *       "mismatches":0,"version":"000835B3","ms":412}
+ */
+
+#define BSL430_AUDIT_UNLOCK     0x01    /* send the password, may erase the device */
+
+typedef struct bsl430_audit_s {
+    int status;             /* 0: the image, 1: a CRC mismatch, else an error */
+    int erased;             /* the password failed, the device is erased */
+    int locked;             /* the BSL is locked and no password was sent */
+    uint32_t image;         /* bsl430_ti_txt_hash() */
+    uint32_t segments;      /* checked */
+    uint32_t mismatches;
+    uint32_t version;
+    uint32_t time_ms;
+    char device[BSL430_DEVICE_ID_SIZE * 2 + 1];
+} bsl430_audit_t;
+
+int bsl430_audit(titxt_header_t *header, int flags, bsl430_audit_t *audit);
+int bsl430_audit_report(const char *port, const bsl430_audit_t *audit, char *buf, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_AUDIT_H__ */
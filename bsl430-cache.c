@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-cache"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-cache.h"
+
+#define CACHE_LINE_SIZE     192
+
+static int cache_parse(const char *line, bsl430_cache_t *record);
+
+int bsl430_cache_load(const char *path, bsl430_cache_t *entry)
+{
+    FILE *fp = NULL;
+    char line[CACHE_LINE_SIZE];
+    bsl430_cache_t record;
+    int status = -1;
+
+    if (!path || !entry) {
+        return -1;
+    }
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (cache_parse(line, &record) != 0) {
+            continue;
+        }
+
+        if (strcmp(record.device, entry->device) == 0) {
+            *entry = record;
+            status = 0;
+            break;
+        }
+    }
+
+    fclose(fp);
+    return status;
+}
+
+int bsl430_cache_password(const char *path, uint8_t *password)
+{
+    FILE *fp = NULL;
+    char line[CACHE_LINE_SIZE];
+    bsl430_cache_t record;
+    int status = -1;
+    int i;
+
+    if (!path || !password) {
+        return -1;
+    }
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (cache_parse(line, &record) != 0) {
+            continue;
+        }
+
+        for (i = 0; i < 32 && record.password[i] == 0xFF; i++) ;
+        if (i < 32) {
+            memcpy(password, record.password, 32);
+            status = 0;
+        }
+    }
+
+    fclose(fp);
+    return status;
+}
+
+/*
+ * A device holds one image, so its record is replaced. The cache is
+ * rewritten into a temporary file and renamed over the old one.
+ */
+int bsl430_cache_save(const char *path, const bsl430_cache_t *entry)
+{
+    FILE *in = NULL;
+    FILE *out = NULL;
+    char *tmp = NULL;
+    char line[CACHE_LINE_SIZE];
+    bsl430_cache_t record;
+    int status = 0;
+    int i;
+
+    if (!path || !entry) {
+        return -1;
+    }
+
+    tmp = malloc(strlen(path) + 5);
+    if (tmp == NULL) {
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", path);
+
+    out = fopen(tmp, "w");
+    if (out == NULL) {
+        log("** Open cache failed! %s\n", tmp);
+        free(tmp);
+        return -1;
+    }
+
+    in = fopen(path, "r");
+    if (in != NULL) {
+        while (fgets(line, sizeof(line), in)) {
+            if (cache_parse(line, &record) == 0 &&
+                strcmp(record.device, entry->device) == 0) {
+                continue;
+            }
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+
+    fprintf(out, "%s %08X %04X %u %04X ", entry->device, entry->image,
+            entry->address, entry->size, entry->crc);
+    for (i = 0; i < 32; i++) {
+        fprintf(out, "%02X", entry->password[i]);
+    }
+    fprintf(out, "\n");
+
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0) {
+        status = -1;
+    }
+    fclose(out);
+
+    if (status == 0 && rename(tmp, path) != 0) {
+        status = -1;
+    }
+
+    if (status != 0) {
+        log("** Update cache failed! %s\n", path);
+        unlink(tmp);
+    }
+
+    free(tmp);
+    return status;
+}
+
+/*
+ * Records of an older cache have no password.
+ */
+static int cache_parse(const char *line, bsl430_cache_t *record)
+{
+    unsigned int crc = 0;
+    unsigned int b = 0;
+    char password[65];
+    int i;
+
+    memset(record, 0, sizeof(*record));
+    memset(record->password, 0xFF, sizeof(record->password));
+    memset(password, 0, sizeof(password));
+
+    if (sscanf(line, "%32s %x %x %u %x %64s", record->device, &record->image,
+               &record->address, &record->size, &crc, password) < 5) {
+        return -1;
+    }
+    record->crc = (uint16_t)crc;
+
+    if (strlen(password) == 64) {
+        for (i = 0; i < 32; i++) {
+            if (sscanf(&password[i * 2], "%2x", &b) != 1) {
+                memset(record->password, 0xFF, sizeof(record->password));
+                break;
+            }
+            record->password[i] = (uint8_t)b;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_CACHE_H__
+#define __BSL430_CACHE_H__
+
+#include <stdint.h>
+
+#include "bsl430.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Flash state of a device after its last successful programming:
+ *      <device id> <image hash> <address> <size> <crc> [<password>]
+ *
+ * <address> and <size> span all segments of the image, <crc> is what
+ * CRC_CHECK over the span returned right after the programming. <password>
+ * is the vector table of the image in hex, all 0xFF if not recorded.
+ *
+ * The record saved last is at the end. bsl430_cache_password() returns its
+ * password, the one of the image most likely deployed on the next device.
+ */
+typedef struct bsl430_cache_s {
+    char     device[BSL430_DEVICE_ID_SIZE * 2 + 1];
+    uint32_t image;
+    uint32_t address;
+    uint32_t size;
+    uint16_t crc;
+    uint8_t  password[32];
+} bsl430_cache_t;
+
+int bsl430_cache_load(const char *path, bsl430_cache_t *entry);
+int bsl430_cache_save(const char *path, const bsl430_cache_t *entry);
+int bsl430_cache_password(const char *path, uint8_t *password);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_CACHE_H__ */
@@ -0,0 +1,1032 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-daemon"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "bsl430-platform.h"
+#include "bsl430.h"
+#include "bsl430-program.h"
+#include "bsl430-stream.h"
+#include "bsl430-patch.h"
+#include "bsl430-session.h"
+#include "bsl430-audit.h"
+#include "bsl430-daemon.h"
+
+#define DAEMON_LINE_MAX     4096
+#define DAEMON_MAX_CLIENTS  32
+#define DAEMON_MAX_WORDS    16
+/* Bytes of a read job, its data line is 3 characters a byte. */
+#define DAEMON_READ_MAX     1024
+
+typedef struct daemon_line_s {
+    char buf[DAEMON_LINE_MAX];
+    uint32_t start;
+    uint32_t len;
+} daemon_line_t;
+
+typedef struct daemon_job_s {
+    uint32_t id;
+    int client;                 /* index of the client, -1 if it is gone */
+    char tty[PATH_MAX];
+    char line[DAEMON_LINE_MAX];
+    uint64_t queued_ms;
+    struct daemon_job_s *next;
+} daemon_job_t;
+
+typedef struct daemon_worker_s {
+    pid_t pid;
+    int in;                     /* jobs to the worker */
+    int out;                    /* answers from the worker */
+    char tty[PATH_MAX];
+    daemon_job_t *job;          /* running, or NULL */
+    daemon_line_t line;
+} daemon_worker_t;
+
+typedef struct daemon_client_s {
+    int fd;
+    daemon_line_t line;
+} daemon_client_t;
+
+typedef struct daemon_s {
+    bsl430_daemon_config_t config;
+    int fd;
+    uint32_t id;
+    daemon_job_t *queue;
+    daemon_worker_t worker[BSL430_DAEMON_MAX_WORKERS];
+    int workers;
+    daemon_client_t client[DAEMON_MAX_CLIENTS];
+} daemon_t;
+
+/* Where the progress of a job goes. */
+typedef struct daemon_progress_s {
+    int fd;
+    uint32_t id;
+} daemon_progress_t;
+
+/* An image cached by a worker. */
+typedef struct daemon_image_s {
+    char path[PATH_MAX];
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    titxt_header_t *header;
+    bsl430_stream_t stream;
+    uint32_t used;
+} daemon_image_t;
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void daemon_signal(int sig);
+static uint64_t daemon_ms(void);
+static int daemon_read(int fd, daemon_line_t *line);
+static char *daemon_next(daemon_line_t *line);
+static int daemon_words(char *line, char **words);
+static void daemon_send(daemon_t *daemon, int client, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+static void daemon_accept(daemon_t *daemon);
+static void daemon_client(daemon_t *daemon, int index);
+static void daemon_job(daemon_t *daemon, int client, const char *line);
+static void daemon_answer(daemon_t *daemon, daemon_worker_t *worker);
+static void daemon_dispatch(daemon_t *daemon);
+static int daemon_spawn(daemon_t *daemon, const char *tty);
+static void daemon_retire(daemon_t *daemon, daemon_worker_t *worker);
+
+static void daemon_worker(daemon_t *daemon, daemon_worker_t *worker);
+static int daemon_worker_job(int out, char *line, daemon_image_t *images, int count,
+                             uint32_t *clock);
+static daemon_image_t *daemon_image(daemon_image_t *images, int count, uint32_t *clock,
+                                   const char *path);
+static void daemon_progress(uint32_t done, uint32_t total, void *arg);
+
+int bsl430_daemon_run(const bsl430_daemon_config_t *config)
+{
+    int status = 0;
+    int i, n;
+    daemon_t *daemon = NULL;
+    struct sockaddr_un addr;
+    struct sigaction action;
+    struct pollfd fds[1 + DAEMON_MAX_CLIENTS + BSL430_DAEMON_MAX_WORKERS];
+    void *owner[1 + DAEMON_MAX_CLIENTS + BSL430_DAEMON_MAX_WORKERS];
+    daemon_job_t *job = NULL;
+
+    if (!config || !config->socket || strlen(config->socket) >= sizeof(addr.sun_path)) {
+        log("** Bad socket path.\n");
+        return -1;
+    }
+
+    daemon = calloc(1, sizeof(*daemon));
+    if (daemon == NULL) {
+        log("Allocating daemon error.\n");
+        return -1;
+    }
+
+    daemon->config = *config;
+    if (daemon->config.workers <= 0 || daemon->config.workers > BSL430_DAEMON_MAX_WORKERS) {
+        daemon->config.workers = (daemon->config.workers > 0)? BSL430_DAEMON_MAX_WORKERS:
+                                 bsl430_gpio_per_port()? 4: 1;
+    }
+    if (daemon->config.workers > 1 && !bsl430_gpio_per_port()) {
+        log("RST/TST are shared by the ttys, one worker.\n");
+        daemon->config.workers = 1;
+    }
+    /* The image and the previous one are held at once. */
+    if (daemon->config.images < 2) {
+        daemon->config.images = (daemon->config.images <= 0)? 8: 2;
+    }
+    if (daemon->config.idle_ms == 0) {
+        daemon->config.idle_ms = 5000;
+    }
+    for (i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        daemon->client[i].fd = -1;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = daemon_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, config->socket);
+    unlink(addr.sun_path);
+
+    daemon->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (daemon->fd < 0 || bind(daemon->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(daemon->fd, 8) != 0) {
+        log("Opening socket %s failed! %s\n", config->socket, strerror(errno));
+        status = -1;
+        goto error0;
+    }
+
+    log("Serving %s, %d workers, %d images each.\n", config->socket,
+        daemon->config.workers, daemon->config.images);
+
+    while (!daemon_stop) {
+        n = 0;
+        fds[n].fd = daemon->fd;
+        fds[n].events = POLLIN;
+        owner[n++] = NULL;
+        for (i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+            if (daemon->client[i].fd >= 0) {
+                fds[n].fd = daemon->client[i].fd;
+                fds[n].events = POLLIN;
+                owner[n++] = &daemon->client[i];
+            }
+        }
+        for (i = 0; i < daemon->workers; i++) {
+            fds[n].fd = daemon->worker[i].out;
+            fds[n].events = POLLIN;
+            owner[n++] = &daemon->worker[i];
+        }
+
+        if (poll(fds, (nfds_t)n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log("Polling failed! %s\n", strerror(errno));
+            status = -1;
+            break;
+        }
+
+        /* The workers first, a retired one moves the others down. */
+        for (i = n - 1; i > 0; i--) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            if (owner[i] >= (void *)daemon->worker &&
+                owner[i] < (void *)&daemon->worker[BSL430_DAEMON_MAX_WORKERS]) {
+                daemon_answer(daemon, owner[i]);
+            } else {
+                daemon_client(daemon, (int)((daemon_client_t *)owner[i] - daemon->client));
+            }
+        }
+
+        if (fds[0].revents) {
+            daemon_accept(daemon);
+        }
+
+        while (waitpid(-1, NULL, WNOHANG) > 0) {
+        }
+
+        daemon_dispatch(daemon);
+    }
+
+    log("Stopping, %d workers.\n", daemon->workers);
+
+error0:
+    /* The workers close their sessions and exit at the end of their input. */
+    while (daemon->workers > 0) {
+        daemon_retire(daemon, &daemon->worker[0]);
+    }
+    while (wait(NULL) > 0) {
+    }
+
+    for (i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        if (daemon->client[i].fd >= 0) {
+            close(daemon->client[i].fd);
+        }
+    }
+    while (daemon->queue) {
+        job = daemon->queue;
+        daemon->queue = job->next;
+        free(job);
+    }
+    if (daemon->fd >= 0) {
+        close(daemon->fd);
+        unlink(addr.sun_path);
+    }
+    free(daemon);
+
+    return status;
+}
+
+/*
+ * Send the job and print the answers until it is done. Return the status
+ * of the job.
+ */
+int bsl430_daemon_submit(const char *socket_path, const char *job)
+{
+    int status = -1;
+    int fd = -1;
+    int n = 0;
+    struct sockaddr_un addr;
+    daemon_line_t line;
+    char *s = NULL;
+    char *words[DAEMON_MAX_WORDS + 1];
+
+    if (!socket_path || strlen(socket_path) >= sizeof(addr.sun_path)) {
+        log("** Bad socket path.\n");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        log("Connecting %s failed! %s\n", socket_path, strerror(errno));
+        goto error0;
+    }
+
+    if (write(fd, job, strlen(job)) != (ssize_t)strlen(job) || write(fd, "\n", 1) != 1) {
+        log("Sending job failed! %s\n", strerror(errno));
+        goto error0;
+    }
+
+    memset(&line, 0, sizeof(line));
+    while (daemon_read(fd, &line) == 0) {
+        while ((s = daemon_next(&line)) != NULL) {
+            printf("%s\n", s);
+            n = daemon_words(s, words);
+            if (n >= 3 && strcmp(words[0], "done") == 0) {
+                status = atoi(words[2]);
+                goto error0;
+            }
+            if (n >= 1 && strcmp(words[0], "error") == 0) {
+                goto error0;
+            }
+        }
+    }
+
+    log("** Daemon closed the connection.\n");
+
+error0:
+    if (fd >= 0) {
+        close(fd);
+    }
+    return status;
+}
+
+static void daemon_signal(int sig)
+{
+    (void)sig;
+    daemon_stop = 1;
+}
+
+static uint64_t daemon_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/*
+ * Read what is there into the line buffer. Return -1 at the end of input,
+ * on an error, or on a line too long.
+ */
+static int daemon_read(int fd, daemon_line_t *line)
+{
+    ssize_t n;
+
+    if (line->len == sizeof(line->buf)) {
+        return -1;
+    }
+
+    do {
+        n = read(fd, line->buf + line->len, sizeof(line->buf) - line->len);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        return -1;
+    }
+
+    line->len += (uint32_t)n;
+    return 0;
+}
+
+/*
+ * Return the next whole line, without its '\n', or NULL. It is valid until
+ * the next call.
+ */
+static char *daemon_next(daemon_line_t *line)
+{
+    char *end = NULL;
+    char *s = NULL;
+
+    end = memchr(line->buf + line->start, '\n', line->len - line->start);
+    if (end == NULL) {
+        memmove(line->buf, line->buf + line->start, line->len - line->start);
+        line->len -= line->start;
+        line->start = 0;
+        return NULL;
+    }
+
+    *end = '\0';
+    s = line->buf + line->start;
+    line->start = (uint32_t)(end - line->buf) + 1;
+
+    return s;
+}
+
+static int daemon_words(char *line, char **words)
+{
+    int n = 0;
+    char *save = NULL;
+    char *word = NULL;
+
+    for (word = strtok_r(line, " \t\r", &save); word && n < DAEMON_MAX_WORDS;
+         word = strtok_r(NULL, " \t\r", &save)) {
+        words[n++] = word;
+    }
+    words[n] = NULL;
+
+    return n;
+}
+
+static void daemon_send(daemon_t *daemon, int client, const char *fmt, ...)
+{
+    va_list args;
+    int fd;
+
+    if (client < 0 || daemon->client[client].fd < 0) {
+        return;
+    }
+
+    fd = daemon->client[client].fd;
+
+    va_start(args, fmt);
+    vdprintf(fd, fmt, args);
+    va_end(args);
+}
+
+static void daemon_accept(daemon_t *daemon)
+{
+    int i;
+    int fd;
+
+    fd = accept(daemon->fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+
+    for (i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        if (daemon->client[i].fd < 0) {
+            memset(&daemon->client[i], 0, sizeof(daemon->client[i]));
+            daemon->client[i].fd = fd;
+            return;
+        }
+    }
+
+    dprintf(fd, "error too many clients\n");
+    close(fd);
+}
+
+/*
+ * Take the jobs of the client. The jobs of a client gone are run still,
+ * a programming is not left half done.
+ */
+static void daemon_client(daemon_t *daemon, int index)
+{
+    int i;
+    char *s = NULL;
+    daemon_client_t *client = &daemon->client[index];
+    daemon_job_t *job = NULL;
+
+    if (daemon_read(client->fd, &client->line) != 0) {
+        close(client->fd);
+        client->fd = -1;
+
+        for (job = daemon->queue; job; job = job->next) {
+            if (job->client == index) {
+                job->client = -1;
+            }
+        }
+        for (i = 0; i < daemon->workers; i++) {
+            if (daemon->worker[i].job && daemon->worker[i].job->client == index) {
+                daemon->worker[i].job->client = -1;
+            }
+        }
+        return;
+    }
+
+    while ((s = daemon_next(&client->line)) != NULL) {
+        daemon_job(daemon, index, s);
+    }
+}
+
+static void daemon_job(daemon_t *daemon, int client, const char *line)
+{
+    int n;
+    uint32_t ahead = 0;
+    char copy[DAEMON_LINE_MAX];
+    char *words[DAEMON_MAX_WORDS + 1];
+    daemon_job_t *job = NULL;
+    daemon_job_t **tail = NULL;
+
+    strcpy(copy, line);
+    n = daemon_words(copy, words);
+    if (n == 0) {
+        return;
+    }
+
+    if (!((strcmp(words[0], "program") == 0 && n >= 3) ||
+          (strcmp(words[0], "read") == 0 && n >= 4) ||
+          (strcmp(words[0], "crc") == 0 && n >= 4) ||
+          (strcmp(words[0], "audit") == 0 && n >= 3) ||
+          (strcmp(words[0], "close") == 0 && n >= 2)) ||
+        strlen(words[1]) >= PATH_MAX) {
+        daemon_send(daemon, client, "error bad job: %s\n", line);
+        return;
+    }
+
+    job = calloc(1, sizeof(*job));
+    if (job == NULL) {
+        daemon_send(daemon, client, "error out of memory\n");
+        return;
+    }
+
+    job->id = ++daemon->id;
+    job->client = client;
+    job->queued_ms = daemon_ms();
+    strcpy(job->tty, words[1]);
+    strcpy(job->line, line);
+
+    for (tail = &daemon->queue; *tail; tail = &(*tail)->next) {
+        ahead++;
+    }
+    *tail = job;
+
+    daemon_send(daemon, client, "queued %u %u\n", job->id, ahead);
+}
+
+/*
+ * Pass the answers of the worker to the client of its job. At the end of
+ * its output the worker is gone, its job fails.
+ */
+static void daemon_answer(daemon_t *daemon, daemon_worker_t *worker)
+{
+    char *s = NULL;
+    daemon_job_t *job = worker->job;
+
+    if (daemon_read(worker->out, &worker->line) != 0) {
+        log("** Worker of %s is gone!\n", worker->tty);
+        if (job) {
+            daemon_send(daemon, job->client, "done %u -1 0\n", job->id);
+            free(job);
+            worker->job = NULL;
+        }
+        daemon_retire(daemon, worker);
+        return;
+    }
+
+    while ((s = daemon_next(&worker->line)) != NULL) {
+        if (job) {
+            daemon_send(daemon, job->client, "%s\n", s);
+        }
+        if (job && strncmp(s, "done ", 5) == 0) {
+            free(job);
+            job = worker->job = NULL;
+        }
+    }
+}
+
+/*
+ * Start the first queued job of each tty whose worker is idle. A tty
+ * without a worker gets one if there is room, or the place of an idle
+ * worker no job waits for.
+ */
+static void daemon_dispatch(daemon_t *daemon)
+{
+    int i;
+    daemon_job_t *job = NULL;
+    daemon_job_t *prev = NULL;
+    daemon_job_t **link = NULL;
+    daemon_worker_t *worker = NULL;
+    int first;
+
+    link = &daemon->queue;
+    while ((job = *link) != NULL) {
+        /* The jobs of a tty run in order. */
+        first = 1;
+        for (prev = daemon->queue; prev != job; prev = prev->next) {
+            if (strcmp(prev->tty, job->tty) == 0) {
+                first = 0;
+                break;
+            }
+        }
+
+        worker = NULL;
+        for (i = 0; first && i < daemon->workers; i++) {
+            if (strcmp(daemon->worker[i].tty, job->tty) == 0) {
+                worker = &daemon->worker[i];
+                break;
+            }
+        }
+
+        if (first && worker == NULL && daemon->workers == daemon->config.workers) {
+            for (i = 0; i < daemon->workers; i++) {
+                if (daemon->worker[i].job) {
+                    continue;
+                }
+                for (prev = daemon->queue; prev; prev = prev->next) {
+                    if (strcmp(prev->tty, daemon->worker[i].tty) == 0) {
+                        break;
+                    }
+                }
+                if (prev == NULL) {
+                    daemon_retire(daemon, &daemon->worker[i]);
+                    break;
+                }
+            }
+        }
+
+        if (first && worker == NULL && daemon->workers < daemon->config.workers &&
+            daemon_spawn(daemon, job->tty) == 0) {
+            worker = &daemon->worker[daemon->workers - 1];
+        }
+
+        if (worker == NULL || worker->job) {
+            link = &job->next;
+            continue;
+        }
+
+        *link = job->next;
+        job->next = NULL;
+        worker->job = job;
+        dprintf(worker->in, "%u %u %s\n", job->id, (uint32_t)(daemon_ms() - job->queued_ms),
+                job->line);
+    }
+}
+
+static int daemon_spawn(daemon_t *daemon, const char *tty)
+{
+    int in[2], out[2];
+    pid_t pid;
+    daemon_worker_t *worker = &daemon->worker[daemon->workers];
+
+    if (pipe(in) != 0) {
+        return -1;
+    }
+    if (pipe(out) != 0) {
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+
+    memset(worker, 0, sizeof(*worker));
+    strcpy(worker->tty, tty);
+    worker->in = in[1];
+    worker->out = out[0];
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        log("Starting worker of %s failed! %s\n", tty, strerror(errno));
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        close(in[1]);
+        close(out[0]);
+        worker->in = in[0];
+        worker->out = out[1];
+        daemon_worker(daemon, worker);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    close(in[0]);
+    close(out[1]);
+    worker->pid = pid;
+    daemon->workers++;
+
+    log("Worker %d of %s started.\n", (int)pid, tty);
+
+    return 0;
+}
+
+/*
+ * End the input of the worker, it closes its session and exits.
+ */
+static void daemon_retire(daemon_t *daemon, daemon_worker_t *worker)
+{
+    int index = (int)(worker - daemon->worker);
+
+    close(worker->in);
+    close(worker->out);
+
+    log("Worker %d of %s retired.\n", (int)worker->pid, worker->tty);
+
+    memmove(worker, worker + 1, (size_t)(daemon->workers - index - 1) * sizeof(*worker));
+    daemon->workers--;
+}
+
+/*
+ * The worker process of one tty. It runs a job at a time, and closes a kept
+ * session after idle_ms without one.
+ */
+static void daemon_worker(daemon_t *daemon, daemon_worker_t *worker)
+{
+    int i;
+    int in = worker->in;
+    int out = worker->out;
+    int count = daemon->config.images;
+    uint32_t clock = 0;
+    char *tty = NULL;
+    char *s = NULL;
+    daemon_line_t line;
+    daemon_image_t *images = NULL;
+    struct pollfd fd;
+
+    /* Only the pipes of this worker are kept, the daemon stops it. */
+    close(daemon->fd);
+    for (i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        if (daemon->client[i].fd >= 0) {
+            close(daemon->client[i].fd);
+        }
+    }
+    for (i = 0; i < daemon->workers; i++) {
+        close(daemon->worker[i].in);
+        close(daemon->worker[i].out);
+    }
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+
+    tty = strdup(worker->tty);
+    images = calloc((size_t)count, sizeof(*images));
+    if (tty == NULL || images == NULL) {
+        log("Allocating worker error.\n");
+        return;
+    }
+
+    bsl430_uart_port(tty);
+    memset(&line, 0, sizeof(line));
+
+    for (;;) {
+        fd.fd = in;
+        fd.events = POLLIN;
+        i = poll(&fd, 1, (bsl430_session_state() != BSL430_SESSION_CLOSED)?
+                         (int)daemon->config.idle_ms: -1);
+        if (i < 0 && errno == EINTR) {
+            continue;
+        }
+        if (i == 0) {
+            log("%s idle, session closed.\n", tty);
+            bsl430_session_close();
+            continue;
+        }
+
+        if (daemon_read(in, &line) != 0) {
+            break;
+        }
+
+        while ((s = daemon_next(&line)) != NULL) {
+            daemon_worker_job(out, s, images, count, &clock);
+        }
+    }
+
+    bsl430_session_close();
+
+    for (i = 0; i < count; i++) {
+        free(images[i].header);
+        if (images[i].header) {
+            bsl430_stream_free(&images[i].stream);
+        }
+    }
+    free(images);
+    free(tty);
+}
+
+/*
+ * Run one job, "<id> <wait ms> <job words>", and answer.
+ */
+static int daemon_worker_job(int out, char *line, daemon_image_t *images, int count,
+                             uint32_t *clock)
+{
+    int status = 0;
+    int i, n;
+    uint32_t id;
+    uint32_t address = 0, size = 0;
+    uint16_t crc = 0;
+    uint64_t start = daemon_ms();
+    int keep = 0;
+    int flags = 0;
+    char *words[DAEMON_MAX_WORDS + 1];
+    const char *unlock = NULL;
+    daemon_image_t *image = NULL;
+    daemon_image_t *previous = NULL;
+    bsl430_program_config_t config;
+    daemon_progress_t progress;
+    bsl430_audit_t audit;
+    char report[512];
+    uint8_t password[32];
+    uint8_t *buf = NULL;
+    bsl430_patch_edit_t edit[BSL430_PATCH_MAX_EDITS];
+    uint8_t edit_data[BSL430_PATCH_MAX_EDITS][BSL430_PATCH_MAX_SIZE];
+    uint32_t edits = 0;
+    bsl430_patch_t patch;
+
+    n = daemon_words(line, words);
+    if (n < 4) {
+        return -1;
+    }
+
+    id = (uint32_t)strtoul(words[0], NULL, 10);
+    memset(&config, 0, sizeof(config));
+    memset(&patch, 0, sizeof(patch));
+
+    for (i = 4; i < n; i++) {
+        if (strcmp(words[i], "keep") == 0) {
+            keep = 1;
+        } else if (strcmp(words[i], "optimize") == 0) {
+            config.optimize = 1;
+        } else if (strcmp(words[i], "unlock") == 0) {
+            flags |= BSL430_AUDIT_UNLOCK;
+        } else if (strncmp(words[i], "cache=", 6) == 0) {
+            config.cache = words[i] + 6;
+        } else if (strncmp(words[i], "journal=", 8) == 0) {
+            config.journal = words[i] + 8;
+        } else if (strncmp(words[i], "previous=", 9) == 0) {
+            previous = daemon_image(images, count, clock, words[i] + 9);
+        } else if (strncmp(words[i], "image=", 6) == 0) {
+            unlock = words[i] + 6;
+        } else if (strncmp(words[i], "patch=", 6) == 0) {
+            if (edits >= BSL430_PATCH_MAX_EDITS ||
+                bsl430_patch_parse(words[i] + 6, &edit[edits], edit_data[edits],
+                                   BSL430_PATCH_MAX_SIZE) != 0) {
+                log("** Bad %s, ADDR:HEX up to %u Bytes.\n", words[i], BSL430_PATCH_MAX_SIZE);
+                status = -1;
+                break;
+            }
+            edits++;
+        }
+    }
+
+    dprintf(out, "start %u %s %s\n", id, words[1],
+            (bsl430_session_state() != BSL430_SESSION_CLOSED)? "warm": "cold");
+
+    if (status != 0) {
+        goto done;
+    }
+
+    if (strcmp(words[2], "program") == 0) {
+        image = (n > 4)? daemon_image(images, count, clock, words[4]): NULL;
+        if (image == NULL) {
+            status = -1;
+            goto done;
+        }
+
+        /* The cached image is shared by the jobs, the unit's bytes go over a copy. */
+        if (edits > 0) {
+            status = bsl430_patch_apply(image->header, &image->stream, edit, edits, &patch);
+            if (status != 0) {
+                goto done;
+            }
+        }
+
+        config.stream = (edits > 0)? &patch.stream: &image->stream;
+        config.previous = (previous)? previous->header: NULL;
+        /* The session is the worker's, so that it may be kept. */
+        if (bsl430_session_state() == BSL430_SESSION_CLOSED) {
+            status = bsl430_session_open(115200);
+            if (status != 0) {
+                goto done;
+            }
+        }
+
+        progress.fd = out;
+        progress.id = id;
+        config.progress = daemon_progress;
+        config.progress_arg = &progress;
+
+        status = bsl430_program_ex((edits > 0)? patch.header: image->header, &config);
+        goto done;
+    }
+
+    if (strcmp(words[2], "audit") == 0) {
+        image = (n > 4)? daemon_image(images, count, clock, words[4]): NULL;
+        if (image == NULL) {
+            status = -1;
+            goto done;
+        }
+
+        status = bsl430_audit(image->header, flags, &audit);
+        bsl430_audit_report(words[3], &audit, report, sizeof(report));
+        dprintf(out, "audit %u %s\n", id, report);
+        goto done;
+    }
+
+    if (strcmp(words[2], "close") == 0) {
+        keep = 0;
+        goto done;
+    }
+
+    /* read and crc */
+    address = (uint32_t)strtoul(words[4], NULL, 16);
+    size = (n > 5)? (uint32_t)strtoul(words[5], NULL, 0): 0;
+    if (size == 0 || size > DAEMON_READ_MAX) {
+        log("** Bad size, 1 to %u Bytes.\n", DAEMON_READ_MAX);
+        status = -1;
+        goto done;
+    }
+
+    if (bsl430_session_state() != BSL430_SESSION_UNLOCKED) {
+        image = (unlock)? daemon_image(images, count, clock, unlock): NULL;
+        if (image == NULL) {
+            log("** No session unlocked and no image to unlock by.\n");
+            status = -1;
+            goto done;
+        }
+
+        bsl430_ti_txt_password(image->header, password);
+        if (bsl430_session_state() == BSL430_SESSION_CLOSED) {
+            status = bsl430_session_open(115200);
+        }
+        if (status == 0) {
+            status = bsl430_session_unlock(password, NULL);
+        }
+        if (status != 0) {
+            goto done;
+        }
+    }
+
+    if (strcmp(words[2], "crc") == 0) {
+        status = bsl430_session_crc(address, (uint16_t)size, &crc);
+        if (status == 0) {
+            dprintf(out, "crc %u %04X\n", id, crc);
+        }
+        goto done;
+    }
+
+    /* The data, then its hex line. */
+    buf = malloc(size + size * 3);
+    if (buf == NULL) {
+        status = -1;
+        goto done;
+    }
+
+    status = bsl430_session_read(address, buf, (uint16_t)size);
+    if (status == 0) {
+        for (i = 0; i < (int)size; i++) {
+            snprintf((char *)&buf[size + i * 3], 4, "%02X ", buf[i]);
+        }
+        buf[size + size * 3 - 1] = '\0';
+        dprintf(out, "data %u %s\n", id, (char *)&buf[size]);
+    }
+    free(buf);
+
+done:
+    bsl430_patch_free(&patch);
+
+    /* The device state is not known after a failure. */
+    if (!keep || status != 0) {
+        bsl430_session_close();
+    }
+
+    dprintf(out, "done %u %d %u\n", id, status, (uint32_t)(daemon_ms() - start));
+
+    return status;
+}
+
+/*
+ * The image of the path, parsed and encoded, from the cache or else into
+ * the place of the least recently used one.
+ */
+static daemon_image_t *daemon_image(daemon_image_t *images, int count, uint32_t *clock,
+                                   const char *path)
+{
+    int i;
+    struct stat st;
+    daemon_image_t *image = NULL;
+    daemon_image_t *lru = &images[0];
+
+    if (stat(path, &st) != 0) {
+        log("** %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++) {
+        image = &images[i];
+        if (image->header && strcmp(image->path, path) == 0 && image->dev == st.st_dev &&
+            image->ino == st.st_ino && image->size == st.st_size &&
+            image->mtime == st.st_mtime) {
+            image->used = ++*clock;
+            debug("Image %s cached.\n", path);
+            return image;
+        }
+        if (image->used < lru->used) {
+            lru = image;
+        }
+    }
+
+    image = lru;
+    if (image->header) {
+        debug("Image %s evicted.\n", image->path);
+        bsl430_stream_free(&image->stream);
+        free(image->header);
+        image->header = NULL;
+    }
+
+    if (strlen(path) >= sizeof(image->path)) {
+        return NULL;
+    }
+
+    image->header = bsl430_ti_txt_load(path, BSL430_MAX_CODE_SIZE);
+    if (image->header == NULL) {
+        return NULL;
+    }
+
+    if (bsl430_stream_encode(image->header, &image->stream) != 0) {
+        free(image->header);
+        image->header = NULL;
+        return NULL;
+    }
+
+    strcpy(image->path, path);
+    image->dev = st.st_dev;
+    image->ino = st.st_ino;
+    image->size = st.st_size;
+    image->mtime = st.st_mtime;
+    image->used = ++*clock;
+
+    log("Image %s loaded, %u segments.\n", path, image->header->segments);
+
+    return image;
+}
+
+static void daemon_progress(uint32_t done, uint32_t total, void *arg)
+{
+    daemon_progress_t *progress = arg;
+
+    dprintf(progress->fd, "progress %u %u %u\n", progress->id, done, total);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_DAEMON_H__
+#define __BSL430_DAEMON_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Flashing daemon
+ *
+ * bsl430_daemon_run() serves jobs on a Unix socket until SIGINT or SIGTERM.
+ * A job is one line of words, the command and the tty first:
+ *
+ *      program <tty> <TI-TXT file> [keep] [optimize] [cache=FILE]
+ *                                  [previous=FILE] [journal=FILE]
+ *                                  [patch=ADDR:HEX]...
+ *      read <tty> <address> <size> [keep] [image=FILE]
+ *      crc <tty> <address> <size> [keep] [image=FILE]
+ *      audit <tty> <TI-TXT file> [keep] [unlock]
+ *      close <tty>
+ *
+ * and it is answered by lines of the job id on the same connection:
+ *
+ *      queued <id> <jobs ahead>
+ *      start <id> <wait ms> <warm|cold>
+ *      progress <id> <bytes done> <bytes in all>
+ *      data <id> <hex bytes>                   of read
+ *      crc <id> <crc>                          of crc
+ *      audit <id> <JSON report>                of audit, see bsl430-audit.h
+ *      done <id> <status> <ms>
+ *      error <reason>                          the job is not taken
+ *
+ * Each tty is driven by a worker process of its own, as the platform layer
+ * is process wide, see bsl430-platform.h. Up to <workers> ttys are served
+ * at once and the jobs of one tty run in order. An idle worker is retired
+ * when another tty needs its place. The ttys need RST/TST lines of their
+ * own for that, i.e. the MODEM backend, see bsl430_gpio_per_port(); with
+ * shared lines the daemon runs one worker.
+ *
+ * A worker keeps the images it programs parsed and encoded into a stream
+ * in an LRU cache of <images> entries, checked against the file by its
+ * inode, size and time of modification.
+ *
+ * A job with keep leaves the session open at 115200 after it, see
+ * bsl430-session.h, and the next job on the tty runs in it without
+ * entering the BSL ("warm"). The session is closed, and the device runs
+ * its code, after the next job without keep, on close, on a failure, or
+ * after <idle_ms> without jobs. read and crc need an unlocked session, or
+ * the image whose vector table unlocks the device.
+ *
+ * A job with optimize programs by the fastest strategy, see
+ * bsl430-strategy.h. The cost model is the worker's, measured on its tty
+ * over the jobs.
+ *
+ * A job with patch words writes the bytes of each, hex, at ADDR over the
+ * cached image, e.g. the serial number of the unit. Only the frames they
+ * touch are encoded again, see bsl430-patch.h.
+ */
+
+#define BSL430_DAEMON_MAX_WORKERS   16
+
+typedef struct bsl430_daemon_config_s {
+    const char *socket;     /* path of the Unix socket */
+    int workers;            /* ttys served at once, 0: 4, 1 with shared lines */
+    int images;             /* images cached per worker, 0: 8 */
+    uint32_t idle_ms;       /* a kept session is closed after, 0: 5000 */
+} bsl430_daemon_config_t;
+
+int bsl430_daemon_run(const bsl430_daemon_config_t *config);
+int bsl430_daemon_submit(const char *socket, const char *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_DAEMON_H__ */
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-journal"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-journal.h"
+
+#define JOURNAL_LINE_SIZE   128
+
+static int journal_update(const char *path, const bsl430_journal_t *entry, int remove);
+
+int bsl430_journal_load(const char *path, bsl430_journal_t *entry)
+{
+    FILE *fp = NULL;
+    char line[JOURNAL_LINE_SIZE];
+    bsl430_journal_t record;
+    int status = -1;
+
+    if (!path || !entry || entry->device[0] == '\0') {
+        return -1;
+    }
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        memset(&record, 0, sizeof(record));
+        if (sscanf(line, "%32s %x %u %u", record.device, &record.image,
+                   &record.segment, &record.offset) != 4) {
+            continue;
+        }
+
+        if (strcmp(record.device, entry->device) == 0 && record.image == entry->image) {
+            entry->segment = record.segment;
+            entry->offset  = record.offset;
+            status = 0;
+            break;
+        }
+    }
+
+    fclose(fp);
+    return status;
+}
+
+int bsl430_journal_save(const char *path, const bsl430_journal_t *entry)
+{
+    return journal_update(path, entry, 0);
+}
+
+int bsl430_journal_remove(const char *path, const bsl430_journal_t *entry)
+{
+    return journal_update(path, entry, 1);
+}
+
+/*
+ * Rewrite the journal into a temporary file and rename it over the old one,
+ * so an interrupted update never leaves a torn record behind.
+ */
+static int journal_update(const char *path, const bsl430_journal_t *entry, int remove)
+{
+    FILE *in = NULL;
+    FILE *out = NULL;
+    char *tmp = NULL;
+    char line[JOURNAL_LINE_SIZE];
+    char device[sizeof(entry->device)];
+    uint32_t image = 0;
+    int status = 0;
+
+    if (!path || !entry) {
+        return -1;
+    }
+
+    tmp = malloc(strlen(path) + 5);
+    if (tmp == NULL) {
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", path);
+
+    out = fopen(tmp, "w");
+    if (out == NULL) {
+        log("** Open journal failed! %s\n", tmp);
+        free(tmp);
+        return -1;
+    }
+
+    in = fopen(path, "r");
+    if (in != NULL) {
+        while (fgets(line, sizeof(line), in)) {
+            if (sscanf(line, "%32s %x", device, &image) == 2 &&
+                strcmp(device, entry->device) == 0 && image == entry->image) {
+                continue;
+            }
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+
+    if (!remove) {
+        fprintf(out, "%s %08X %u %u\n", entry->device, entry->image,
+                entry->segment, entry->offset);
+    }
+
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0) {
+        status = -1;
+    }
+    fclose(out);
+
+    if (status == 0 && rename(tmp, path) != 0) {
+        status = -1;
+    }
+
+    if (status != 0) {
+        log("** Update journal failed! %s\n", path);
+        unlink(tmp);
+    }
+
+    free(tmp);
+    return status;
+}
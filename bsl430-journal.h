@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_JOURNAL_H__
+#define __BSL430_JOURNAL_H__
+
+#include <stdint.h>
+
+#include "bsl430.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * One record per device and image:
+ *      <device id> <image hash> <segment> <offset>
+ *
+ * Segments before <segment> and the first <offset> bytes of <segment>
+ * have been written and acknowledged by the BSL.
+ *
+ * bsl430_journal_load() looks up the record by device and image, there is
+ * none for an empty device.
+ *
+ * bsl430_journal_save() rewrites and syncs the file, the programming saves
+ * every BSL430_JOURNAL_BLOCKS blocks and at the end of each segment.
+ */
+#define BSL430_JOURNAL_BLOCKS   16
+
+typedef struct bsl430_journal_s {
+    char     device[BSL430_DEVICE_ID_SIZE * 2 + 1];
+    uint32_t image;
+    uint32_t segment;
+    uint32_t offset;
+} bsl430_journal_t;
+
+int bsl430_journal_load(const char *path, bsl430_journal_t *entry);
+int bsl430_journal_save(const char *path, const bsl430_journal_t *entry);
+int bsl430_journal_remove(const char *path, const bsl430_journal_t *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_JOURNAL_H__ */
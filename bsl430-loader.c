@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-loader"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "bsl430-platform.h"
+#include "bsl430.h"
+#include "bsl430-loader.h"
+#include "bsl430-trace.h"
+
+#define HEAD    0x80
+#define INITFCS 0xFFFF
+#define ACK     0x00
+
+#define CHAR_TIMEOUT    10  /* ms */
+#define RESP_TIMEOUT   100  /* ms */
+
+/* Time for the loader to set up its UART after LOAD_PC. */
+#define LOADER_START_DELAY  10  /* ms */
+
+/* Header + NL NH + Payload + CKL CKH */
+#define LOADER_MAX_FRAME_SIZE   (1 + 2 + BSL430_LOADER_MAX_PAYLOAD + 2)
+
+static uint16_t loader_block = BSL430_LOADER_BLOCK;
+/* The pacing of the ROM BSL while the loader runs, -1 if it doesn't. */
+static int loader_pacing = -1;
+
+static int loader_send(const uint8_t *payload, uint16_t len);
+static int loader_recv(uint8_t *payload, uint16_t size, int resp, uint16_t timeout);
+static int loader_ack(uint8_t seq);
+static void loader_restore(void);
+
+int bsl430_loader_start(titxt_header_t *loader, uint32_t entry, uint32_t baudrate)
+{
+    int status = 0;
+    uint32_t i;
+    titxt_segment_t *segment = NULL;
+    uint8_t payload[8];
+
+    if (!loader || loader->segments == 0) {
+        return -1;
+    }
+
+    /* Download the loader into RAM. */
+    for (i = 0; i < loader->segments; i++) {
+        segment = bsl430_ti_txt_segment(loader, segment);
+        if (i == 0 && entry == 0) {
+            entry = segment->address;
+        }
+
+        status = bsl430_cmd_rx_data_block(segment->address, segment->data, segment->size);
+        if (status != 0) {
+            log("** Downloading loader failed! 0x%02X\n", (uint8_t)status);
+            return status;
+        }
+    }
+
+    log("LOAD_PC: @%04X\n", entry);
+
+    status = bsl430_cmd_load_pc(entry);
+    if (status != 0) {
+        return status;
+    }
+
+    /* The loader receives without the ONE-byte FIFO limit. */
+    if (loader_pacing < 0) {
+        loader_pacing = bsl430_uart_set_pacing(BSL430_PACING_NONE);
+    }
+    bsl430_uart_init(115200, 0);
+
+    mdelay(LOADER_START_DELAY);
+
+    payload[0] = BSL430_LOADER_CMD_SYNC;
+    loader_send(payload, 1);
+
+    status = loader_recv(payload, sizeof(payload), 1, RESP_TIMEOUT);
+    if (status < 4 || payload[0] != BSL430_LOADER_RESP_DATA) {
+        log("** Loader SYNC failed!\n");
+        loader_restore();
+        return -1;
+    }
+
+    loader_block = (uint16_t)payload[2] << 0 | (uint16_t)payload[3] << 8;
+    if (loader_block == 0 || loader_block > BSL430_LOADER_BLOCK) {
+        loader_block = BSL430_LOADER_BLOCK;
+    }
+
+    log("Loader Version: %02X, Block %u Bytes\n", payload[1], loader_block);
+
+    if (baudrate != 0 && baudrate != 115200) {
+        payload[0] = BSL430_LOADER_CMD_BAUDRATE;
+        payload[1] = (uint8_t)(baudrate >>  0 & 0xFF);
+        payload[2] = (uint8_t)(baudrate >>  8 & 0xFF);
+        payload[3] = (uint8_t)(baudrate >> 16 & 0xFF);
+        payload[4] = (uint8_t)(baudrate >> 24 & 0xFF);
+        loader_send(payload, 5);
+
+        status = loader_recv(payload, sizeof(payload), 0, RESP_TIMEOUT);
+        if (status != 0) {
+            log("** Loader baudrate failed!\n");
+            loader_restore();
+            return -1;
+        }
+
+        log("Change baudrate to %u.\n", baudrate);
+        if (bsl430_uart_init((int)baudrate, 0) != 0) {
+            loader_restore();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int bsl430_loader_write(uint32_t address, const uint8_t *data, uint32_t size)
+{
+    int status = 0;
+    uint8_t payload[BSL430_LOADER_MAX_PAYLOAD];
+    uint16_t write_size = 0;
+    int len = 0;
+    uint8_t seq = 0;
+    int inflight = 0;
+
+    if (!data) {
+        return -1;
+    }
+
+    while (size > 0) {
+        write_size = (size > loader_block)? loader_block: (uint16_t)size;
+
+        payload[0] = BSL430_LOADER_CMD_WRITE;
+        payload[1] = seq;
+        payload[2] = (uint8_t)(address >>  0 & 0xFF);
+        payload[3] = (uint8_t)(address >>  8 & 0xFF);
+        payload[4] = (uint8_t)(address >> 16 & 0xFF);
+
+        len = bsl430_loader_rle(data, write_size, &payload[6], write_size);
+        if (len > 0) {
+            payload[5] = BSL430_LOADER_RLE;
+        } else {
+            payload[5] = BSL430_LOADER_RAW;
+            memcpy(&payload[6], data, write_size);
+            len = write_size;
+        }
+
+        debug("LDR_WRITE: @%04X %4u Bytes, %4d on wire\n", address, write_size, len);
+
+        /* Keep up to a window of blocks in flight. */
+        if (inflight == BSL430_LOADER_WINDOW) {
+            status = loader_ack((uint8_t)(seq - inflight));
+            if (status != 0) {
+                return status;
+            }
+            inflight--;
+        }
+
+        loader_send(payload, (uint16_t)(6 + len));
+        inflight++;
+        seq++;
+
+        address += write_size;
+        data    += write_size;
+        size    -= write_size;
+    }
+
+    while (inflight > 0) {
+        status = loader_ack((uint8_t)(seq - inflight));
+        if (status != 0) {
+            return status;
+        }
+        inflight--;
+    }
+
+    return 0;
+}
+
+int bsl430_loader_crc(uint32_t address, uint32_t size, uint16_t *crc)
+{
+    int status = 0;
+    uint8_t payload[8];
+
+    if (!crc) {
+        return -1;
+    }
+
+    payload[0] = BSL430_LOADER_CMD_CRC;
+    payload[1] = (uint8_t)(address >>  0 & 0xFF);
+    payload[2] = (uint8_t)(address >>  8 & 0xFF);
+    payload[3] = (uint8_t)(address >> 16 & 0xFF);
+    payload[4] = (uint8_t)(size >>  0 & 0xFF);
+    payload[5] = (uint8_t)(size >>  8 & 0xFF);
+    payload[6] = (uint8_t)(size >> 16 & 0xFF);
+    loader_send(payload, 7);
+
+    status = loader_recv(payload, sizeof(payload), 1, RESP_TIMEOUT);
+    if (status < 3 || payload[0] != BSL430_LOADER_RESP_DATA) {
+        log("** LDR_CRC failed!\n");
+        return -1;
+    }
+
+    *crc = (uint16_t)payload[1] << 0 |
+           (uint16_t)payload[2] << 8;
+
+    return 0;
+}
+
+int bsl430_loader_exit(void)
+{
+    int status = 0;
+    uint8_t payload[1];
+
+    payload[0] = BSL430_LOADER_CMD_EXIT;
+    loader_send(payload, 1);
+
+    status = loader_recv(payload, sizeof(payload), 0, RESP_TIMEOUT);
+
+    loader_restore();
+
+    return status;
+}
+
+/*
+ * Give up on the loader after a failure. The UART is paced for the ROM BSL
+ * again, the device stays in the loader until the next entry resets it.
+ */
+void bsl430_loader_abort(void)
+{
+    loader_restore();
+}
+
+int bsl430_loader_rle(const uint8_t *data, uint32_t size, uint8_t *buf, uint32_t bufsize)
+{
+    uint32_t i = 0;
+    uint32_t n = 0;
+    uint32_t run, lit;
+
+    while (i < size) {
+        run = 1;
+        while (i + run < size && run < 130 && data[i + run] == data[i]) {
+            run++;
+        }
+
+        if (run >= 3) {
+            if (n + 2 > bufsize) {
+                return -1;
+            }
+            buf[n++] = (uint8_t)(0x80 + run - 3);
+            buf[n++] = data[i];
+            i += run;
+        } else {
+            /* Literals up to the next run of three. */
+            lit = 0;
+            while (i + lit < size && lit < 128) {
+                if (i + lit + 2 < size &&
+                    data[i + lit] == data[i + lit + 1] &&
+                    data[i + lit] == data[i + lit + 2]) {
+                    break;
+                }
+                lit++;
+            }
+
+            if (n + 1 + lit > bufsize) {
+                return -1;
+            }
+            buf[n++] = (uint8_t)(lit - 1);
+            memcpy(&buf[n], &data[i], lit);
+            n += lit;
+            i += lit;
+        }
+    }
+
+    return (int)n;
+}
+
+/*
+ * The loader side of bsl430_loader_rle(). Return the decoded length, or -1
+ * if it doesn't fit <buf> or <data> is cut short.
+ */
+int bsl430_loader_unrle(const uint8_t *data, uint32_t size, uint8_t *buf, uint32_t bufsize)
+{
+    uint32_t i = 0;
+    uint32_t n = 0;
+    uint32_t count;
+
+    while (i < size) {
+        if (data[i] < 0x80) {
+            count = (uint32_t)data[i] + 1;
+            if (i + 1 + count > size || n + count > bufsize) {
+                return -1;
+            }
+            memcpy(&buf[n], &data[i + 1], count);
+            i += 1 + count;
+        } else {
+            count = (uint32_t)data[i] - 0x80 + 3;
+            if (i + 2 > size || n + count > bufsize) {
+                return -1;
+            }
+            memset(&buf[n], data[i + 1], count);
+            i += 2;
+        }
+        n += count;
+    }
+
+    return (int)n;
+}
+
+static int loader_send(const uint8_t *payload, uint16_t len)
+{
+    uint8_t buf[LOADER_MAX_FRAME_SIZE];
+    uint16_t fcs;
+    int n = 0;
+
+    fcs = bsl430_crc16(payload, len, INITFCS);
+
+    buf[n++] = HEAD;
+    buf[n++] = (uint8_t)(len >> 0 & 0x00FF);
+    buf[n++] = (uint8_t)(len >> 8 & 0x00FF);
+
+    memcpy(&buf[n], payload, len);
+    n += len;
+
+    buf[n++] = (uint8_t)(fcs >> 0 & 0x00FF);
+    buf[n++] = (uint8_t)(fcs >> 8 & 0x00FF);
+
+    bsl430_trace_frame(BSL430_TRACE_FRAME_TX, 0, payload, len);
+
+    return bsl430_uart_write(buf, n);
+}
+
+/*
+ * Return the length of the response payload, 0 for an ACK only, or -1.
+ */
+static int loader_recv(uint8_t *payload, uint16_t size, int resp, uint16_t timeout)
+{
+    int c = -1;
+    int i;
+    uint16_t len;
+    uint16_t cks;
+
+    c = bsl430_uart_readb(timeout);
+    if (c != ACK) {
+        log("** Wrong ACK. 0x%02x\n", (uint8_t)c);
+        goto err_exit;
+    }
+
+    if (!resp) {
+        bsl430_trace_frame(BSL430_TRACE_FRAME_RX, 0, NULL, 0);
+        return 0;
+    }
+
+    c = bsl430_uart_readb(timeout);
+    if (c != HEAD) {
+        log("** Wrong head or timeout.\n");
+        goto err_exit;
+    }
+
+    len  = (uint16_t)(bsl430_uart_readb(CHAR_TIMEOUT) & 0xFF) << 0;
+    len |= (uint16_t)(bsl430_uart_readb(CHAR_TIMEOUT) & 0xFF) << 8;
+    if (len > size) {
+        log("** Wrong N. %u\n", len);
+        goto err_exit;
+    }
+
+    for (i = 0; i < len; i++) {
+        c = bsl430_uart_readb(CHAR_TIMEOUT);
+        if (c == -1) {
+            log("** Response data timeout. %d\n", i);
+            goto err_exit;
+        }
+        payload[i] = (uint8_t)c;
+    }
+
+    cks  = (uint16_t)(bsl430_uart_readb(CHAR_TIMEOUT) & 0xFF) << 0;
+    cks |= (uint16_t)(bsl430_uart_readb(CHAR_TIMEOUT) & 0xFF) << 8;
+    if (bsl430_crc16(payload, len, INITFCS) != cks) {
+        log("** CKS error.\n");
+        goto err_exit;
+    }
+
+    bsl430_trace_frame(BSL430_TRACE_FRAME_RX, 0, payload, len);
+
+    return len;
+
+err_exit:
+    bsl430_trace_frame(BSL430_TRACE_FRAME_RX, -1, NULL, 0);
+
+    bsl430_uart_drain(CHAR_TIMEOUT, timeout);
+
+    return -1;
+}
+
+static void loader_restore(void)
+{
+    if (loader_pacing >= 0) {
+        bsl430_uart_set_pacing(loader_pacing);
+        loader_pacing = -1;
+    }
+}
+
+static int loader_ack(uint8_t seq)
+{
+    int status = 0;
+    uint8_t payload[4];
+
+    status = loader_recv(payload, sizeof(payload), 1, RESP_TIMEOUT);
+    if (status < 3 || payload[0] != BSL430_LOADER_RESP_MSG) {
+        log("** LDR_WRITE no response! seq %u\n", seq);
+        return -1;
+    }
+
+    if (payload[1] != BSL430_MSG_SUCC || payload[2] != seq) {
+        log("** LDR_WRITE failed! 0x%02X seq %u/%u\n", payload[1], payload[2], seq);
+        return (payload[1] != BSL430_MSG_SUCC)? payload[1]: -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_LOADER_H__
+#define __BSL430_LOADER_H__
+
+#include <stdint.h>
+
+#include "bsl430-program.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Secondary loader protocol
+ *
+ * The loader is downloaded into RAM by RX_DATA_BLOCK and started by LOAD_PC.
+ * It keeps the framing of the BSL (ACK + 0x80 NL NH payload CKL CKH, with
+ * the same CRC-CCITT), but without the ONE-byte FIFO and the 256-byte limit:
+ *
+ *   LDR_SYNC      0x20                                 -> 0x3A VER BL BH
+ *                 BL BH is the largest block the loader accepts.
+ *   LDR_BAUDRATE  0x21 B0 B1 B2 B3                     -> ACK only
+ *                 Both sides switch after the ACK.
+ *   LDR_WRITE     0x22 SEQ AL AM AH METHOD D1...Dn     -> 0x3B MSG SEQ
+ *                 METHOD 0: raw, 1: RLE. The host keeps up to
+ *                 BSL430_LOADER_WINDOW blocks in flight.
+ *   LDR_CRC       0x23 AL AM AH SL SM SH               -> 0x3A CKL CKH
+ *   LDR_EXIT      0x24                                 -> ACK only
+ *
+ * RLE: a control byte C < 0x80 is followed by C + 1 literal bytes,
+ *      C >= 0x80 by one byte repeated C - 0x80 + 3 times.
+ */
+#define BSL430_LOADER_BLOCK     1024
+#define BSL430_LOADER_WINDOW    2
+
+#define BSL430_LOADER_CMD_SYNC      0x20
+#define BSL430_LOADER_CMD_BAUDRATE  0x21
+#define BSL430_LOADER_CMD_WRITE     0x22
+#define BSL430_LOADER_CMD_CRC       0x23
+#define BSL430_LOADER_CMD_EXIT      0x24
+
+#define BSL430_LOADER_RESP_DATA     0x3A
+#define BSL430_LOADER_RESP_MSG      0x3B
+
+#define BSL430_LOADER_RAW       0
+#define BSL430_LOADER_RLE       1
+
+/* CMD + SEQ + AL AM AH + METHOD + D1...Dn, RLE grows one byte per 128 at most. */
+#define BSL430_LOADER_MAX_PAYLOAD   (6 + BSL430_LOADER_BLOCK + BSL430_LOADER_BLOCK / 128 + 1)
+
+int bsl430_loader_start(titxt_header_t *loader, uint32_t entry, uint32_t baudrate);
+int bsl430_loader_write(uint32_t address, const uint8_t *data, uint32_t size);
+int bsl430_loader_crc(uint32_t address, uint32_t size, uint16_t *crc);
+int bsl430_loader_exit(void);
+void bsl430_loader_abort(void);
+
+int bsl430_loader_rle(const uint8_t *data, uint32_t size, uint8_t *buf, uint32_t bufsize);
+int bsl430_loader_unrle(const uint8_t *data, uint32_t size, uint8_t *buf, uint32_t bufsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_LOADER_H__ */
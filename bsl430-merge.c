@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-merge"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-merge.h"
+
+/* The 16 bit address space, the owner of each byte is the image + 1. */
+#define MERGE_SPACE         0x10000
+/* Conflicting bytes logged one by one. */
+#define MERGE_MAX_LOGGED    8
+
+#define MERGE_ALIGN(x)      (((x) + TITXT_SEGMENT_ALIGN - 1) & ~(TITXT_SEGMENT_ALIGN - 1))
+
+static const char *merge_name(const char *const *names, uint32_t i);
+
+titxt_header_t *bsl430_merge(titxt_header_t *const *images, const char *const *names,
+                             uint32_t count)
+{
+    uint32_t i, j, k;
+    uint32_t address, start;
+    uint32_t conflicts = 0, overlap = 0;
+    uint32_t segments = 0, bytes = 0, size = sizeof(titxt_header_t);
+    uint8_t *data = NULL;
+    uint8_t *owner = NULL;
+    uint8_t *buf = NULL;
+    titxt_header_t *header = NULL;
+    titxt_segment_t *seg = NULL;
+
+    if (!images || count == 0 || count > BSL430_MERGE_MAX_IMAGES) {
+        return NULL;
+    }
+
+    data = malloc(MERGE_SPACE);
+    owner = calloc(1, MERGE_SPACE);
+    if (!data || !owner) {
+        log("** Allocating merge failed!\n");
+        goto error0;
+    }
+
+    for (i = 0; i < count; i++) {
+        for (j = 0, seg = NULL; j < images[i]->segments; j++) {
+            seg = bsl430_ti_txt_segment(images[i], seg);
+
+            if (seg->address + seg->size > MERGE_SPACE) {
+                log("** %s: Segment @%04X %u Bytes is out of range!\n",
+                    merge_name(names, i), seg->address, seg->size);
+                goto error0;
+            }
+
+            for (k = 0; k < seg->size; k++) {
+                address = seg->address + k;
+                if (owner[address] == 0) {
+                    owner[address] = (uint8_t)(i + 1);
+                    data[address] = seg->data[k];
+                } else if (data[address] == seg->data[k]) {
+                    overlap++;
+                } else {
+                    if (conflicts++ < MERGE_MAX_LOGGED) {
+                        log("** @%04X: %02X of %s, %02X of %s!\n", address, data[address],
+                            merge_name(names, owner[address] - 1), seg->data[k],
+                            merge_name(names, i));
+                    }
+                }
+            }
+        }
+    }
+
+    if (conflicts > 0) {
+        log("** %u Bytes conflict, images not merged!\n", conflicts);
+        goto error0;
+    }
+
+    /* Runs of owned bytes are the segments, sized first for one allocation. */
+    for (address = 0; address < MERGE_SPACE; address = start) {
+        for (start = address; start < MERGE_SPACE && owner[start] == 0; start++) ;
+        for (address = start; address < MERGE_SPACE && owner[address] != 0; address++) ;
+        if (address > start) {
+            segments++;
+            bytes += address - start;
+            size += sizeof(titxt_segment_t) + MERGE_ALIGN(address - start);
+        }
+        start = address;
+    }
+
+    buf = calloc(1, size);
+    if (!buf) {
+        log("** Allocating merge failed!\n");
+        goto error0;
+    }
+
+    header = (titxt_header_t *)buf;
+    header->segments = segments;
+
+    seg = NULL;
+    for (address = 0; address < MERGE_SPACE; address = start) {
+        for (start = address; start < MERGE_SPACE && owner[start] == 0; start++) ;
+        for (address = start; address < MERGE_SPACE && owner[address] != 0; address++) ;
+        if (address > start) {
+            seg = bsl430_ti_txt_segment(header, seg);
+            seg->address = start;
+            seg->size = address - start;
+            memcpy(seg->data, &data[start], seg->size);
+        }
+        start = address;
+    }
+
+    log("Merge: %u images, %u segments, %u Bytes, %u Bytes overlapping.\n",
+        count, segments, bytes, overlap);
+
+    free(data);
+    free(owner);
+
+    return header;
+
+error0:
+    free(data);
+    free(owner);
+    return NULL;
+}
+
+/*
+ * Load the TI-TXT files and merge them, named by their paths.
+ */
+titxt_header_t *bsl430_merge_load(const char *const *paths, uint32_t count)
+{
+    uint32_t i;
+    titxt_header_t *images[BSL430_MERGE_MAX_IMAGES];
+    titxt_header_t *header = NULL;
+
+    if (!paths || count == 0 || count > BSL430_MERGE_MAX_IMAGES) {
+        log("** Merging takes 1 to %u images.\n", BSL430_MERGE_MAX_IMAGES);
+        return NULL;
+    }
+
+    memset(images, 0, sizeof(images));
+    for (i = 0; i < count; i++) {
+        images[i] = bsl430_ti_txt_load(paths[i], BSL430_MAX_CODE_SIZE);
+        if (images[i] == NULL) {
+            goto done;
+        }
+    }
+
+    header = bsl430_merge(images, paths, count);
+
+done:
+    for (i = 0; i < count; i++) {
+        free(images[i]);
+    }
+
+    return header;
+}
+
+static const char *merge_name(const char *const *names, uint32_t i)
+{
+    return (names && names[i])? names[i]: "image";
+}
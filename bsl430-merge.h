@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_MERGE_H__
+#define __BSL430_MERGE_H__
+
+#include <stdint.h>
+
+#include "bsl430-program.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Merge of images programmed together
+ *
+ * A product ships as several TI-TXT files, e.g. a bootloader, the
+ * application and a calibration blob. bsl430_merge() lays them over one
+ * address space and returns one image of their segments, adjacent ones
+ * coalesced, which bsl430_program_ex() programs in one session with one
+ * CRC check per segment. The password is the vector table of the merged
+ * image, i.e. of the image holding it.
+ *
+ * Images may overlap by the same bytes. A byte two images give different
+ * values is a conflict, it is logged by the names of the images, if any,
+ * and nothing is returned. So are addresses above 0xFFFF.
+ *
+ * The result is allocated, free() it.
+ */
+
+#define BSL430_MERGE_MAX_IMAGES     8
+
+titxt_header_t *bsl430_merge(titxt_header_t *const *images, const char *const *names,
+                             uint32_t count);
+titxt_header_t *bsl430_merge_load(const char *const *paths, uint32_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_MERGE_H__ */
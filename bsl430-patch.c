@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-patch"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-patch.h"
+
+static int patch_segment(const bsl430_stream_t *stream, const bsl430_patch_edit_t *edit);
+static int patch_hex(char c);
+
+/*
+ * Return 0, or -1 if an edit is not in a segment or the stream is not of
+ * the image. <patch> is the unit, free it by bsl430_patch_free().
+ */
+int bsl430_patch_apply(titxt_header_t *header, const bsl430_stream_t *stream,
+                       const bsl430_patch_edit_t *edit, uint32_t count, bsl430_patch_t *patch)
+{
+    uint32_t i, j;
+    uint32_t first, last, frames = 0;
+    uint32_t offset, after;
+    uint32_t size;
+    uint16_t crc;
+    int n;
+    int seg[BSL430_PATCH_MAX_EDITS];
+    titxt_segment_t *segment = NULL;
+    bsl430_stream_segment_t *table = NULL;
+    bsl430_stream_frame_t *index = NULL;
+    bsl430_stream_frame_t *frame = NULL;
+    uint8_t *image = NULL;
+    uint8_t *buf = NULL;
+
+    if (!header || !stream || !patch || (count > 0 && !edit) || count > BSL430_PATCH_MAX_EDITS) {
+        return -1;
+    }
+
+    memset(patch, 0, sizeof(*patch));
+
+    if (stream->segments != header->segments || stream->patch != NULL) {
+        log("** Stream is not the encoded image!\n");
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        seg[i] = patch_segment(stream, &edit[i]);
+        if (seg[i] < 0) {
+            log("** Patch @%04X %u Bytes is not in a segment!\n", edit[i].address, edit[i].size);
+            return -1;
+        }
+    }
+
+    /* The image ends after its last segment. */
+    for (i = 0, segment = NULL; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+    }
+    size = (uint32_t)((uint8_t *)bsl430_ti_txt_segment(header, segment) - (uint8_t *)header);
+
+    image = malloc(size);
+    table = malloc((stream->segments + 1) * sizeof(*table));
+    index = malloc((stream->frames + 1) * sizeof(*index));
+    if (!image || !table || !index) {
+        log("** Allocating patch failed!\n");
+        goto error0;
+    }
+
+    memcpy(image, header, size);
+    memcpy(table, stream->segment, stream->segments * sizeof(*table));
+    memcpy(index, stream->index, stream->frames * sizeof(*index));
+
+    /* The frames edited are marked, and the bytes go into the copy. */
+    for (i = 0; i < count; i++) {
+        segment = NULL;
+        for (j = 0; j <= (uint32_t)seg[i]; j++) {
+            segment = bsl430_ti_txt_segment((titxt_header_t *)image, segment);
+        }
+        offset = edit[i].address - segment->address;
+        memcpy(segment->data + offset, edit[i].data, edit[i].size);
+
+        first = offset / BSL430_MAX_DATA_SIZE;
+        last = (offset + edit[i].size - 1) / BSL430_MAX_DATA_SIZE;
+        for (j = first; j <= last; j++) {
+            frame = &index[table[seg[i]].frame + j];
+            if (!(frame->flags & BSL430_STREAM_PATCHED)) {
+                frame->flags |= BSL430_STREAM_PATCHED;
+                frames++;
+            }
+        }
+    }
+
+    buf = malloc(frames * BSL430_RX_DATA_FRAME_SIZE + 1);
+    if (!buf) {
+        log("** Allocating patch failed!\n");
+        goto error0;
+    }
+
+    size = 0;
+    segment = NULL;
+    for (i = 0; i < stream->segments; i++) {
+        segment = bsl430_ti_txt_segment((titxt_header_t *)image, segment);
+
+        for (j = 0; j < table[i].frames; j++) {
+            frame = &index[table[i].frame + j];
+            if (!(frame->flags & BSL430_STREAM_PATCHED)) {
+                continue;
+            }
+
+            offset = j * BSL430_MAX_DATA_SIZE;
+            n = bsl430_encode_rx_data_block(segment->address + offset, segment->data + offset,
+                                            frame->size, &buf[size]);
+            if (n < 0) {
+                goto error0;
+            }
+
+            /* Equal lengths, the CRCs differ by the CRC of the difference. */
+            crc = bsl430_crc16(segment->data + offset, frame->size, 0xFFFF);
+            after = segment->size - offset - frame->size;
+            table[i].crc ^= bsl430_crc16_shift(frame->crc ^ crc, after);
+
+            frame->offset = size;
+            frame->len    = (uint16_t)n;
+            frame->crc    = crc;
+            frame->flags  = BSL430_STREAM_PATCHED |
+                            ((bsl430_blank(segment->address + offset, segment->data + offset,
+                                           frame->size))?
+                             BSL430_STREAM_BLANK: 0);
+            size += n;
+        }
+    }
+
+    patch->header           = (titxt_header_t *)image;
+    patch->frames           = frames;
+    patch->stream.image     = bsl430_ti_txt_hash(patch->header);
+    patch->stream.segments  = stream->segments;
+    patch->stream.frames    = stream->frames;
+    patch->stream.size      = stream->size;
+    patch->stream.segment   = table;
+    patch->stream.index     = index;
+    patch->stream.buf       = stream->buf;
+    patch->stream.patch     = buf;
+
+    debug("Patch: %u edits, %u frames encoded again.\n", count, frames);
+
+    return 0;
+
+error0:
+    free(image);
+    free(table);
+    free(index);
+    free(buf);
+    return -1;
+}
+
+/*
+ * The frames of the base are not freed, they are the base's.
+ */
+int bsl430_patch_free(bsl430_patch_t *patch)
+{
+    if (!patch) {
+        return -1;
+    }
+
+    free(patch->header);
+    free((void *)patch->stream.segment);
+    free((void *)patch->stream.index);
+    free((void *)patch->stream.patch);
+    memset(patch, 0, sizeof(*patch));
+
+    return 0;
+}
+
+/*
+ * Parse "<hex address>:<hex bytes>", e.g. "1800:0123ABCD", into <edit>,
+ * the bytes into <data> of <size>. Return 0, or -1 if it's malformed.
+ */
+int bsl430_patch_parse(const char *spec, bsl430_patch_edit_t *edit, uint8_t *data,
+                       uint32_t size)
+{
+    char *end = NULL;
+    uint32_t n = 0;
+    int hi, lo;
+
+    if (!spec || !edit || !data) {
+        return -1;
+    }
+
+    edit->address = (uint32_t)strtoul(spec, &end, 16);
+    if (end == spec || *end != ':') {
+        return -1;
+    }
+
+    for (end++; *end != '\0'; end += 2) {
+        hi = patch_hex(end[0]);
+        lo = (hi >= 0)? patch_hex(end[1]): -1;
+        if (lo < 0 || n >= size) {
+            return -1;
+        }
+        data[n++] = (uint8_t)((hi << 4) | lo);
+    }
+
+    edit->size = n;
+    edit->data = data;
+
+    return (n > 0)? 0: -1;
+}
+
+/*
+ * The segment holding all of the edit, or -1.
+ */
+static int patch_segment(const bsl430_stream_t *stream, const bsl430_patch_edit_t *edit)
+{
+    uint32_t i;
+
+    if (edit->size == 0 || edit->data == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < stream->segments; i++) {
+        if (edit->address >= stream->segment[i].address &&
+            edit->address + edit->size <= stream->segment[i].address + stream->segment[i].size) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+static int patch_hex(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
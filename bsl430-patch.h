@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_PATCH_H__
+#define __BSL430_PATCH_H__
+
+#include <stdint.h>
+
+#include "bsl430-program.h"
+#include "bsl430-stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per-unit patch over a shared image
+ *
+ * Each unit gets a few bytes of its own, e.g. a serial number, a MAC and
+ * calibration constants, over an image which is the same for all. The
+ * image is parsed and encoded into a stream once, see bsl430-stream.h,
+ * and bsl430_patch_apply() makes the image and the stream of a unit from
+ * the edits:
+ *
+ *  - the image is copied with the edits in, as bsl430_program_ex() takes
+ *    the password and the data of the strategies from it;
+ *  - the stream shares the frames of the base, only the frames an edit
+ *    touches are encoded again, into a buffer of the unit;
+ *  - the CRC of an edited frame is taken again, that of its segment is
+ *    corrected by the difference, see bsl430_crc16_shift().
+ *
+ * The base image and stream are only read, so the units can be prepared
+ * on any number of threads. Program a unit by bsl430_program_ex() of
+ * <header> with <stream> in the config, and free it by bsl430_patch_free().
+ *
+ * An edit must lie in a segment of the image, bytes are not added. The
+ * stream is that of bsl430_stream_encode(), a unit is not patched again.
+ */
+
+#define BSL430_PATCH_MAX_EDITS  16
+#define BSL430_PATCH_MAX_SIZE   64
+
+typedef struct bsl430_patch_edit_s {
+    uint32_t address;
+    uint32_t size;
+    const uint8_t *data;
+} bsl430_patch_edit_t;
+
+typedef struct bsl430_patch_s {
+    titxt_header_t *header;     /* the image with the edits */
+    bsl430_stream_t stream;     /* the frames of the base, those edited encoded again */
+    uint32_t frames;            /* encoded again */
+} bsl430_patch_t;
+
+int bsl430_patch_apply(titxt_header_t *header, const bsl430_stream_t *stream,
+                       const bsl430_patch_edit_t *edit, uint32_t count, bsl430_patch_t *patch);
+int bsl430_patch_free(bsl430_patch_t *patch);
+int bsl430_patch_parse(const char *spec, bsl430_patch_edit_t *edit, uint8_t *data,
+                       uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_PATCH_H__ */
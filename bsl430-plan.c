@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-plan"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-plan.h"
+
+/* 11 bits of 8E1 at 115200 baud. */
+#define PLAN_BYTE_US        96
+/* Round trip of a command besides its bytes, USB-serial latency mostly. */
+#define PLAN_TURNAROUND_US  1000
+/* RX_DATA_BLOCK frame besides its data, and its ACK and message back. */
+#define PLAN_WRITE_WIRE     (BSL430_RX_DATA_FRAME_SIZE - BSL430_MAX_DATA_SIZE + 8)
+/* CRC_CHECK frame, and its ACK and data back. */
+#define PLAN_CHECK_WIRE     (11 + 9)
+/* Unchanged bytes sent rather than starting a new frame. */
+#define PLAN_GAP            (PLAN_WRITE_WIRE + PLAN_TURNAROUND_US / PLAN_BYTE_US)
+
+static uint32_t plan_segment(titxt_header_t *old, titxt_segment_t *seg, uint8_t *changed,
+                             bsl430_plan_write_t *write, uint32_t *bytes);
+
+int bsl430_plan_diff(titxt_header_t *old, titxt_header_t *header, bsl430_plan_t *plan)
+{
+    uint32_t i;
+    uint32_t writes = 0;
+    uint32_t max = 0;
+    uint32_t changed = 0;
+    titxt_segment_t *seg = NULL;
+    bsl430_plan_write_t *write = NULL;
+    bsl430_plan_check_t *check = NULL;
+    uint8_t *map = NULL;
+
+    if (!old || !header || !plan) {
+        return -1;
+    }
+
+    memset(plan, 0, sizeof(*plan));
+
+    for (i = 0; i < header->segments; i++) {
+        seg = bsl430_ti_txt_segment(header, seg);
+        max = (seg->size > max)? seg->size: max;
+    }
+
+    /* The writes are counted first, for one allocation. */
+    map = malloc(max + 1);
+    if (!map) {
+        goto error0;
+    }
+
+    for (i = 0, seg = NULL; i < header->segments; i++) {
+        seg = bsl430_ti_txt_segment(header, seg);
+        writes += plan_segment(old, seg, map, NULL, &changed);
+    }
+
+    write = calloc(writes + 1, sizeof(*write));
+    check = calloc(header->segments + 1, sizeof(*check));
+    if (!write || !check) {
+        goto error0;
+    }
+
+    writes = changed = 0;
+    for (i = 0, seg = NULL; i < header->segments; i++) {
+        seg = bsl430_ti_txt_segment(header, seg);
+        writes += plan_segment(old, seg, map, &write[writes], &changed);
+
+        check[i].address = seg->address;
+        check[i].size    = seg->size;
+        check[i].crc     = bsl430_crc16(seg->data, seg->size, 0xFFFF);
+        check[i].data    = seg->data;
+
+        plan->size += seg->size;
+    }
+
+    for (i = 0; i < writes; i++) {
+        plan->data += write[i].size;
+    }
+
+    plan->writes  = writes;
+    plan->checks  = header->segments;
+    plan->write   = write;
+    plan->check   = check;
+    plan->changed = changed;
+    plan->wire    = plan->data + writes * PLAN_WRITE_WIRE + plan->checks * PLAN_CHECK_WIRE;
+    plan->time_ms = (plan->wire * PLAN_BYTE_US +
+                     (writes + plan->checks) * PLAN_TURNAROUND_US + 999) / 1000;
+
+    free(map);
+
+    return 0;
+
+error0:
+    log("** Allocating plan failed!\n");
+    free(map);
+    free(write);
+    free(check);
+    return -1;
+}
+
+int bsl430_plan_free(bsl430_plan_t *plan)
+{
+    if (!plan) {
+        return -1;
+    }
+
+    free((void *)plan->write);
+    free((void *)plan->check);
+    memset(plan, 0, sizeof(*plan));
+
+    return 0;
+}
+
+void bsl430_plan_print(const bsl430_plan_t *plan)
+{
+    log("Plan: %u of %u Bytes changed, %u writes of %u Bytes, %u CRC checks.\n",
+        plan->changed, plan->size, plan->writes, plan->data, plan->checks);
+    log("Plan: %u Bytes on the wire, about %u ms at 115200 baud.\n", plan->wire, plan->time_ms);
+}
+
+/*
+ * Map the bytes of the segment which the old image doesn't hold, and plan
+ * their frames into <write> if not NULL. Return the number of frames.
+ */
+static uint32_t plan_segment(titxt_header_t *old, titxt_segment_t *seg, uint8_t *changed,
+                             bsl430_plan_write_t *write, uint32_t *bytes)
+{
+    uint32_t i, j;
+    uint32_t start, end;
+    uint32_t from, to;
+    uint32_t writes = 0;
+    titxt_segment_t *prev = NULL;
+
+    memset(changed, 1, seg->size);
+
+    for (i = 0; i < old->segments; i++) {
+        prev = bsl430_ti_txt_segment(old, prev);
+
+        from = (prev->address > seg->address)? prev->address: seg->address;
+        to = (prev->address + prev->size < seg->address + seg->size)?
+             prev->address + prev->size: seg->address + seg->size;
+
+        for (j = from; j < to; j++) {
+            if (prev->data[j - prev->address] == seg->data[j - seg->address]) {
+                changed[j - seg->address] = 0;
+            }
+        }
+    }
+
+    i = 0;
+    while (i < seg->size) {
+        if (!changed[i]) {
+            i++;
+            continue;
+        }
+
+        /* A gap of PLAN_GAP bytes is cheaper than a new frame. */
+        start = i;
+        end = i + 1;
+        for (j = end; j < seg->size && j - end <= PLAN_GAP && j < start + BSL430_MAX_DATA_SIZE; j++) {
+            if (changed[j]) {
+                end = j + 1;
+            }
+        }
+
+        for (j = start; j < end; j++) {
+            *bytes += changed[j];
+        }
+
+        if (write) {
+            write[writes].address = seg->address + start;
+            write[writes].size    = (uint16_t)(end - start);
+            write[writes].data    = seg->data + start;
+        }
+        writes++;
+        i = end;
+    }
+
+    return writes;
+}
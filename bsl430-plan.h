@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_PLAN_H__
+#define __BSL430_PLAN_H__
+
+#include <stdint.h>
+
+#include "bsl430.h"
+#include "bsl430-program.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Write plan of an update
+ *
+ * bsl430_plan_diff() compares the image on the device with the new one,
+ * offline, and plans the RX_DATA_BLOCK frames that make the device hold the
+ * new one: the bytes of the new image that differ from the old one, or that
+ * the old one doesn't have. Runs of changed bytes closer than a frame costs
+ * on the wire are sent in one frame, a frame holds BSL430_MAX_DATA_SIZE
+ * bytes at most. The bytes of the old image the new one doesn't have are
+ * left as they are.
+ *
+ * Each segment of the new image is then verified by one CRC_CHECK, so a
+ * device which doesn't hold the old image fails the check, and the segment
+ * is written whole, see bsl430_program_ex().
+ *
+ * The plan points into the new image, which must outlive it.
+ */
+
+typedef struct bsl430_plan_write_s {
+    uint32_t address;
+    uint16_t size;
+    const uint8_t *data;
+} bsl430_plan_write_t;
+
+typedef struct bsl430_plan_check_s {
+    uint32_t address;
+    uint32_t size;
+    uint16_t crc;
+    const uint8_t *data;    /* the segment, written whole on a mismatch */
+} bsl430_plan_check_t;
+
+typedef struct bsl430_plan_s {
+    uint32_t writes;
+    uint32_t checks;
+    const bsl430_plan_write_t *write;
+    const bsl430_plan_check_t *check;
+    uint32_t size;          /* bytes of the new image */
+    uint32_t changed;       /* bytes which differ */
+    uint32_t data;          /* bytes written, with the gaps merged */
+    uint32_t wire;          /* bytes on the wire both ways, checks included */
+    uint32_t time_ms;       /* estimated at 115200 baud */
+} bsl430_plan_t;
+
+int bsl430_plan_diff(titxt_header_t *old, titxt_header_t *header, bsl430_plan_t *plan);
+int bsl430_plan_free(bsl430_plan_t *plan);
+void bsl430_plan_print(const bsl430_plan_t *plan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_PLAN_H__ */
@@ -19,44 +19,188 @@
 #define LOG_TAG "bsl430-platform"
 
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 
 #include <termios.h>
+#include <linux/gpio.h>
+#include <linux/serial.h>
 
+#ifndef BSL430_NO_HISI
 #include "hi_board.h"
 #include "hi_unf_gpio.h"
+#endif
 
 #include "bsl430-platform.h"
+#include "bsl430-trace.h"
 
 #define PMRPC_UART_PORT "/dev/ttyAMA2"
 
+/* Default time between two states of the BSL entry sequence. */
+#define GPIO_STATE_INTERVAL 20  /* ms */
+
+/*
+ * Idle time added after each character in BSL430_PACING_SOFT mode,
+ * on top of the character time itself.
+ */
+#define UART_GUARD_NS       20000
+/* Upper bound of the busy-wait window in front of each deadline. */
+#define UART_SPIN_MAX_NS    200000
+#define UART_CALIBRATE_LOOP 8
+
+/*
+ * Low latency mode: the latency timer of a USB-serial adapter (FTDI: 16 ms
+ * by default), and the shortest wait for a character, to allow for a
+ * scheduling delay.
+ */
+#define UART_LATENCY_TIMER  "1"     /* ms */
+#define UART_POLL_MIN_MS    20
+#define UART_RX_BUF_SIZE    512
+
 static int fd = -1;
+static const char *uart_port = PMRPC_UART_PORT;
+
+#ifndef BSL430_NO_HISI
+static bsl430_gpio_config_t gpio_config = { BSL430_GPIO_HISI, NULL, 0, 0, 0, 0 };
+#else
+static bsl430_gpio_config_t gpio_config = { BSL430_GPIO_CHIP, "/dev/gpiochip0", 0, 1, 0, 0 };
+#endif
+static int gpio_ready = 0;
+static int gpio_fd = -1;        /* line request of CHIP, or tty of MODEM */
+static int gpio_rst_level = 1;
+static int gpio_tst_level = 0;
+
+static int pacing = BSL430_PACING_SOFT;
+static uint64_t char_ns = 0;    /* period between two paced characters */
+static uint64_t spin_ns = 0;    /* calibrated wakeup latency of clock_nanosleep */
+static uint64_t next_ns = 0;    /* earliest time the next character may be written */
+static bsl430_uart_stats_t stats;
+
+static int low_latency = 0;
+static uint8_t rx_buf[UART_RX_BUF_SIZE];
+static int rx_head = 0;
+static int rx_tail = 0;
+static int rtt_armed = 0;       /* a write waits for its first response byte */
+static uint64_t rtt_start = 0;
+static uint64_t rtt_wire_end = 0;
+static uint64_t rtt_sum_ns = 0;
+static uint64_t rtt_max_ns = 0;
+static uint64_t rtt_wire_sum_ns = 0;
+static uint64_t tx_gap_max_ns = 0;
+static uint64_t tx_late_max_ns = 0;
+
+/* The UART is replaced by a trace while replaying it. */
+static bsl430_trace_reader_t replay;
+static bsl430_trace_record_t replay_record;
+static int replay_valid = 0;    /* replay_record is a TX, RX or TIMEOUT not consumed */
+static int replay_pos = 0;
+static uint64_t replay_anchor_ns = 0;   /* when the last TX record was replayed */
+static uint64_t replay_anchor_us = 0;   /* and its time in the trace */
+static uint32_t replay_mismatch = 0;
 
 static int uart_set_speed(int fd, int speed);
 static int uart_set_attribute(int fd, int databits, int stopbits, char parity);
+static int uart_set_low_latency(int fd);
+static int uart_open(void);
+static int uart_vtime_readb(uint16_t timeout);
+static int uart_poll_readb(uint16_t timeout);
+static void uart_rtt_sample(void);
+static int uart_xwrite(const uint8_t *buf, int len);
+static bsl430_trace_record_t *replay_next(void);
+static int replay_write(const uint8_t *buf, int len);
+static int replay_readb(void);
+static uint64_t uart_now_ns(void);
+static void uart_wait_until(uint64_t deadline);
+static void uart_calibrate(void);
+static int gpio_chip_init(void);
+static int gpio_chip_set(int rst, int tst);
+static int gpio_modem_init(void);
+static int gpio_modem_set(int rst, int tst);
 
 int bsl430_uart_init(int baudrate, int parity)
 {
     int status = 0;
+    int stopbits = (pacing == BSL430_PACING_STOPBITS)? 2: 1;
+    int bits = 0;
+    uint8_t open_record[5];
 
-    fd = open(PMRPC_UART_PORT, O_RDWR | O_NOCTTY);
-    if (fd < 0) {
-        log("Open UART failed! %s\n", strerror(errno));
-        return -1;
+    /* Re-initialization, e.g. after CHANGE_BAUDRATE. */
+    bsl430_uart_term();
+
+    if (replay.fp == NULL) {
+        fd = uart_open();
+        if (fd < 0) {
+            log("Open UART failed! %s\n", strerror(errno));
+            return -1;
+        }
+
+        status  = uart_set_speed(fd, baudrate);
+        status |= uart_set_attribute(fd, 8, stopbits, (parity == 0)? 'E': (parity == 1)? 'O': 'N');
+        if (low_latency) {
+            status |= uart_set_low_latency(fd);
+        }
+
+        if (status != 0) {
+            log("Config UART failed!\n");
+            close(fd);
+            fd = -1;
+            return status;
+        }
     }
 
-    status  = uart_set_speed(fd, baudrate);
-    status |= uart_set_attribute(fd, 8, 1, (parity == 0)? 'E': (parity == 1)? 'O': 'N');
+    open_record[0] = (uint8_t)((uint32_t)baudrate >> 0  & 0xFF);
+    open_record[1] = (uint8_t)((uint32_t)baudrate >> 8  & 0xFF);
+    open_record[2] = (uint8_t)((uint32_t)baudrate >> 16 & 0xFF);
+    open_record[3] = (uint8_t)((uint32_t)baudrate >> 24 & 0xFF);
+    open_record[4] = (uint8_t)parity;
+    bsl430_trace_record(BSL430_TRACE_OPEN, open_record, sizeof(open_record));
 
-    if (status != 0) {
-        log("Config UART failed!\n");
-        close(fd);
-        fd = -1;
+    /* Start + 8 data bits + parity + stop bits on the wire. */
+    bits = 1 + 8 + ((parity == 0 || parity == 1)? 1: 0) + stopbits;
+    char_ns = (uint64_t)bits * 1000000000ULL / (uint64_t)(baudrate? baudrate: 115200);
+    next_ns = 0;
+    rx_head = rx_tail = 0;
+    rtt_armed = 0;
+
+    if (pacing == BSL430_PACING_SOFT) {
+        char_ns += UART_GUARD_NS;
+        if (spin_ns == 0) {
+            uart_calibrate();
+        }
     }
 
-    return status;
+    debug("UART %d baud, %d bits/char, pacing %d, period %u ns, spin %u ns, low latency %d\n",
+          baudrate, bits, pacing, (uint32_t)char_ns, (uint32_t)spin_ns, low_latency);
+
+    return 0;
+}
+
+/*
+ * Linux raises DTR/RTS on every open() of a tty, even while another fd holds
+ * it. With the MODEM backend on the UART, that pulls RST low, so the UART is
+ * a dup() of the fd of the lines: it is closed and opened again around
+ * CHANGE_BAUDRATE without an open() of the tty.
+ */
+static int uart_open(void)
+{
+    struct stat uart_stat;
+    struct stat modem_stat;
+
+    if (gpio_ready && gpio_config.backend == BSL430_GPIO_MODEM && gpio_fd >= 0 &&
+        stat(uart_port, &uart_stat) == 0 && fstat(gpio_fd, &modem_stat) == 0 &&
+        S_ISCHR(uart_stat.st_mode) && uart_stat.st_rdev == modem_stat.st_rdev) {
+        return dup(gpio_fd);
+    }
+
+    return open(uart_port, O_RDWR | O_NOCTTY);
 }
 
 int bsl430_uart_term(void)
@@ -70,77 +214,378 @@ int bsl430_uart_term(void)
 
 int bsl430_uart_readb(uint16_t timeout)
 {
-    int status = 0;
-    uint8_t c;
+    int c = -1;
+    uint8_t b;
 
-    (void)timeout;
-
-    if (fd < 0) {
+    if (replay.fp) {
+        c = replay_readb();
+    } else if (fd >= 0) {
+        c = (low_latency)? uart_poll_readb(timeout): uart_vtime_readb(timeout);
+    } else {
         return -1;
     }
 
-    status = read(fd, &c, 1);
-    if (status <= 0 && errno != 0) {
-        log("Read UART error! %s\n", strerror(errno));
+    if (c >= 0) {
+        stats.rx_bytes++;
+        if (rtt_armed) {
+            uart_rtt_sample();
+        }
+
+        b = (uint8_t)c;
+        bsl430_trace_record(BSL430_TRACE_RX, &b, 1);
+    } else {
+        bsl430_trace_record(BSL430_TRACE_TIMEOUT, NULL, 0);
     }
 
-    return (status == 1)? c: -1;
+    return c;
 }
 
 int bsl430_uart_writeb(uint8_t c)
+{
+    return bsl430_uart_write(&c, 1);
+}
+
+int bsl430_uart_write(const uint8_t *buf, int len)
 {
     int status = 0;
+    int i = 0;
+    uint64_t start = 0;
+    uint64_t now = 0;
+    uint64_t last = 0;
 
-    if (fd < 0) {
+    if ((fd < 0 && replay.fp == NULL) || !buf || len < 0) {
         return -1;
     }
 
-    /*
-     * The FIFO depth of MSP430 UART is ONE.
-     * So add some delay between two bytes to avoid overflow.
-     */
-    usleep(200);
+    start = uart_now_ns();
+    if (next_ns < start) {
+        /* The line has been idle. */
+        next_ns = start;
+    }
+    /* The line is busy with this buffer from here on. */
+    start = next_ns;
 
-    status = write(fd, &c, 1);
-    if (status <= 0) {
-        log("Write UART error! %s\n", strerror(errno));
+    /* A round trip runs from the first write to the first byte read. */
+    if (!rtt_armed) {
+        rtt_start = start;
+        rtt_armed = 1;
+    }
+
+    if (pacing == BSL430_PACING_SOFT) {
+        /*
+         * The FIFO depth of MSP430 UART is ONE.
+         * So hand the characters to the host UART one by one,
+         * each one character time plus a guard after the previous one.
+         * The deadlines are absolute, so the overshoots don't accumulate.
+         */
+        for (i = 0; i < len; i++) {
+            uart_wait_until(next_ns);
+
+            status = uart_xwrite(&buf[i], 1);
+            if (status != 1) {
+                log("Write UART error! %s\n", strerror(errno));
+                return -1;
+            }
+
+            /* The jitter of the host, a preemption shows as a gap. */
+            now = uart_now_ns();
+            if (now - next_ns > tx_late_max_ns) {
+                tx_late_max_ns = now - next_ns;
+            }
+            if (i > 0 && now - last > tx_gap_max_ns) {
+                tx_gap_max_ns = now - last;
+            }
+            last = now;
+
+            next_ns = ((now - next_ns < char_ns)? next_ns: now) + char_ns;
+        }
+    } else {
+        /*
+         * The gap between characters is generated by the UART itself
+         * (the second stop bit), or not needed at all.
+         * So write the whole buffer at once.
+         */
+        while (i < len) {
+            status = uart_xwrite(&buf[i], len - i);
+            if (status <= 0) {
+                log("Write UART error! %s\n", strerror(errno));
+                return -1;
+            }
+            i += status;
+        }
+
+        /* write() returns once the data is queued, account the wire time. */
+        next_ns += char_ns * len;
+    }
+
+    stats.tx_bytes += len;
+    stats.tx_ns    += next_ns - start;
+    rtt_wire_end    = next_ns;
+
+    bsl430_trace_record(BSL430_TRACE_TX, buf, len);
+
+    return 0;
+}
+
+int bsl430_uart_set_pacing(int mode)
+{
+    int previous;
+
+    if (mode != BSL430_PACING_SOFT && mode != BSL430_PACING_STOPBITS &&
+        mode != BSL430_PACING_NONE) {
+        return -1;
     }
 
-    return (status == 1)? 0: -1;
+    /* Take effect at next bsl430_uart_init(). */
+    previous = pacing;
+    pacing = mode;
+    return previous;
+}
+
+/*
+ * Take effect at next bsl430_uart_init(). The settings of the adapter are
+ * left as they are after bsl430_uart_term(), they are back to the defaults
+ * once it is plugged again.
+ */
+int bsl430_uart_set_low_latency(int enable)
+{
+    int previous = low_latency;
+
+    low_latency = (enable != 0);
+    return previous;
+}
+
+int bsl430_uart_get_stats(bsl430_uart_stats_t *s)
+{
+    if (!s) {
+        return -1;
+    }
+
+    *s = stats;
+    s->tx_rate = (stats.tx_ns > 0)?
+                 (uint32_t)((uint64_t)stats.tx_bytes * 1000000000ULL / stats.tx_ns): 0;
+    s->line_rate = (char_ns > 0)? (uint32_t)(1000000000ULL / char_ns): 0;
+
+    if (stats.rtt_count > 0) {
+        s->rtt_us      = (uint32_t)(rtt_sum_ns / stats.rtt_count / 1000);
+        s->rtt_wire_us = (uint32_t)(rtt_wire_sum_ns / stats.rtt_count / 1000);
+        s->rtt_max_us  = (uint32_t)(rtt_max_ns / 1000);
+    }
+    s->tx_gap_max_us  = (uint32_t)(tx_gap_max_ns / 1000);
+    s->tx_late_max_us = (uint32_t)(tx_late_max_ns / 1000);
+
+    return 0;
+}
+
+int bsl430_uart_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    rtt_armed = 0;
+    rtt_sum_ns = rtt_max_ns = rtt_wire_sum_ns = 0;
+    tx_gap_max_ns = tx_late_max_ns = 0;
+    return 0;
 }
 
 int bsl430_uart_clear(void)
 {
-    while (bsl430_uart_readb(10) != -1) ;
+    return bsl430_uart_drain(10, 0);
+}
+
+/*
+ * Read and drop characters until none comes for <quiet> ms, or <limit> ms
+ * have passed if not 0, e.g. the rest of a broken response.
+ */
+int bsl430_uart_drain(uint16_t quiet, uint16_t limit)
+{
+    uint64_t end = uart_now_ns() + (uint64_t)limit * 1000000ULL;
+
+    /* Whatever is pending doesn't answer a write. */
+    rtt_armed = 0;
+    while (bsl430_uart_readb(quiet) != -1) {
+        if (limit > 0 && uart_now_ns() >= end) {
+            break;
+        }
+    }
+    return 0;
+}
+
+int bsl430_uart_port(const char *path)
+{
+    uart_port = (path)? path: PMRPC_UART_PORT;
+    return 0;
+}
+
+/*
+ * Replay a trace recorded by bsl430_trace_open() in place of the UART, from
+ * the next bsl430_uart_init() on. The bytes written are compared with the
+ * recorded ones, the bytes read come from the trace at the recorded time
+ * after the preceding write, so the latency of the device is reproduced.
+ * The GPIO lines are left alone meanwhile. NULL ends the replay.
+ */
+int bsl430_uart_replay(const char *path)
+{
+    if (replay.fp) {
+        log("Replay: %u Bytes differ from the trace.\n", replay_mismatch);
+        bsl430_trace_reader_close(&replay);
+    }
+
+    replay_valid = 0;
+    replay_pos = 0;
+    replay_mismatch = 0;
+
+    if (path == NULL) {
+        return 0;
+    }
+
+    return bsl430_trace_reader_open(&replay, path);
+}
+
+/*
+ * Configure a tty opened by the caller the way the UART is, e.g. the ports
+ * of bsl430-uring.c. parity is as for bsl430_uart_init().
+ */
+int bsl430_uart_config(int fd, int baudrate, int parity, int stopbits)
+{
+    int status = 0;
+
+    status  = uart_set_speed(fd, baudrate);
+    status |= uart_set_attribute(fd, 8, stopbits, (parity == 0)? 'E': (parity == 1)? 'O': 'N');
+
+    return status;
+}
+
+int bsl430_gpio_config(const bsl430_gpio_config_t *config)
+{
+    if (!config) {
+        return -1;
+    }
+
+    bsl430_gpio_term();
+    gpio_config = *config;
+
+    return 0;
+}
+
+int bsl430_gpio_get_config(bsl430_gpio_config_t *config)
+{
+    if (!config) {
+        return -1;
+    }
+
+    *config = gpio_config;
+
     return 0;
 }
 
 int bsl430_gpio_init(void)
 {
-    HI_SYS_Init();
-    HI_UNF_GPIO_Init();
+    int status = 0;
 
-    HI_UNF_GPIO_SetDirBit(HI_BOARD_RST_GPIONUM, HI_BOARD_GPIO_OUT);
-    HI_UNF_GPIO_SetDirBit(HI_BOARD_TST_GPIONUM, HI_BOARD_GPIO_OUT);
+    /* The lines are set up once, and kept until bsl430_gpio_term(). */
+    if (gpio_ready || replay.fp) {
+        return 0;
+    }
+
+    switch (gpio_config.backend) {
+#ifndef BSL430_NO_HISI
+    case BSL430_GPIO_HISI:
+        HI_SYS_Init();
+        HI_UNF_GPIO_Init();
 
+        HI_UNF_GPIO_SetDirBit(HI_BOARD_RST_GPIONUM, HI_BOARD_GPIO_OUT);
+        HI_UNF_GPIO_SetDirBit(HI_BOARD_TST_GPIONUM, HI_BOARD_GPIO_OUT);
+        break;
+#endif
+    case BSL430_GPIO_CHIP:
+        status = gpio_chip_init();
+        break;
+    case BSL430_GPIO_MODEM:
+        status = gpio_modem_init();
+        break;
+    default:
+        status = -1;
+        break;
+    }
+
+    if (status != 0) {
+        log("** GPIO init failed!\n");
+        return status;
+    }
+
+    gpio_ready = 1;
     return 0;
 }
 
 int bsl430_gpio_term(void)
 {
+    if (gpio_fd >= 0) {
+        close(gpio_fd);
+        gpio_fd = -1;
+    }
+
+    gpio_ready = 0;
     return 0;
 }
 
 int bsl430_gpio_rst(int level)
 {
-    return HI_UNF_GPIO_WriteBit(HI_BOARD_RST_GPIONUM,
-                                (level == 0)? HI_BOARD_GPIO_LOW: HI_BOARD_GPIO_HIGH);
+    return bsl430_gpio_set(level, gpio_tst_level);
 }
 
 int bsl430_gpio_tst(int level)
 {
-    return HI_UNF_GPIO_WriteBit(HI_BOARD_TST_GPIONUM,
-                                (level == 0)? HI_BOARD_GPIO_LOW: HI_BOARD_GPIO_HIGH);
+    return bsl430_gpio_set(gpio_rst_level, level);
+}
+
+/*
+ * Set RST and TST together. The CHIP and MODEM backends update both lines
+ * by one ioctl, so they change at the same time.
+ */
+int bsl430_gpio_set(int rst, int tst)
+{
+    int status = 0;
+
+    rst = (rst != 0);
+    tst = (tst != 0);
+
+    if (replay.fp) {
+        return 0;
+    }
+
+    switch (gpio_config.backend) {
+#ifndef BSL430_NO_HISI
+    case BSL430_GPIO_HISI:
+        status |= HI_UNF_GPIO_WriteBit(HI_BOARD_RST_GPIONUM,
+                                       (rst == 0)? HI_BOARD_GPIO_LOW: HI_BOARD_GPIO_HIGH);
+        status |= HI_UNF_GPIO_WriteBit(HI_BOARD_TST_GPIONUM,
+                                       (tst == 0)? HI_BOARD_GPIO_LOW: HI_BOARD_GPIO_HIGH);
+        break;
+#endif
+    case BSL430_GPIO_CHIP:
+        status = gpio_chip_set(rst, tst);
+        break;
+    case BSL430_GPIO_MODEM:
+        status = gpio_modem_set(rst, tst);
+        break;
+    default:
+        status = -1;
+        break;
+    }
+
+    gpio_rst_level = rst;
+    gpio_tst_level = tst;
+
+    return status;
+}
+
+int bsl430_gpio_interval(void)
+{
+    return (gpio_config.interval > 0)? gpio_config.interval: GPIO_STATE_INTERVAL;
+}
+
+int bsl430_gpio_per_port(void)
+{
+    return (gpio_config.backend == BSL430_GPIO_MODEM && gpio_config.device == NULL);
 }
 
 static int uart_set_speed(int fd, int speed)
@@ -149,9 +594,9 @@ static int uart_set_speed(int fd, int speed)
     struct termios option;
 
     /* baud speed reference table */
-    int speed_arr[] = {B230400, B115200, B57600, B38400, B19200, B9600,
+    int speed_arr[] = {B921600, B460800, B230400, B115200, B57600, B38400, B19200, B9600,
         B4800, B2400, B1200, B600, B300, B110};
-    int name_arr[]  = {230400,  115200,  57600,  38400,  19200,  9600,
+    int name_arr[]  = {921600,  460800,  230400,  115200,  57600,  38400,  19200,  9600,
         4800,  2400,  1200,  600,  300,  110};
 
     if (fd < 0) {
@@ -183,7 +628,7 @@ static int uart_set_speed(int fd, int speed)
     }
 
     /* unsupport baud speed */
-    log("only support speed of 230400 115200 57600 38400 19200 "
+    log("only support speed of 921600 460800 230400 115200 57600 38400 19200 "
           "9600 4800 2400 1200 600 300 110 but [%d]\n", speed);
     return -1;
 }
@@ -264,6 +709,68 @@ static int uart_set_attribute(int fd, int databits, int stopbits, char parity)
     option.c_cc[VMIN] = 0; /* each char */
 
     tcflush(fd, TCIOFLUSH); /* update the option and do it now */
+    if (tcsetattr(fd, TCSANOW, &option) != 0) {
+        /* A pty has no parity bit to send, newer kernels reject it. */
+        if (errno != EINVAL || !(option.c_cflag & PARENB)) {
+            log("tcsetattr\n");
+            return -1;
+        }
+        option.c_cflag &= ~(PARENB | PARODD);
+        option.c_iflag &= ~INPCK;
+        if (tcsetattr(fd, TCSANOW, &option) != 0) {
+            log("tcsetattr\n");
+            return -1;
+        }
+        log("No parity on this TTY, e.g. a pty.\n");
+    }
+
+    return 0;
+}
+
+/*
+ * Hand the received characters on at once, in the adapter and in the tty,
+ * and never wait for more than a read() asks for.
+ */
+static int uart_set_low_latency(int fd)
+{
+    struct serial_struct serial;
+    struct termios option;
+    char path[128];
+    char name[PATH_MAX];
+    const char *base = NULL;
+    int lfd = -1;
+
+    /* Not every UART driver supports it, e.g. a pty. */
+    if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(fd, TIOCSSERIAL, &serial) != 0) {
+            debug("ASYNC_LOW_LATENCY is not supported. %s\n", strerror(errno));
+        }
+    }
+
+    /* The latency timer of FTDI and alike, /sys/class/tty/ttyUSBn/device. */
+    if (realpath(uart_port, name) != NULL) {
+        base = strrchr(name, '/');
+        snprintf(path, sizeof(path), "/sys/class/tty/%.64s/device/latency_timer",
+                 (base)? base + 1: name);
+        lfd = open(path, O_WRONLY);
+        if (lfd >= 0) {
+            if (write(lfd, UART_LATENCY_TIMER, strlen(UART_LATENCY_TIMER)) < 0) {
+                log("Setting latency timer failed! %s\n", strerror(errno));
+            }
+            close(lfd);
+        }
+    }
+
+    /* read() returns what is there, poll() does the waiting. */
+    if (tcgetattr(fd, &option)) {
+        log("tcgetattr\n");
+        return -1;
+    }
+
+    option.c_cc[VTIME] = 0;
+    option.c_cc[VMIN] = 0;
+
     if (tcsetattr(fd, TCSANOW, &option) != 0) {
         log("tcsetattr\n");
         return -1;
@@ -271,3 +778,364 @@ static int uart_set_attribute(int fd, int databits, int stopbits, char parity)
 
     return 0;
 }
+
+/*
+ * Wait by poll() for the timeout given, then read one character, which
+ * VTIME bounds too.
+ */
+static int uart_vtime_readb(uint16_t timeout)
+{
+    int status = 0;
+    uint8_t c;
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    status = poll(&pfd, 1, timeout);
+    if (status <= 0) {
+        if (status < 0) {
+            log("Poll UART error! %s\n", strerror(errno));
+        }
+        return -1;
+    }
+
+    errno = 0;
+    status = read(fd, &c, 1);
+    if (status <= 0 && errno != 0) {
+        log("Read UART error! %s\n", strerror(errno));
+    }
+
+    return (status == 1)? c: -1;
+}
+
+/*
+ * Wait by poll() for the timeout given, and read all there is into rx_buf,
+ * so a response frame takes one or two read() rather than one per byte.
+ */
+static int uart_poll_readb(uint16_t timeout)
+{
+    int status = 0;
+    struct pollfd pfd;
+
+    if (rx_head == rx_tail) {
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        status = poll(&pfd, 1, (timeout > UART_POLL_MIN_MS)? timeout: UART_POLL_MIN_MS);
+        if (status <= 0) {
+            if (status < 0) {
+                log("Poll UART error! %s\n", strerror(errno));
+            }
+            return -1;
+        }
+
+        status = read(fd, rx_buf, sizeof(rx_buf));
+        if (status <= 0) {
+            log("Read UART error! %s\n", strerror(errno));
+            return -1;
+        }
+
+        rx_head = 0;
+        rx_tail = status;
+    }
+
+    return rx_buf[rx_head++];
+}
+
+static void uart_rtt_sample(void)
+{
+    uint64_t now = uart_now_ns();
+    uint64_t rtt;
+
+    rtt_armed = 0;
+
+    /*
+     * Unpaced, the wire time is accounted ahead and the write may start
+     * past now, on a line faster than the baudrate, e.g. a pty.
+     */
+    if (rtt_start > now) {
+        rtt_start = now;
+    }
+    rtt = now - rtt_start;
+
+    stats.rtt_count++;
+    rtt_sum_ns += rtt;
+    rtt_max_ns = (rtt > rtt_max_ns)? rtt: rtt_max_ns;
+    /* The request on the wire and the first character of the response. */
+    rtt_wire_sum_ns += rtt_wire_end - rtt_start + char_ns;
+}
+
+static int uart_xwrite(const uint8_t *buf, int len)
+{
+    return (replay.fp)? replay_write(buf, len): (int)write(fd, buf, len);
+}
+
+/*
+ * The TX, RX or TIMEOUT record to replay next, NULL at the end of the trace.
+ */
+static bsl430_trace_record_t *replay_next(void)
+{
+    int type;
+
+    while (!replay_valid || (replay_record.type != BSL430_TRACE_TIMEOUT &&
+                             replay_pos >= replay_record.len)) {
+        if (bsl430_trace_reader_next(&replay, &replay_record) != 0) {
+            replay_valid = 0;
+            return NULL;
+        }
+
+        type = replay_record.type;
+        replay_valid = (type == BSL430_TRACE_TX || type == BSL430_TRACE_RX ||
+                        type == BSL430_TRACE_TIMEOUT);
+        replay_pos = 0;
+    }
+
+    return &replay_record;
+}
+
+static int replay_write(const uint8_t *buf, int len)
+{
+    bsl430_trace_record_t *record;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        record = replay_next();
+        if (record == NULL || record->type != BSL430_TRACE_TX) {
+            /* Written more than recorded, the code differs from the trace. */
+            if (replay_mismatch++ == 0) {
+                log("** Replay: unexpected TX at %u ms.\n",
+                    (uint32_t)(replay.time_us / 1000));
+            }
+            continue;
+        }
+
+        if (record->data[replay_pos++] != buf[i] && replay_mismatch++ == 0) {
+            log("** Replay: TX 0x%02X differs from 0x%02X at %u ms.\n", buf[i],
+                record->data[replay_pos - 1], (uint32_t)(record->time_us / 1000));
+        }
+
+        if (replay_pos == record->len) {
+            replay_anchor_ns = uart_now_ns();
+            replay_anchor_us = record->time_us;
+        }
+    }
+
+    return len;
+}
+
+static int replay_readb(void)
+{
+    bsl430_trace_record_t *record;
+    uint64_t delay_us;
+
+    record = replay_next();
+    if (record == NULL) {
+        return -1;
+    }
+
+    if (record->type == BSL430_TRACE_TX) {
+        /* Read where a write was recorded, time out as the device would. */
+        if (replay_mismatch++ == 0) {
+            log("** Replay: unexpected RX at %u ms.\n", (uint32_t)(record->time_us / 1000));
+        }
+        return -1;
+    }
+
+    delay_us = (record->time_us > replay_anchor_us)? record->time_us - replay_anchor_us: 0;
+    uart_wait_until(replay_anchor_ns + delay_us * 1000);
+
+    if (record->type == BSL430_TRACE_TIMEOUT) {
+        replay_valid = 0;
+        return -1;
+    }
+
+    return record->data[replay_pos++];
+}
+
+static uint64_t uart_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void uart_wait_until(uint64_t deadline)
+{
+    struct timespec ts;
+
+    /* Sleep for the coarse part, then spin through the wakeup latency. */
+    if (deadline > spin_ns && uart_now_ns() < deadline - spin_ns) {
+        ts.tv_sec  = (time_t)((deadline - spin_ns) / 1000000000ULL);
+        ts.tv_nsec = (long)((deadline - spin_ns) % 1000000000ULL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) ;
+    }
+
+    while (uart_now_ns() < deadline) ;
+}
+
+static void uart_calibrate(void)
+{
+    int i;
+    uint64_t t0, t1, late;
+    uint64_t worst = 0;
+    struct timespec ts;
+
+    /* Measure how late clock_nanosleep() wakes up on this host. */
+    for (i = 0; i < UART_CALIBRATE_LOOP; i++) {
+        t0 = uart_now_ns() + 50000;
+        ts.tv_sec  = (time_t)(t0 / 1000000000ULL);
+        ts.tv_nsec = (long)(t0 % 1000000000ULL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) ;
+        t1 = uart_now_ns();
+
+        late = (t1 > t0)? t1 - t0: 0;
+        if (late > worst) {
+            worst = late;
+        }
+    }
+
+    spin_ns = (worst > UART_SPIN_MAX_NS)? UART_SPIN_MAX_NS: worst + 1;
+}
+
+static int gpio_chip_init(void)
+{
+    int chip = -1;
+    int status = 0;
+    /* Running state, RST high and TST low. */
+    int rst = (gpio_config.invert & BSL430_GPIO_RST_INVERT)? 0: 1;
+    int tst = (gpio_config.invert & BSL430_GPIO_TST_INVERT)? 1: 0;
+#ifdef GPIO_V2_GET_LINE_IOCTL
+    struct gpio_v2_line_request req;
+#else
+    struct gpiohandle_request req;
+#endif
+
+    chip = open(gpio_config.device, O_RDWR | O_CLOEXEC);
+    if (chip < 0) {
+        log("Open GPIO chip failed! %s %s\n", gpio_config.device, strerror(errno));
+        return -1;
+    }
+
+    /* One request holds both lines. */
+    memset(&req, 0, sizeof(req));
+#ifdef GPIO_V2_GET_LINE_IOCTL
+    req.offsets[0] = gpio_config.rst;
+    req.offsets[1] = gpio_config.tst;
+    req.num_lines = 2;
+    req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    req.config.num_attrs = 1;
+    req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    req.config.attrs[0].attr.values = (uint64_t)rst << 0 | (uint64_t)tst << 1;
+    req.config.attrs[0].mask = 0x3;
+    strncpy(req.consumer, "bsl430", sizeof(req.consumer) - 1);
+
+    status = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req);
+#else
+    req.lineoffsets[0] = gpio_config.rst;
+    req.lineoffsets[1] = gpio_config.tst;
+    req.lines = 2;
+    req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    req.default_values[0] = (uint8_t)rst;
+    req.default_values[1] = (uint8_t)tst;
+    strncpy(req.consumer_label, "bsl430", sizeof(req.consumer_label) - 1);
+
+    status = ioctl(chip, GPIO_GET_LINEHANDLE_IOCTL, &req);
+#endif
+    close(chip);
+
+    if (status < 0) {
+        log("Request GPIO lines failed! %s\n", strerror(errno));
+        return -1;
+    }
+
+    gpio_fd = req.fd;
+    return 0;
+}
+
+static int gpio_chip_set(int rst, int tst)
+{
+#ifdef GPIO_V2_GET_LINE_IOCTL
+    struct gpio_v2_line_values values;
+#else
+    struct gpiohandle_data values;
+#endif
+
+    if (gpio_fd < 0) {
+        return -1;
+    }
+
+    if (gpio_config.invert & BSL430_GPIO_RST_INVERT) {
+        rst = !rst;
+    }
+    if (gpio_config.invert & BSL430_GPIO_TST_INVERT) {
+        tst = !tst;
+    }
+
+    memset(&values, 0, sizeof(values));
+#ifdef GPIO_V2_GET_LINE_IOCTL
+    values.bits = (uint64_t)rst << 0 | (uint64_t)tst << 1;
+    values.mask = 0x3;
+
+    return (ioctl(gpio_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0)? -1: 0;
+#else
+    values.values[0] = (uint8_t)rst;
+    values.values[1] = (uint8_t)tst;
+
+    return (ioctl(gpio_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &values) < 0)? -1: 0;
+#endif
+}
+
+/*
+ * The tty is opened once and kept by the GPIO, the UART on the same tty
+ * shares the fd, see uart_open(). It is opened without waiting for the
+ * carrier, then set blocking for the reads of the UART.
+ */
+static int gpio_modem_init(void)
+{
+    const char *device = (gpio_config.device)? gpio_config.device: uart_port;
+    int flags = 0;
+
+    gpio_fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (gpio_fd < 0) {
+        log("Open modem lines failed! %s %s\n", device, strerror(errno));
+        return -1;
+    }
+
+    flags = fcntl(gpio_fd, F_GETFL);
+    if (flags < 0 || fcntl(gpio_fd, F_SETFL, flags & ~O_NONBLOCK) < 0 ||
+        gpio_modem_set(gpio_rst_level, gpio_tst_level) != 0) {
+        log("Set modem lines failed! %s %s\n", device, strerror(errno));
+        close(gpio_fd);
+        gpio_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int gpio_modem_set(int rst, int tst)
+{
+    int bits = 0;
+
+    if (gpio_fd < 0 || ioctl(gpio_fd, TIOCMGET, &bits) < 0) {
+        return -1;
+    }
+
+    /* An asserted modem line drives the pin low. */
+    if (gpio_config.invert & BSL430_GPIO_RST_INVERT) {
+        rst = !rst;
+    }
+    if (gpio_config.invert & BSL430_GPIO_TST_INVERT) {
+        tst = !tst;
+    }
+
+    bits &= ~(int)(gpio_config.rst | gpio_config.tst);
+    bits |= (rst == 0)? (int)gpio_config.rst: 0;
+    bits |= (tst == 0)? (int)gpio_config.tst: 0;
+
+    return (ioctl(gpio_fd, TIOCMSET, &bits) < 0)? -1: 0;
+}
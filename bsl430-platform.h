@@ -21,6 +21,8 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "bsl430-uart.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -45,16 +47,48 @@ extern "C" {
 
 #define mdelay(a)   usleep((a) * 1000)
 
-int bsl430_uart_init(int baudrate, int parity);
-int bsl430_uart_term(void);
-int bsl430_uart_readb(uint16_t timeout);
-int bsl430_uart_writeb(uint8_t c);
-int bsl430_uart_clear(void);
+/*
+ * Backends driving RST and TST, see bsl430_gpio_config().
+ *
+ * BSL430_GPIO_HISI:    HiSilicon HI_UNF_GPIO, the lines of hi_board.h.
+ * BSL430_GPIO_CHIP:    Linux GPIO character device. <device> is the
+ *                      gpiochip, <rst> and <tst> are line offsets on it.
+ * BSL430_GPIO_MODEM:   Modem lines of a USB-serial adapter. <device> is the
+ *                      tty (NULL: the UART port), <rst> and <tst> are
+ *                      TIOCM_DTR or TIOCM_RTS.
+ *
+ * <invert> flips the level of a line, <interval> is the time in ms between
+ * two states of the entry sequence (0: 20 ms). bsl430_gpio_get_config()
+ * returns the configuration in use, the built-in default until one is set.
+ *
+ * bsl430_gpio_per_port() tells whether each UART port has lines of its own,
+ * i.e. MODEM on the port's tty, and several ports can be driven at once.
+ */
+#define BSL430_GPIO_HISI        0
+#define BSL430_GPIO_CHIP        1
+#define BSL430_GPIO_MODEM       2
+
+#define BSL430_GPIO_RST_INVERT  0x01
+#define BSL430_GPIO_TST_INVERT  0x02
+
+typedef struct bsl430_gpio_config_s {
+    int         backend;
+    const char *device;
+    uint32_t    rst;
+    uint32_t    tst;
+    int         invert;
+    int         interval;
+} bsl430_gpio_config_t;
 
 int bsl430_gpio_init(void);
 int bsl430_gpio_term(void);
 int bsl430_gpio_rst(int level);
 int bsl430_gpio_tst(int level);
+int bsl430_gpio_set(int rst, int tst);
+int bsl430_gpio_interval(void);
+int bsl430_gpio_per_port(void);
+int bsl430_gpio_config(const bsl430_gpio_config_t *config);
+int bsl430_gpio_get_config(bsl430_gpio_config_t *config);
 
 #ifdef __cplusplus
 }
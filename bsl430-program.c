@@ -18,20 +18,148 @@
 //#define LOG_NDEBUG 0
 #define LOG_TAG "bsl430-program"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "bsl430-platform.h"
 #include "bsl430.h"
 #include "bsl430-program.h"
+#include "bsl430-journal.h"
+#include "bsl430-cache.h"
+#include "bsl430-loader.h"
+#include "bsl430-stream.h"
+#include "bsl430-titxt.h"
+#include "bsl430-session.h"
+#include "bsl430-plan.h"
+#include "bsl430-strategy.h"
+#include "bsl430-merge.h"
 
 
 #define ALIGN(x,a)  __ALIGN_MASK((x),(typeof(x))(a)-1)
 #define __ALIGN_MASK(x,mask)    (((x)+(mask))&~(mask))
 
-#define TITXT_SEGMENT_ALIGN 8
+/* BSL password is the interrupt vector table. */
+#define BSL430_PASSWORD_ADDR    0xFFE0
+
+static const uint8_t bsl430_erased_password[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/* An image loaded, encoded and planned while the device enters the BSL. */
+typedef struct program_prepare_s {
+    const char *const *paths;
+    uint32_t count;
+    titxt_header_t *previous;
+    titxt_header_t *header;
+    bsl430_stream_t stream;
+    bsl430_plan_t plan;
+    int planned;
+    int status;
+    uint32_t ms;
+    int started;
+    pthread_t thread;
+} program_prepare_t;
+
+/* Progress of the programming, see bsl430_program_config_t. */
+static const bsl430_program_config_t *progress_config = NULL;
+static uint32_t progress_done = 0;
+static uint32_t progress_total = 0;
+
+static int program_device_id(char *device);
+static int program_sort(titxt_header_t *header);
+static void program_password(titxt_header_t *header, uint32_t end_segment, uint32_t end_offset,
+                             uint8_t *password);
+static int program_journal_verify(titxt_header_t *header, bsl430_journal_t *journal);
+static void program_span(titxt_header_t *header, uint32_t *address, uint32_t *size);
+static int program_cache_check(const char *path, titxt_header_t *header, bsl430_cache_t *cache);
+static uint16_t program_span_crc(titxt_header_t *header, uint32_t address, uint32_t size);
+static int program_segments(titxt_header_t *header, const bsl430_stream_t *stream,
+                            const char *journal_path, bsl430_journal_t *journal, int erased);
+static int program_loader(titxt_header_t *header, const bsl430_program_config_t *config,
+                          uint16_t *crc);
+static int program_file_segments(titxt_reader_t *reader, int erased);
+static int program_plan(const bsl430_plan_t *plan);
+static int program_probe(titxt_header_t *header);
+static int program_fast(titxt_header_t *header, int erased);
+static uint32_t program_ms(void);
+static void program_stats(void);
+static int program_run(titxt_header_t *header, program_prepare_t *prepare,
+                       const bsl430_program_config_t *config);
+static void *program_prepare(void *arg);
+static int program_join(program_prepare_t *prepare);
+static int program_open(const uint8_t *password, int *erased, int *owned);
+static int program_enter(int *owned);
+static int program_unlock(const uint8_t *password, int *erased, int *owned);
+static void program_progress_start(const bsl430_program_config_t *config, uint32_t total);
+static void program_progress(uint32_t size);
 
 int bsl430_program(titxt_header_t *header)
+{
+    return bsl430_program_ex(header, NULL);
+}
+
+int bsl430_program_ex(titxt_header_t *header, const bsl430_program_config_t *config)
+{
+    return program_run(header, NULL, config);
+}
+
+/*
+ * Load the TI-TXT files, merged if there are several, and program them.
+ * The device enters the BSL while the files are parsed, encoded into a
+ * stream with the CRCs of the segments and frames, and planned from the
+ * previous image, on a thread of its own. Both are joined before the
+ * password, which may be the image's vector table. The entry is ~250 ms
+ * of sleeping, so small images are ready by the time it is done. A file
+ * which fails to parse leaves the BSL without unlocking. config->stream is
+ * not used, the stream is the one prepared.
+ */
+int bsl430_program_load(const char *const *paths, uint32_t count,
+                        const bsl430_program_config_t *config)
+{
+    int status = 0;
+    program_prepare_t prepare;
+
+    if (!paths || count == 0) {
+        return -1;
+    }
+
+    memset(&prepare, 0, sizeof(prepare));
+    prepare.paths = paths;
+    prepare.count = count;
+    prepare.previous = (config)? config->previous: NULL;
+
+    /* In an open session there is no entry to overlap. */
+    prepare.started = (bsl430_session_state() == BSL430_SESSION_CLOSED);
+    if (prepare.started &&
+        pthread_create(&prepare.thread, NULL, program_prepare, &prepare) != 0) {
+        prepare.started = 0;
+    }
+    if (!prepare.started) {
+        program_prepare(&prepare);
+    }
+
+    status = program_run(NULL, &prepare, config);
+
+    program_join(&prepare);
+    bsl430_plan_free(&prepare.plan);
+    bsl430_stream_free(&prepare.stream);
+    free(prepare.header);
+
+    return status;
+}
+
+static int program_run(titxt_header_t *header, program_prepare_t *prepare,
+                       const bsl430_program_config_t *config)
 {
     int status = 0;
     uint8_t password[] = {
@@ -40,46 +168,385 @@ int bsl430_program(titxt_header_t *header)
         "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF" \
         "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF"
     };
-    uint32_t version = 0;
-    uint32_t i = 0;
+    const char *journal_path = (config)? config->journal: NULL;
+    const char *cache_path = (config)? config->cache: NULL;
+    const bsl430_stream_t *stream = (config)? config->stream: NULL;
+    char device[BSL430_DEVICE_ID_SIZE * 2 + 1];
+    bsl430_journal_t journal;
+    bsl430_cache_t cache;
+    int erased = 0;
+    int owned = 0;
+    int resumed = 0;
+    int planned = 0;
+    uint8_t previous[32];
+    bsl430_plan_t plan;
+    bsl430_strategy_t strategy;
+    int optimized = 0;
+    int prepared = 0;
+    uint32_t start = 0;
+    uint32_t i, total = 0;
     titxt_segment_t *segment = NULL;
-    uint16_t crc0, crc1;
 
-    bsl430_enter(1);
+    memset(device, 0, sizeof(device));
+    memset(&journal, 0, sizeof(journal));
+    memset(&cache, 0, sizeof(cache));
+    memset(&plan, 0, sizeof(plan));
+
+    status = program_enter(&owned);
+
+    /* The image is ready, or the entry waits for it. */
+    if (prepare) {
+        if (program_join(prepare) != 0 && status == 0) {
+            status = -1;
+            if (owned) {
+                bsl430_session_close();
+            }
+        }
+        header = prepare->header;
+        stream = &prepare->stream;
+        if (prepare->planned) {
+            memcpy(&plan, &prepare->plan, sizeof(plan));
+            memset(&prepare->plan, 0, sizeof(prepare->plan));
+            prepared = 1;
+        }
+    }
+    if (status != 0) {
+        goto error0;
+    }
+
+    if (stream && stream->segments != header->segments) {
+        log("** Stream is not of the image! Ignored.\n");
+        stream = NULL;
+    }
+
+    journal.image = (stream)? stream->image: bsl430_ti_txt_hash(header);
+    cache.image = journal.image;
+
+    /*
+     * The BSL password is the interrupt vector table, and a wrong one erases
+     * the device, so there is one try. The device most likely runs the
+     * previous image if given, else the image programmed last by the cache,
+     * else this image if the cache is used. The device ID can't be read
+     * before the unlock, so the journal of another device can't be told
+     * apart and doesn't take part: a device interrupted past the vectors is
+     * erased and written again.
+     */
+    if (config && config->previous) {
+        bsl430_ti_txt_password(config->previous, password);
+    } else if (cache_path && bsl430_cache_password(cache_path, password) != 0) {
+        bsl430_ti_txt_password(header, password);
+    }
+
+    status = program_unlock(password, &erased, &owned);
+    if (status != 0) {
+        goto error0;
+    }
+
+    for (i = 0, segment = NULL; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+        total += segment->size;
+    }
+    program_progress_start(config, total);
+
+    if (journal_path || cache_path) {
+        if (program_device_id(device) != 0) {
+            log("** Reading device ID failed! Journal and cache disabled.\n");
+            journal_path = cache_path = NULL;
+        }
+        strcpy(journal.device, device);
+        strcpy(cache.device, device);
+    }
+
+    if (cache_path && !erased && program_cache_check(cache_path, header, &cache) == 0) {
+        log("Device %s is up to date.\n", device);
+        status = 0;
+        goto done;
+    }
+
+    if (journal_path) {
+        journal.segment = journal.offset = 0;
+        if (!erased && bsl430_journal_load(journal_path, &journal) == 0 &&
+            program_journal_verify(header, &journal) == 0) {
+            resumed = 1;
+        } else {
+            journal.segment = journal.offset = 0;
+        }
+    }
+
+    /*
+     * Unlocked by the password of a deployed image. FRAM is written in place
+     * without erase, so it is updated over the image it holds.
+     */
+    if (!erased && !resumed && memcmp(password, bsl430_erased_password, 32) != 0) {
+        log("Device is out of date, updating without erase.\n");
+    }
+
+    /*
+     * Unlocked by the password of the previous image, the device holds it.
+     * Only the bytes which differ are written, see bsl430-plan.h.
+     */
+    if (config && config->previous && !erased && !resumed) {
+        bsl430_ti_txt_password(config->previous, previous);
+        if (memcmp(password, previous, 32) == 0 &&
+            (prepared || bsl430_plan_diff(config->previous, header, &plan) == 0)) {
+            bsl430_plan_print(&plan);
+            planned = 1;
+        }
+    }
+
+    if (config && config->optimize && !config->loader && !resumed) {
+        bsl430_strategy_choose(header, (planned)? &plan: NULL, erased, &strategy);
+        bsl430_strategy_print(&strategy);
+        optimized = 1;
+    }
+
+    /*
+     * The secondary loader writes the whole image and verifies it once, by
+     * one CRC over its span with the gaps erased. The journal doesn't apply.
+     */
+    if (optimized) {
+        log("Strategy %s: predicted %u ms.\n", bsl430_strategy_name(strategy.strategy),
+            (strategy.time_us[strategy.strategy] + 999) / 1000);
+        start = program_ms();
+
+        switch (strategy.strategy) {
+        case BSL430_STRATEGY_ERASE:
+            log("All code FRAM is erased.\n");
+            status = bsl430_session_erase();
+            erased = 1;
+            if (status == 0) {
+                status = program_segments(header, stream, journal_path, &journal, erased);
+            }
+            break;
+        case BSL430_STRATEGY_DELTA:
+            program_progress_start(config, plan.data);
+            status = program_plan(&plan);
+            break;
+        case BSL430_STRATEGY_PROBE:
+            status = program_probe(header);
+            break;
+        case BSL430_STRATEGY_FAST:
+            status = program_fast(header, erased);
+            break;
+        default:
+            status = program_segments(header, stream, journal_path, &journal, erased);
+            break;
+        }
+
+        log("Strategy %s: predicted %u ms, took %u ms.\n", bsl430_strategy_name(strategy.strategy),
+            (strategy.time_us[strategy.strategy] + 999) / 1000, program_ms() - start);
+    } else if (planned) {
+        program_progress_start(config, plan.data);
+        status = program_plan(&plan);
+    } else if (config && config->loader) {
+        if (!owned) {
+            log("** The loader leaves the BSL, it needs a session of its own!\n");
+            status = -1;
+            goto done;
+        }
+        if (!erased) {
+            log("All code FRAM is erased for the loader.\n");
+            bsl430_session_erase();
+            erased = 1;
+        }
+        status = program_loader(header, config, &cache.crc);
+    } else {
+        status = program_segments(header, stream, journal_path, &journal, erased);
+    }
+
+    if (journal_path && status == 0) {
+        bsl430_journal_remove(journal_path, &journal);
+    }
+
+    if (cache_path && status == 0) {
+        program_span(header, &cache.address, &cache.size);
+        bsl430_ti_txt_password(header, cache.password);
+        if ((config && config->loader) ||
+            bsl430_cmd_crc_check(cache.address, (uint16_t)cache.size, &cache.crc) == 0) {
+            bsl430_cache_save(cache_path, &cache);
+        }
+    }
+
+done:
+
+    bsl430_plan_free(&plan);
+    program_stats();
+    bsl430_cost_update();
+
+    log("BSL programming %s.\n\n", (status == 0)? "SUCC": "FAIL");
+
+    /* The device holds this image now, not the erased value. */
+    bsl430_session_dirty();
+    if (owned) {
+        bsl430_session_close();
+    }
+
+error0:
+    bsl430_plan_free(&plan);
+    return status;
+}
+
+/*
+ * Program the TI-TXT file as it is read, see bsl430-titxt.h, so the memory
+ * used doesn't depend on the image size and the parsing overlaps the UART.
+ * The file is read once before entering the BSL, for its vector table and
+ * so that a broken file fails before the device is touched, and once to
+ * program. The journal, the cache records and the loader need the whole
+ * image and are not used, only the password of the cache.
+ */
+int bsl430_program_file(const char *path, const bsl430_program_config_t *config)
+{
+    int status = 0;
+    int n;
+    uint32_t i;
+    uint8_t password[32];
+    uint8_t image_password[32];
+    uint32_t segments = 0, size = 0;
+    titxt_reader_t reader;
+    titxt_block_t block;
+    int erased = 0;
+    int owned = 0;
+
+    if (bsl430_titxt_open(&reader, path) != 0) {
+        return -1;
+    }
+
+    memset(image_password, 0xFF, sizeof(image_password));
+    while ((n = bsl430_titxt_next(&reader, &block)) > 0) {
+        size += block.size;
+        if (block.flags & TITXT_BLOCK_LAST) {
+            segments++;
+        }
+        for (i = 0; i < block.size; i++) {
+            if (block.address + i >= BSL430_PASSWORD_ADDR && block.address + i < 0x10000) {
+                image_password[block.address + i - BSL430_PASSWORD_ADDR] = block.data[i];
+            }
+        }
+    }
+
+    if (n < 0 || bsl430_titxt_rewind(&reader) != 0) {
+        log("** Parsing TI-TXT file failed!\n");
+        bsl430_titxt_close(&reader);
+        return -1;
+    }
+
+    log("TI-TXT file: %u segments, %u Bytes.\n", segments, size);
+
+    if (config && (config->journal || config->loader || config->stream)) {
+        log("** Journal, loader and stream are not used by file streaming.\n");
+    }
 
-    status = bsl430_cmd_change_baudrate(115200);
+    /* The same password choice as bsl430_program_ex(). */
+    memset(password, 0xFF, sizeof(password));
+    if (config && config->previous) {
+        bsl430_ti_txt_password(config->previous, password);
+    } else if (config && config->cache && bsl430_cache_password(config->cache, password) != 0) {
+        memcpy(password, image_password, sizeof(password));
+    }
+
+    status = program_open(password, &erased, &owned);
     if (status != 0) {
-        log("** Change baudrate failed.\n");
         goto error0;
     }
 
-    status = bsl430_cmd_rx_password(password, 32);
-    if (status == BSL430_MSG_PASSWD_ERROR) {
-        log("** Password Error! All code FRAM is erased!\n");
-        bsl430_cmd_rx_password(password, 32);
+    if (!erased && memcmp(password, bsl430_erased_password, 32) != 0) {
+        log("Device is out of date, updating without erase.\n");
+    }
+
+    program_progress_start(config, size);
+
+    status = program_file_segments(&reader, erased);
+
+    program_stats();
+
+    log("BSL programming %s.\n\n", (status == 0)? "SUCC": "FAIL");
+
+    /* The device holds this image now, not the erased value. */
+    bsl430_session_dirty();
+    if (owned) {
+        bsl430_session_close();
     }
 
-    bsl430_cmd_tx_version(&version);
-    log("BSL Version: %08X\n", version);
+error0:
+    bsl430_titxt_close(&reader);
+
+    return status;
+}
+
+/*
+ * Write code segment and verify, block by block into the journal if any.
+ * With a stream, the frames and the CRC are taken from it as they are.
+ *
+ * On an erased device, the blocks of 0xFF hold the erased value already and
+ * are not sent. The CRC check of the segment covers them still.
+ */
+static int program_segments(titxt_header_t *header, const bsl430_stream_t *stream,
+                            const char *journal_path, bsl430_journal_t *journal, int erased)
+{
+    int status = 0;
+    uint32_t i = 0;
+    titxt_segment_t *segment = NULL;
+    uint16_t crc0, crc1;
+    uint32_t offset = 0;
+    uint16_t write_size = 0;
+    const bsl430_stream_frame_t *frame = NULL;
+    uint32_t skipped = 0;
+    uint32_t pending = 0;
 
-    /* Write code segment and verify. */
     for (i = 0; i < header->segments; i++) {
         crc0 = crc1 = 0;
 
-        if (i == 0) {
-            segment = (titxt_segment_t *)((uint8_t *)header + sizeof(titxt_header_t));
-        } else {
-            segment = (titxt_segment_t *)((uint8_t *)segment +
-                                          sizeof(titxt_segment_t) +
-                                          ALIGN(segment->size, TITXT_SEGMENT_ALIGN));
+        segment = bsl430_ti_txt_segment(header, segment);
+
+        if (journal_path && i < journal->segment) {
+            continue;
         }
 
-        crc0 = bsl430_crc16(segment->data, segment->size, 0xFFFF);
+        crc0 = (stream)? stream->segment[i].crc: bsl430_crc16(segment->data, segment->size, 0xFFFF);
 
         log("<<< Segment: @%04X %u Bytes, Crc %04X >>>\n", segment->address, segment->size, crc0);
 
-        status = bsl430_cmd_rx_data_block(segment->address, segment->data, segment->size);
+        offset = (journal_path && i == journal->segment)? journal->offset: 0;
+
+        while (offset < segment->size) {
+            write_size = (segment->size - offset > BSL430_MAX_DATA_SIZE)?
+                         BSL430_MAX_DATA_SIZE: (uint16_t)(segment->size - offset);
+
+            if (stream) {
+                frame = &stream->index[stream->segment[i].frame + offset / BSL430_MAX_DATA_SIZE];
+            }
+
+            if (erased && ((stream)? (frame->flags & BSL430_STREAM_BLANK) != 0:
+                           bsl430_blank(segment->address + offset, segment->data + offset, write_size))) {
+                skipped += write_size;
+            } else if (stream) {
+                status = bsl430_cmd_rx_data_frame(bsl430_stream_frame(stream, frame), frame->len);
+            } else {
+                status = bsl430_cmd_rx_data_block(segment->address + offset,
+                                                  segment->data + offset, write_size);
+            }
+            if (status != 0) {
+                break;
+            }
+
+            offset += write_size;
+            program_progress(write_size);
+
+            /* Synced in batches, it is a rewrite and an fsync each time. */
+            if (journal_path) {
+                journal->segment = i;
+                journal->offset  = offset;
+                if (++pending >= BSL430_JOURNAL_BLOCKS || offset >= segment->size) {
+                    bsl430_journal_save(journal_path, journal);
+                    pending = 0;
+                }
+            }
+        }
+
         if (status != 0) {
+            if (journal_path && pending > 0) {
+                bsl430_journal_save(journal_path, journal);
+            }
             log("** Programing failed! 0x%02X\n", (uint8_t)status);
             break;
         }
@@ -99,109 +566,366 @@ int bsl430_program(titxt_header_t *header)
         }
     }
 
-    log("BSL programming %s.\n\n", (status == 0)? "SUCC": "FAIL");
-
-error0:
-    bsl430_exit();
+    if (skipped > 0) {
+        log("%u Bytes of 0xFF skipped on the erased device.\n", skipped);
+    }
 
     return status;
 }
 
-int bsl430_parse_ti_txt(uint8_t *txt, uint32_t size, uint8_t *buf, uint32_t bufsize)
+titxt_segment_t *bsl430_ti_txt_segment(titxt_header_t *header, titxt_segment_t *segment)
 {
-    char *txt_copy = NULL;
-    char *line = NULL;
-    char *next = NULL;
-    char *arg = NULL;
-    uint32_t segments = 0;
-    titxt_header_t *header = NULL;
-    titxt_segment_t *segment = NULL;
-    uint8_t *data = buf;
-
-    if (txt == NULL || size == 0) {
-        return -1;
+    if (segment == NULL) {
+        return (titxt_segment_t *)((uint8_t *)header + sizeof(titxt_header_t));
     }
 
-    if (buf == NULL || bufsize == 0) {
-        return -1;
-    }
+    return (titxt_segment_t *)((uint8_t *)segment +
+                               sizeof(titxt_segment_t) +
+                               ALIGN(segment->size, TITXT_SEGMENT_ALIGN));
+}
 
-    txt_copy = malloc(size + 1);
-    if (txt_copy == NULL) {
-        return -1;
-    }
+/*
+ * FNV-1a over the address, size and data of all segments.
+ */
+uint32_t bsl430_ti_txt_hash(titxt_header_t *header)
+{
+    uint32_t hash = 0x811C9DC5;
+    uint32_t i, j;
+    titxt_segment_t *segment = NULL;
+    uint8_t field[8];
 
-    /* It's convenient to parse the whole file and each line as strings. */
-    memmove(txt_copy, txt, size);
-    txt_copy[size] = '\0';
+    for (i = 0; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
 
-    line = txt_copy;
-    next = txt_copy;
+        for (j = 0; j < 4; j++) {
+            field[j]     = (uint8_t)(segment->address >> (j * 8));
+            field[j + 4] = (uint8_t)(segment->size >> (j * 8));
+        }
 
-    header = (titxt_header_t *)data;
-    data += sizeof(titxt_header_t);
+        for (j = 0; j < sizeof(field); j++) {
+            hash = (hash ^ field[j]) * 0x01000193;
+        }
 
-    while (*next) {
-        if (*next == '\r' || *next == '\n') {
-            *next = '\0';
-            /* Parse non-empty line. */
-            if (*line) {
-                /* printf("line: %s\n", line); */
-                if (*line == '@') {
-                    /* Start of new segment. */
-                    if (segment == NULL) {
-                        segment = (titxt_segment_t *)data;
-                    } else {
-                        data += (sizeof(titxt_segment_t) + ALIGN(segment->size, TITXT_SEGMENT_ALIGN));
-                        segment = (titxt_segment_t *)data;
-                    }
+        for (j = 0; j < segment->size; j++) {
+            hash = (hash ^ segment->data[j]) * 0x01000193;
+        }
+    }
 
-                    if ((void *)segment >= (void *)(buf + bufsize)) {
-                        log("The TI-TXT file is too big!\n");
-                        free(txt_copy);
-                        return -1;
-                    }
+    return hash;
+}
 
-                    segment->address = strtoul(line + 1, NULL, 16);
-                    segment->size = 0;
+/*
+ * Fill the BSL password from the vector table of the image, 0xFF where it
+ * defines nothing.
+ */
+void bsl430_ti_txt_password(titxt_header_t *header, uint8_t *password)
+{
+    memset(password, 0xFF, 32);
+    program_password(header, header->segments, 0, password);
+}
 
-                    segments++;
-                } else if (*line == 'q') {
-                    /* End of TI-TXT file. */
-                    header->segments = segments;
-                    break;
-                } else {
-                    /* Data line. Please refer to parse_line(). */
-                    while (*line) {
-                        while (*line == ' ' || *line == '\t') {
-                            line++;
-                        }
+static int program_device_id(char *device)
+{
+    uint8_t id[BSL430_DEVICE_ID_SIZE];
+    int i;
 
-                        if (*line == '\0') {
-                            break;
-                        }
+    if (bsl430_device_id(id, sizeof(id)) != 0) {
+        return -1;
+    }
 
-                        arg = line;
+    for (i = 0; i < BSL430_DEVICE_ID_SIZE; i++) {
+        sprintf(&device[i * 2], "%02X", id[i]);
+    }
 
-                        while (*line && (*line != ' ' && *line != '\t')) {
-                            line++;
-                        }
+    return 0;
+}
 
-                        if (*line) {
-                            *line++ = '\0';
-                        }
+/*
+ * Fill the password from the segments before <end_segment> and the first
+ * <end_offset> bytes of <end_segment>.
+ */
+static void program_password(titxt_header_t *header, uint32_t end_segment, uint32_t end_offset,
+                             uint8_t *password)
+{
+    uint32_t i, j, size;
+    titxt_segment_t *segment = NULL;
 
-                        if ((void *)&segment->data[segment->size] >= (void *)(buf + bufsize)) {
-                            log("The TI-TXT file is too big!\n");
-                            free(txt_copy);
-                            return -1;
-                        }
+    for (i = 0; i < header->segments && i <= end_segment; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+        size = (i < end_segment)? segment->size: end_offset;
 
-                        segment->data[segment->size++] = (uint8_t)strtoul(arg, NULL, 16);
-                    }
-                }
+        for (j = 0; j < size && j < segment->size; j++) {
+            if (segment->address + j >= BSL430_PASSWORD_ADDR &&
+                segment->address + j <  BSL430_PASSWORD_ADDR + 32) {
+                password[segment->address + j - BSL430_PASSWORD_ADDR] = segment->data[j];
             }
-            line = next + 1;
+        }
+    }
+}
+
+/*
+ * CRC-confirm what the journal claims has been written before resuming.
+ */
+static int program_journal_verify(titxt_header_t *header, bsl430_journal_t *journal)
+{
+    uint32_t i, size;
+    titxt_segment_t *segment = NULL;
+    uint16_t crc0, crc1;
+
+    if (journal->segment >= header->segments) {
+        return -1;
+    }
+
+    for (i = 0; i <= journal->segment; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+        size = (i < journal->segment)? segment->size: journal->offset;
+        if (size > segment->size) {
+            return -1;
+        }
+
+        if (size == 0) {
+            continue;
+        }
+
+        crc0 = bsl430_crc16(segment->data, size, 0xFFFF);
+        if (bsl430_cmd_crc_check(segment->address, size, &crc1) != 0 || crc0 != crc1) {
+            log("** Journal mismatch @%04X! Start over.\n", segment->address);
+            return -1;
+        }
+    }
+
+    log("Resume from segment %u offset %u.\n", journal->segment, journal->offset);
+
+    return 0;
+}
+
+/*
+ * Read and parse the TI-TXT file into a buffer of <bufsize> bytes allocated,
+ * to be freed by free(). Return NULL on error.
+ */
+titxt_header_t *bsl430_ti_txt_load(const char *filename, uint32_t bufsize)
+{
+    int status = 0;
+    int fd = -1;
+    off_t size = 0;
+    uint8_t *txt = NULL;
+    uint8_t *buf = NULL;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        log("Openning file error (%s). %s\n", filename, strerror(errno));
+        return NULL;
+    }
+
+    size = lseek(fd, 0, SEEK_END);
+    if (size < 0) {
+        log("Getting file size error. %s\n", strerror(errno));
+        goto error0;
+    }
+
+    log("File size: %u Byte.\n", (uint32_t)size);
+    if (size > BSL430_MAX_FW_SIZE) {
+        log("FW size error.\n");
+        goto error0;
+    }
+
+    lseek(fd, 0, SEEK_SET);
+
+    txt = malloc((size_t)size);
+    buf = calloc(1, bufsize);
+    if (txt == NULL || buf == NULL) {
+        log("Allocating buffers error.\n");
+        goto error0;
+    }
+
+    if (read(fd, txt, (size_t)size) != (ssize_t)size) {
+        log("Reading file error. %s\n", strerror(errno));
+        goto error0;
+    }
+
+    status = bsl430_parse_ti_txt(txt, (uint32_t)size, buf, bufsize);
+    if (status != 0) {
+        log("Parsing TI-TXT file error.\n");
+        goto error0;
+    }
+
+    if (program_sort((titxt_header_t *)buf) != 0) {
+        goto error0;
+    }
+
+    free(txt);
+    close(fd);
+
+    return (titxt_header_t *)buf;
+
+error0:
+    free(txt);
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+/*
+ * Put the segments in order of address, as bsl430_merge() leaves them and
+ * bsl430_stream_crc() needs them. A TI-TXT file may have the vectors first.
+ */
+static int program_sort(titxt_header_t *header)
+{
+    uint32_t i, j;
+    uint32_t size;
+    int sorted = 1;
+    uint8_t *copy = NULL;
+    uint8_t *data = NULL;
+    titxt_segment_t *segment = NULL;
+    titxt_segment_t *last = NULL;
+    titxt_segment_t **order = NULL;
+
+    for (i = 0; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+        if (last && segment->address < last->address) {
+            sorted = 0;
+        }
+        last = segment;
+    }
+
+    if (sorted) {
+        return 0;
+    }
+
+    data = (uint8_t *)bsl430_ti_txt_segment(header, NULL);
+    size = (uint32_t)((uint8_t *)bsl430_ti_txt_segment(header, last) - data);
+
+    copy = malloc(size);
+    order = malloc(header->segments * sizeof(*order));
+    if (copy == NULL || order == NULL) {
+        log("Allocating buffers error.\n");
+        free(copy);
+        free(order);
+        return -1;
+    }
+
+    memcpy(copy, data, size);
+
+    /* Insertion sort, an image has a handful of segments. */
+    segment = (titxt_segment_t *)copy;
+    for (i = 0; i < header->segments; i++) {
+        for (j = i; j > 0 && order[j - 1]->address > segment->address; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = segment;
+        segment = (titxt_segment_t *)((uint8_t *)segment + sizeof(titxt_segment_t) +
+                                      ALIGN(segment->size, TITXT_SEGMENT_ALIGN));
+    }
+
+    for (i = 0; i < header->segments; i++) {
+        size = sizeof(titxt_segment_t) + ALIGN(order[i]->size, TITXT_SEGMENT_ALIGN);
+        memcpy(data, order[i], size);
+        data += size;
+    }
+
+    debug("Segments sorted by address.\n");
+
+    free(copy);
+    free(order);
+
+    return 0;
+}
+
+int bsl430_parse_ti_txt(uint8_t *txt, uint32_t size, uint8_t *buf, uint32_t bufsize)
+{
+    char *txt_copy = NULL;
+    char *line = NULL;
+    char *next = NULL;
+    char *arg = NULL;
+    uint32_t segments = 0;
+    titxt_header_t *header = NULL;
+    titxt_segment_t *segment = NULL;
+    uint8_t *data = buf;
+
+    if (txt == NULL || size == 0) {
+        return -1;
+    }
+
+    if (buf == NULL || bufsize == 0) {
+        return -1;
+    }
+
+    txt_copy = malloc(size + 1);
+    if (txt_copy == NULL) {
+        return -1;
+    }
+
+    /* It's convenient to parse the whole file and each line as strings. */
+    memmove(txt_copy, txt, size);
+    txt_copy[size] = '\0';
+
+    line = txt_copy;
+    next = txt_copy;
+
+    header = (titxt_header_t *)data;
+    data += sizeof(titxt_header_t);
+
+    while (*next) {
+        if (*next == '\r' || *next == '\n') {
+            *next = '\0';
+            /* Parse non-empty line. */
+            if (*line) {
+                /* printf("line: %s\n", line); */
+                if (*line == '@') {
+                    /* Start of new segment. */
+                    if (segment == NULL) {
+                        segment = (titxt_segment_t *)data;
+                    } else {
+                        data += (sizeof(titxt_segment_t) + ALIGN(segment->size, TITXT_SEGMENT_ALIGN));
+                        segment = (titxt_segment_t *)data;
+                    }
+
+                    if ((void *)segment >= (void *)(buf + bufsize)) {
+                        log("The TI-TXT file is too big!\n");
+                        free(txt_copy);
+                        return -1;
+                    }
+
+                    segment->address = strtoul(line + 1, NULL, 16);
+                    segment->size = 0;
+
+                    segments++;
+                } else if (*line == 'q') {
+                    /* End of TI-TXT file. */
+                    header->segments = segments;
+                    break;
+                } else {
+                    /* Data line. Please refer to parse_line(). */
+                    while (*line) {
+                        while (*line == ' ' || *line == '\t') {
+                            line++;
+                        }
+
+                        if (*line == '\0') {
+                            break;
+                        }
+
+                        arg = line;
+
+                        while (*line && (*line != ' ' && *line != '\t')) {
+                            line++;
+                        }
+
+                        if (*line) {
+                            *line++ = '\0';
+                        }
+
+                        if ((void *)&segment->data[segment->size] >= (void *)(buf + bufsize)) {
+                            log("The TI-TXT file is too big!\n");
+                            free(txt_copy);
+                            return -1;
+                        }
+
+                        segment->data[segment->size++] = (uint8_t)strtoul(arg, NULL, 16);
+                    }
+                }
+            }
+            line = next + 1;
         }
         next++;
     }
@@ -209,3 +933,591 @@ int bsl430_parse_ti_txt(uint8_t *txt, uint32_t size, uint8_t *buf, uint32_t bufs
     free(txt_copy);
     return 0;
 }
+/*
+ * The span of the segments in code FRAM. The information FRAM lies below
+ * RAM and the TLV, its segments are checked each on their own.
+ */
+static void program_span(titxt_header_t *header, uint32_t *address, uint32_t *size)
+{
+    uint32_t i;
+    uint32_t low = 0xFFFFFFFF, high = 0;
+    titxt_segment_t *segment = NULL;
+
+    for (i = 0; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+        if (segment->address < BSL430_FRAM_LOW) {
+            continue;
+        }
+        if (segment->address < low) {
+            low = segment->address;
+        }
+        if (segment->address + segment->size > high) {
+            high = segment->address + segment->size;
+        }
+    }
+
+    *address = (high > low)? low: 0;
+    *size    = (high > low)? high - low: 0;
+}
+
+/*
+ * One CRC_CHECK over the span of the image in code FRAM against the cached
+ * result of the last programming of this device.
+ */
+static int program_cache_check(const char *path, titxt_header_t *header, bsl430_cache_t *cache)
+{
+    bsl430_cache_t record;
+    uint32_t address = 0, size = 0;
+    uint16_t crc = 0;
+
+    memset(&record, 0, sizeof(record));
+    strcpy(record.device, cache->device);
+
+    if (bsl430_cache_load(path, &record) != 0 || record.image != cache->image) {
+        return -1;
+    }
+
+    program_span(header, &address, &size);
+    if (record.address != address || record.size != size) {
+        return -1;
+    }
+
+    if (bsl430_cmd_crc_check(address, (uint16_t)size, &crc) != 0 || crc != record.crc) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * CRC over the span of the image as the erased device holds it after
+ * programming, i.e. 0xFF between the segments.
+ */
+static uint16_t program_span_crc(titxt_header_t *header, uint32_t address, uint32_t size)
+{
+    uint16_t crc = 0xFFFF;
+    uint32_t i, next;
+    titxt_segment_t *segment = NULL;
+    titxt_segment_t *found = NULL;
+
+    while (size > 0) {
+        /* The segment at or next after the address. */
+        found = NULL;
+        segment = NULL;
+        for (i = 0; i < header->segments; i++) {
+            segment = bsl430_ti_txt_segment(header, segment);
+            if (segment->address + segment->size > address &&
+                (found == NULL || segment->address < found->address)) {
+                found = segment;
+            }
+        }
+
+        next = (found)? found->address: address + size;
+        if (next > address + size) {
+            next = address + size;
+        }
+
+        if (address < next) {
+            crc = bsl430_crc16_extend_const(crc, 0xFF, next - address);
+            size -= next - address;
+            address = next;
+        }
+
+        if (found && size > 0) {
+            i = address - found->address;
+            next = found->size - i;
+            if (next > size) {
+                next = size;
+            }
+            crc = bsl430_crc16(&found->data[i], (int)next, crc);
+            address += next;
+            size    -= next;
+        }
+    }
+
+    return crc;
+}
+
+static int program_loader(titxt_header_t *header, const bsl430_program_config_t *config,
+                          uint16_t *crc)
+{
+    int status = 0;
+    uint32_t i;
+    titxt_segment_t *segment = NULL;
+    uint32_t address = 0, size = 0;
+    uint16_t crc0 = 0, crc1 = 0;
+
+    status = bsl430_loader_start(config->loader, config->loader_entry, config->loader_baudrate);
+    if (status != 0) {
+        log("** Starting loader failed!\n");
+        return status;
+    }
+
+    for (i = 0; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+
+        log("<<< Segment: @%04X %u Bytes >>>\n", segment->address, segment->size);
+
+        status = bsl430_loader_write(segment->address, segment->data, segment->size);
+        if (status != 0) {
+            log("** Programing failed! 0x%02X\n", (uint8_t)status);
+            goto error0;
+        }
+        program_progress(segment->size);
+    }
+
+    for (i = 0, segment = NULL; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+        if (segment->address >= BSL430_FRAM_LOW) {
+            continue;
+        }
+
+        crc0 = bsl430_crc16(segment->data, segment->size, 0xFFFF);
+        status = bsl430_loader_crc(segment->address, segment->size, &crc1);
+        if (status != 0 || crc0 != crc1) {
+            log("** CRC of segment @%04X failed! 0x%04X 0x%04X\n", segment->address, crc0, crc1);
+            status = (status != 0)? status: 1;
+            goto error0;
+        }
+    }
+
+    program_span(header, &address, &size);
+    crc0 = program_span_crc(header, address, size);
+
+    status = bsl430_loader_crc(address, size, crc);
+    if (status != 0) {
+        log("** Checking CRC failed!\n");
+        goto error0;
+    }
+
+    if (crc0 != *crc) {
+        log("** CRC mismatch! 0x%04X 0x%04X\n", crc0, *crc);
+        status = 1;
+        goto error0;
+    }
+
+    log("<<< Span: @%04X %u Bytes, Crc %04X >>>\n", address, size, crc0);
+
+    bsl430_loader_exit();
+
+    return 0;
+
+error0:
+    bsl430_loader_abort();
+    return status;
+}
+
+/*
+ * Write the frames of the plan, then check the CRC of each segment. A
+ * segment that fails holds other than the previous image, it is written
+ * whole and checked again.
+ */
+static int program_plan(const bsl430_plan_t *plan)
+{
+    int status = 0;
+    uint32_t i;
+    uint16_t crc = 0;
+    const bsl430_plan_check_t *check = NULL;
+
+    for (i = 0; i < plan->writes; i++) {
+        status = bsl430_cmd_rx_data_block(plan->write[i].address, (uint8_t *)plan->write[i].data,
+                                          plan->write[i].size);
+        if (status != 0) {
+            log("** Programing failed! 0x%02X\n", (uint8_t)status);
+            return status;
+        }
+        program_progress(plan->write[i].size);
+    }
+
+    for (i = 0; i < plan->checks; i++) {
+        check = &plan->check[i];
+
+        log("<<< Segment: @%04X %u Bytes, Crc %04X >>>\n", check->address, check->size, check->crc);
+
+        status = bsl430_cmd_crc_check(check->address, (uint16_t)check->size, &crc);
+        if (status != 0) {
+            log("** Checking CRC failed!\n");
+            return status;
+        }
+
+        if (crc == check->crc) {
+            continue;
+        }
+
+        log("** Segment doesn't hold the previous image, written whole.\n");
+
+        status = bsl430_cmd_rx_data_block(check->address, (uint8_t *)check->data,
+                                          (uint16_t)check->size);
+        if (status == 0) {
+            status = bsl430_cmd_crc_check(check->address, (uint16_t)check->size, &crc);
+        }
+        if (status != 0) {
+            log("** Programing failed! 0x%02X\n", (uint8_t)status);
+            return status;
+        }
+
+        if (crc != check->crc) {
+            log("** CRC mismatch! 0x%04X 0x%04X\n", check->crc, crc);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Check each block of the segments by CRC_CHECK, and write the ones the
+ * device doesn't hold. Each segment is checked as a whole at the end.
+ */
+static int program_probe(titxt_header_t *header)
+{
+    int status = 0;
+    uint32_t i;
+    uint32_t offset;
+    uint16_t size;
+    uint16_t crc0, crc1;
+    uint32_t written = 0, held = 0;
+    titxt_segment_t *segment = NULL;
+
+    for (i = 0; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+        crc0 = bsl430_crc16(segment->data, segment->size, 0xFFFF);
+
+        log("<<< Segment: @%04X %u Bytes, Crc %04X >>>\n", segment->address, segment->size, crc0);
+
+        for (offset = 0; offset < segment->size; offset += size) {
+            size = (segment->size - offset > BSL430_MAX_DATA_SIZE)?
+                   BSL430_MAX_DATA_SIZE: (uint16_t)(segment->size - offset);
+
+            status = bsl430_cmd_crc_check(segment->address + offset, size, &crc1);
+            if (status != 0) {
+                log("** Checking CRC failed!\n");
+                return status;
+            }
+
+            if (crc1 == bsl430_crc16(segment->data + offset, size, 0xFFFF)) {
+                held += size;
+            } else {
+                status = bsl430_cmd_rx_data_block(segment->address + offset,
+                                                  segment->data + offset, size);
+                if (status != 0) {
+                    log("** Programing failed! 0x%02X\n", (uint8_t)status);
+                    return status;
+                }
+                written += size;
+            }
+            program_progress(size);
+        }
+
+        status = bsl430_cmd_crc_check(segment->address, (uint16_t)segment->size, &crc1);
+        if (status != 0) {
+            log("** Checking CRC failed!\n");
+            return status;
+        }
+
+        if (crc0 != crc1) {
+            log("** CRC mismatch! 0x%04X 0x%04X\n", crc0, crc1);
+            return 1;
+        }
+    }
+
+    log("%u Bytes written, %u Bytes held by the device already.\n", written, held);
+
+    return 0;
+}
+
+/*
+ * Write the segments by RX_DATA_BLOCK_FAST, which is not answered, and wait
+ * for the line to settle before the CRC check of each. A segment which
+ * fails it lost a frame, and is written again by RX_DATA_BLOCK.
+ */
+static int program_fast(titxt_header_t *header, int erased)
+{
+    int status = 0;
+    uint32_t i;
+    uint32_t offset;
+    uint16_t size;
+    uint16_t crc0, crc1;
+    bsl430_cost_t cost;
+    titxt_segment_t *segment = NULL;
+
+    bsl430_cost_get(&cost);
+
+    for (i = 0; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+        crc0 = bsl430_crc16(segment->data, segment->size, 0xFFFF);
+
+        log("<<< Segment: @%04X %u Bytes, Crc %04X >>>\n", segment->address, segment->size, crc0);
+
+        for (offset = 0; offset < segment->size; offset += size) {
+            size = (segment->size - offset > BSL430_MAX_DATA_SIZE)?
+                   BSL430_MAX_DATA_SIZE: (uint16_t)(segment->size - offset);
+
+            if (!erased || !bsl430_blank(segment->address + offset, segment->data + offset, size)) {
+                status = bsl430_cmd_rx_data_block_fast(segment->address + offset,
+                                                       segment->data + offset, size);
+                if (status != 0) {
+                    return status;
+                }
+            }
+            program_progress(size);
+        }
+
+        mdelay((BSL430_FAST_SETTLE_US(&cost) + 999) / 1000);
+        bsl430_uart_clear();
+
+        status = bsl430_cmd_crc_check(segment->address, (uint16_t)segment->size, &crc1);
+        if (status != 0) {
+            log("** Checking CRC failed!\n");
+            return status;
+        }
+
+        if (crc0 == crc1) {
+            continue;
+        }
+
+        log("** Segment lost a frame, written again.\n");
+
+        status = bsl430_cmd_rx_data_block(segment->address, segment->data, (uint16_t)segment->size);
+        if (status == 0) {
+            status = bsl430_cmd_crc_check(segment->address, (uint16_t)segment->size, &crc1);
+        }
+        if (status != 0) {
+            log("** Programing failed! 0x%02X\n", (uint8_t)status);
+            return status;
+        }
+
+        if (crc0 != crc1) {
+            log("** CRC mismatch! 0x%04X 0x%04X\n", crc0, crc1);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Write the blocks as the reader returns them, and check the CRC of each
+ * segment after its last block. The CRC runs over the blocks as they are
+ * read, so the segment size and CRC are only known at its end.
+ */
+static int program_file_segments(titxt_reader_t *reader, int erased)
+{
+    int status = 0;
+    int n;
+    titxt_block_t block;
+    uint16_t crc = 0;
+    uint32_t skipped = 0;
+
+    while ((n = bsl430_titxt_next(reader, &block)) > 0) {
+        if (block.address == block.segment_address) {
+            log("<<< Segment: @%04X >>>\n", block.segment_address);
+        }
+
+        if (block.size == 0) {
+            /* The segment ends at a block boundary. */
+        } else if (erased && bsl430_blank(block.address, block.data, block.size)) {
+            skipped += block.size;
+        } else {
+            status = bsl430_cmd_rx_data_block(block.address, block.data, block.size);
+            if (status != 0) {
+                log("** Programing failed! 0x%02X\n", (uint8_t)status);
+                break;
+            }
+        }
+        program_progress(block.size);
+
+        if (!(block.flags & TITXT_BLOCK_LAST)) {
+            continue;
+        }
+
+        log("<<< Segment: @%04X %u Bytes, Crc %04X >>>\n",
+            block.segment_address, block.segment_size, block.segment_crc);
+
+        status = bsl430_cmd_crc_check(block.segment_address, (uint16_t)block.segment_size, &crc);
+        if (status != 0) {
+            log("** Checking CRC failed!\n");
+            break;
+        }
+
+        if (crc != block.segment_crc) {
+            log("** CRC mismatch! 0x%04X 0x%04X\n", block.segment_crc, crc);
+            status = 1;
+            break;
+        }
+    }
+
+    if (n < 0) {
+        log("** Parsing TI-TXT file failed!\n");
+        status = -1;
+    }
+
+    if (skipped > 0) {
+        log("%u Bytes of 0xFF skipped on the erased device.\n", skipped);
+    }
+
+    return status;
+}
+
+static void program_stats(void)
+{
+    bsl430_uart_stats_t stats;
+    bsl430_link_stats_t link;
+    bsl430_timeout_stats_t timeout;
+    int i;
+
+    bsl430_uart_get_stats(&stats);
+    bsl430_get_link_stats(&link);
+    log("UART TX: %u Bytes in %u ms, %u Bytes/s (paced line rate %u Bytes/s).\n",
+        stats.tx_bytes, (uint32_t)(stats.tx_ns / 1000000), stats.tx_rate, stats.line_rate);
+    log("UART RX: %u Bytes, %u round trips, RTT %u us (max %u us, wire time %u us).\n",
+        stats.rx_bytes, stats.rtt_count, stats.rtt_us, stats.rtt_max_us, stats.rtt_wire_us);
+    if (stats.tx_gap_max_us > 0) {
+        log("UART jitter: characters %u us apart, pacing %u us late at worst.\n",
+            stats.tx_gap_max_us, stats.tx_late_max_us);
+    }
+    log("Link: %u data frames, %u lost (%u ppm), %u retries, data size %u Bytes.\n",
+        link.frames, link.errors, link.error_rate, link.retries, link.data_size);
+
+    for (i = 0; bsl430_get_timeout_stats(i, &timeout) == 0; i++) {
+        if (timeout.samples > 0 || timeout.timeouts > 0) {
+            log("CMD 0x%02X: SRTT %u us, RTTVAR %u us, max %u us, timeout %u ms, %u timeouts.\n",
+                timeout.cmd, timeout.srtt_us, timeout.rttvar_us, timeout.max_us,
+                timeout.rto_ms, timeout.timeouts);
+        }
+    }
+}
+
+/*
+ * Load, encode and plan the image, see bsl430_program_load(). Nothing of
+ * the platform or the session is touched here.
+ */
+static void *program_prepare(void *arg)
+{
+    program_prepare_t *prepare = (program_prepare_t *)arg;
+    uint32_t start = program_ms();
+    struct sched_param param;
+
+    /* Not at the priority of a real-time caller, see bsl430-rt.h. */
+    if (prepare->started) {
+        memset(&param, 0, sizeof(param));
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    }
+
+    if (prepare->count == 1) {
+        prepare->header = bsl430_ti_txt_load(prepare->paths[0], BSL430_MAX_CODE_SIZE);
+    } else {
+        prepare->header = bsl430_merge_load(prepare->paths, prepare->count);
+    }
+
+    if (prepare->header == NULL || bsl430_stream_encode(prepare->header, &prepare->stream) != 0) {
+        prepare->status = -1;
+        return NULL;
+    }
+
+    if (prepare->previous &&
+        bsl430_plan_diff(prepare->previous, prepare->header, &prepare->plan) == 0) {
+        prepare->planned = 1;
+    }
+
+    prepare->ms = program_ms() - start;
+
+    return NULL;
+}
+
+static int program_join(program_prepare_t *prepare)
+{
+    if (prepare->started) {
+        pthread_join(prepare->thread, NULL);
+        prepare->started = 0;
+        if (prepare->status == 0) {
+            debug("Image prepared in %u ms, during the entry.\n", prepare->ms);
+        }
+    }
+
+    return prepare->status;
+}
+
+/*
+ * Enter the BSL at 115200 and unlock it by <password>, by a session of its
+ * own unless one is open, see bsl430-session.h. <owned> is set if it is to
+ * be closed at the end. In a session unlocked already the password is not
+ * sent again, and the session knows if the device is erased.
+ */
+static int program_open(const uint8_t *password, int *erased, int *owned)
+{
+    int status = program_enter(owned);
+
+    if (status != 0) {
+        return status;
+    }
+
+    return program_unlock(password, erased, owned);
+}
+
+/*
+ * Enter the BSL unless the session is open, <owned> if it is entered here.
+ */
+static int program_enter(int *owned)
+{
+    int status = 0;
+
+    *owned = 0;
+    if (bsl430_session_state() == BSL430_SESSION_CLOSED) {
+        status = bsl430_session_open(115200);
+        if (status != 0) {
+            return status;
+        }
+        *owned = 1;
+    }
+
+    /* The RTT measured on the entry. */
+    if (*owned) {
+        bsl430_cost_update();
+    }
+    bsl430_uart_reset_stats();
+    bsl430_reset_link_stats();
+
+    return 0;
+}
+
+static int program_unlock(const uint8_t *password, int *erased, int *owned)
+{
+    int status = 0;
+
+    if (bsl430_session_state() == BSL430_SESSION_UNLOCKED) {
+        *erased = bsl430_session_erased();
+        return 0;
+    }
+
+    status = bsl430_session_unlock(password, erased);
+    if (status != 0 && *owned) {
+        bsl430_session_close();
+        *owned = 0;
+    }
+
+    return status;
+}
+
+static void program_progress_start(const bsl430_program_config_t *config, uint32_t total)
+{
+    progress_config = (config && config->progress)? config: NULL;
+    progress_done = 0;
+    progress_total = total;
+}
+
+static void program_progress(uint32_t size)
+{
+    progress_done += size;
+    if (progress_config) {
+        progress_config->progress(progress_done, progress_total, progress_config->progress_arg);
+    }
+}
+
+static uint32_t program_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
@@ -24,10 +24,17 @@
 extern "C" {
 #endif
 
+#define BSL430_MAX_FW_SIZE  (64 * 1024)
+/* 16KB is enough for MSP430FR2633. */
+#define BSL430_MAX_CODE_SIZE    (32 * 1024)
+
 typedef struct titxt_header_s {
     uint32_t segments;
 } titxt_header_t;
 
+/* The data of a segment is padded to the alignment, the next one follows. */
+#define TITXT_SEGMENT_ALIGN 8
+
 typedef struct titxt_segment_s {
     uint32_t address;
     uint32_t size;
@@ -35,8 +42,57 @@ typedef struct titxt_segment_s {
 } titxt_segment_t;
 
 
+struct bsl430_stream_s;
+
+typedef struct bsl430_program_config_s {
+    /* Checkpoint journal to resume an interrupted programming, or NULL. */
+    const char *journal;
+    /* Flash state cache to skip programming a device up to date, or NULL. */
+    const char *cache;
+    /*
+     * Secondary loader image downloaded into RAM to write the image faster,
+     * or NULL. It is started at loader_entry (0: its first segment) and
+     * switched to loader_baudrate (0: 115200).
+     */
+    titxt_header_t *loader;
+    uint32_t loader_entry;
+    uint32_t loader_baudrate;
+    /*
+     * Frames of the image encoded by bsl430_stream_encode(), or NULL. It is
+     * only read, so one can be shared by the programming of many devices.
+     */
+    const struct bsl430_stream_s *stream;
+    /*
+     * Image deployed on the device, or NULL. Its vector table is the BSL
+     * password tried, so an up to date device is updated without erase.
+     */
+    titxt_header_t *previous;
+    /*
+     * Called after each block with the bytes of the image done so far and
+     * in all, or NULL. The blocks of a resumed journal are not counted.
+     */
+    void (*progress)(uint32_t done, uint32_t total, void *arg);
+    void *progress_arg;
+    /*
+     * Program by the strategy predicted to be the fastest on this link and
+     * device, see bsl430-strategy.h. Not with the loader or a resumed
+     * journal.
+     */
+    int optimize;
+} bsl430_program_config_t;
+
+
 int bsl430_parse_ti_txt(uint8_t *txt, uint32_t size, uint8_t *buf, uint32_t bufsize);
+titxt_header_t *bsl430_ti_txt_load(const char *path, uint32_t bufsize);
 int bsl430_program(titxt_header_t *header);
+int bsl430_program_ex(titxt_header_t *header, const bsl430_program_config_t *config);
+int bsl430_program_file(const char *path, const bsl430_program_config_t *config);
+int bsl430_program_load(const char *const *paths, uint32_t count,
+                        const bsl430_program_config_t *config);
+
+titxt_segment_t *bsl430_ti_txt_segment(titxt_header_t *header, titxt_segment_t *segment);
+uint32_t bsl430_ti_txt_hash(titxt_header_t *header);
+void bsl430_ti_txt_password(titxt_header_t *header, uint8_t *password);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-rt"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-rt.h"
+
+#define RT_PAGE_SIZE    4096
+
+typedef struct rt_thread_s {
+    const bsl430_rt_config_t *config;
+    int (*func)(void *arg);
+    void *arg;
+    int locked;
+    int unlock;     /* nothing was locked before, munlockall() after */
+    int status;
+} rt_thread_t;
+
+static void *rt_main(void *arg);
+static void rt_prefault(void);
+static uint32_t rt_locked_kb(void);
+
+/*
+ * Return what <func> returns, or -1 if the thread can't be started.
+ */
+int bsl430_rt_run(const bsl430_rt_config_t *config, int (*func)(void *arg), void *arg)
+{
+    int status = 0;
+    pthread_t thread;
+    pthread_attr_t attr;
+    rt_thread_t rt;
+    bsl430_rt_config_t defaults = { BSL430_RT_PRIORITY, -1, 1 };
+
+    if (!func) {
+        return -1;
+    }
+
+    rt.config = (config)? config: &defaults;
+    rt.func = func;
+    rt.arg = arg;
+    rt.locked = 0;
+    rt.unlock = 0;
+    rt.status = -1;
+
+    /*
+     * The pages mapped from here on are locked as they are mapped. Locks the
+     * caller took before, even of one buffer, are kept: munlockall() would
+     * drop them too.
+     */
+    if (rt.config->lock) {
+        rt.unlock = (rt_locked_kb() == 0);
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            log("** Locking memory failed! %s\n", strerror(errno));
+            rt.unlock = 0;
+        } else {
+            rt.locked = 1;
+        }
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BSL430_RT_STACK_SIZE);
+    status = pthread_create(&thread, &attr, rt_main, &rt);
+    pthread_attr_destroy(&attr);
+
+    if (status != 0) {
+        log("** Starting the I/O thread failed! %s\n", strerror(status));
+        rt.status = -1;
+    } else {
+        pthread_join(thread, NULL);
+    }
+
+    if (rt.unlock) {
+        munlockall();
+    }
+
+    return rt.status;
+}
+
+/*
+ * The scheduling is set by the thread itself, pthread_attr_setinheritsched()
+ * is not there on every libc.
+ */
+static void *rt_main(void *arg)
+{
+    rt_thread_t *rt = (rt_thread_t *)arg;
+    struct sched_param param;
+    cpu_set_t cpus;
+    int priority = (rt->config->priority > 0)? rt->config->priority: BSL430_RT_PRIORITY;
+    int status = 0;
+
+    if (rt->config->cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(rt->config->cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            log("** Binding to CPU %d failed! %s\n", rt->config->cpu, strerror(errno));
+        }
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    status = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (status != 0) {
+        log("** SCHED_FIFO %d failed! %s. Normal scheduling.\n", priority, strerror(status));
+    }
+
+    rt_prefault();
+
+    log("I/O thread: %s %d, CPU %d, memory %slocked.\n", (status == 0)? "SCHED_FIFO": "SCHED_OTHER",
+        (status == 0)? priority: 0, rt->config->cpu, (rt->locked)? "": "not ");
+
+    rt->status = rt->func(rt->arg);
+
+    return NULL;
+}
+
+/*
+ * Touch the stack the I/O is to use, a page fault is taken here and not
+ * between two characters.
+ */
+static void rt_prefault(void)
+{
+    volatile uint8_t stack[BSL430_RT_PREFAULT];
+    uint32_t i;
+
+    for (i = 0; i < sizeof(stack); i += RT_PAGE_SIZE) {
+        stack[i] = 0;
+    }
+}
+
+/*
+ * VmLck of the process, 0 if it can't be read.
+ */
+static uint32_t rt_locked_kb(void)
+{
+    FILE *fp = NULL;
+    char line[128];
+    uint32_t kb = 0;
+
+    fp = fopen("/proc/self/status", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "VmLck: %u kB", &kb) == 1) {
+            break;
+        }
+    }
+
+    fclose(fp);
+    return kb;
+}
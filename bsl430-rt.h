@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_RT_H__
+#define __BSL430_RT_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Real-time I/O thread
+ *
+ * The BSL protocol is timed by the host: the characters are paced for the
+ * one byte FIFO of the MSP430 UART, a response comes ~1 ms after a frame,
+ * and the entry sequence holds each state of RST/TST for an interval. A
+ * preemption on a loaded host stretches them, which is why the delays of
+ * bsl430.c and bsl430-platform.c keep a margin.
+ *
+ * bsl430_rt_run() runs <func>, e.g. a programming, on a thread of its own
+ * and waits for it. The thread is
+ *
+ *  - scheduled SCHED_FIFO at <priority>, above all normal tasks;
+ *  - bound to <cpu>, e.g. one kept free by isolcpus, if not -1;
+ *  - with the memory of the process locked by mlockall() if <lock>, the
+ *    allocations made meanwhile too, and BSL430_RT_PREFAULT bytes of its
+ *    stack touched first, so the I/O takes no page fault. The memory is
+ *    unlocked after only if nothing was locked before, a caller which
+ *    locked memory itself, all or a buffer, keeps its locks.
+ *
+ * SCHED_FIFO needs CAP_SYS_NICE or RLIMIT_RTPRIO, mlockall() needs
+ * CAP_IPC_LOCK or RLIMIT_MEMLOCK. What is not permitted is logged and the
+ * thread runs without it.
+ *
+ * The jitter is measured in any mode, see bsl430_uart_stats_t: the worst
+ * gap between two characters written and the worst overshoot of a pacing
+ * deadline, along with the worst RTT. bsl430_program_ex() logs them. Take
+ * them under load with and without the thread before the pacing guard or
+ * the response timeouts are narrowed.
+ */
+
+#define BSL430_RT_PRIORITY      50
+#define BSL430_RT_STACK_SIZE    (512 * 1024)
+#define BSL430_RT_PREFAULT      (256 * 1024)
+
+typedef struct bsl430_rt_config_s {
+    int priority;   /* SCHED_FIFO priority, 0: BSL430_RT_PRIORITY */
+    int cpu;        /* the CPU the thread runs on, -1: any */
+    int lock;       /* lock the memory of the process while it runs */
+} bsl430_rt_config_t;
+
+int bsl430_rt_run(const bsl430_rt_config_t *config, int (*func)(void *arg), void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_RT_H__ */
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-session"
+
+#include <string.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-session.h"
+
+static int state = BSL430_SESSION_CLOSED;
+static int erased = 0;
+
+static int session_check(int needed);
+
+/*
+ * Enter the BSL and switch to <baudrate> (0: 115200).
+ */
+int bsl430_session_open(uint32_t baudrate)
+{
+    int status = 0;
+
+    if (state != BSL430_SESSION_CLOSED) {
+        log("** Session is open already.\n");
+        return -1;
+    }
+
+    baudrate = (baudrate)? baudrate: 115200;
+
+    bsl430_enter(1);
+
+    if (baudrate != 9600) {
+        status = bsl430_cmd_change_baudrate(baudrate);
+        if (status != 0) {
+            log("** Change baudrate failed.\n");
+            bsl430_exit();
+            return status;
+        }
+    }
+
+    bsl430_measure_rtt();
+
+    state = BSL430_SESSION_OPEN;
+    erased = 0;
+
+    return 0;
+}
+
+/*
+ * Unlock by the 32 bytes password. A wrong one erases the code FRAM, the
+ * device is unlocked by the erased password then and <erased> is set.
+ */
+int bsl430_session_unlock(const uint8_t *password, int *erased_out)
+{
+    int status = 0;
+    uint8_t buf[32];
+    uint32_t version = 0;
+
+    if (session_check(BSL430_SESSION_OPEN) != 0 || !password) {
+        return -1;
+    }
+
+    memcpy(buf, password, sizeof(buf));
+
+    status = bsl430_cmd_rx_password(buf, sizeof(buf));
+    if (status == BSL430_MSG_PASSWD_ERROR) {
+        log("** Password Error! All code FRAM is erased!\n");
+        memset(buf, 0xFF, sizeof(buf));
+        status = bsl430_cmd_rx_password(buf, sizeof(buf));
+        erased = 1;
+    }
+
+    if (status != 0) {
+        log("** Unlocking failed! 0x%02X\n", (uint8_t)status);
+        return status;
+    }
+
+    bsl430_cmd_tx_version(&version);
+    log("BSL Version: %08X\n", version);
+
+    state = BSL430_SESSION_UNLOCKED;
+    if (erased_out) {
+        *erased_out = erased;
+    }
+
+    return 0;
+}
+
+int bsl430_session_read(uint32_t address, uint8_t *buf, uint16_t size)
+{
+    if (session_check(BSL430_SESSION_UNLOCKED) != 0) {
+        return -1;
+    }
+
+    return bsl430_cmd_tx_data_block(address, size, buf);
+}
+
+int bsl430_session_write(uint32_t address, const uint8_t *data, uint16_t size)
+{
+    if (session_check(BSL430_SESSION_UNLOCKED) != 0) {
+        return -1;
+    }
+
+    /* The device holds more than the erased value from here on. */
+    erased = 0;
+
+    return bsl430_cmd_rx_data_block(address, (uint8_t *)data, size);
+}
+
+int bsl430_session_crc(uint32_t address, uint16_t size, uint16_t *crc)
+{
+    if (session_check(BSL430_SESSION_UNLOCKED) != 0) {
+        return -1;
+    }
+
+    return bsl430_cmd_crc_check(address, size, crc);
+}
+
+/*
+ * Mass erase the code FRAM. The password is the erased one after, the
+ * session is unlocked by it again.
+ */
+int bsl430_session_erase(void)
+{
+    int status = 0;
+    uint8_t password[32];
+
+    if (session_check(BSL430_SESSION_UNLOCKED) != 0) {
+        return -1;
+    }
+
+    status = bsl430_cmd_mass_erase();
+    if (status != 0) {
+        log("** Mass erase failed! 0x%02X\n", (uint8_t)status);
+        return status;
+    }
+
+    memset(password, 0xFF, sizeof(password));
+    status = bsl430_cmd_rx_password(password, sizeof(password));
+    if (status != 0) {
+        state = BSL430_SESSION_OPEN;
+        return status;
+    }
+
+    erased = 1;
+
+    return 0;
+}
+
+int bsl430_session_version(uint32_t *version)
+{
+    if (session_check(BSL430_SESSION_UNLOCKED) != 0) {
+        return -1;
+    }
+
+    return bsl430_cmd_tx_version(version);
+}
+
+/*
+ * Leave the BSL, the device is reset and runs its code.
+ */
+int bsl430_session_close(void)
+{
+    if (state == BSL430_SESSION_CLOSED) {
+        return 0;
+    }
+
+    bsl430_exit();
+
+    state = BSL430_SESSION_CLOSED;
+    erased = 0;
+
+    return 0;
+}
+
+int bsl430_session_state(void)
+{
+    return state;
+}
+
+/*
+ * 1 if the code FRAM is erased and nothing written since, as far as the
+ * session knows.
+ */
+int bsl430_session_erased(void)
+{
+    return erased;
+}
+
+/*
+ * The code FRAM is written by other than bsl430_session_write(), e.g. the
+ * programming, and holds more than the erased value.
+ */
+void bsl430_session_dirty(void)
+{
+    erased = 0;
+}
+
+static int session_check(int needed)
+{
+    if (state < needed) {
+        log("** Session is not %s.\n", (needed == BSL430_SESSION_OPEN)? "open": "unlocked");
+        return -1;
+    }
+
+    return 0;
+}
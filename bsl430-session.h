@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_SESSION_H__
+#define __BSL430_SESSION_H__
+
+#include <stdint.h>
+
+#include "bsl430.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * BSL session
+ *
+ * bsl430_session_open() enters the BSL once and switches to the baudrate
+ * asked, then any number of operations run on the device until
+ * bsl430_session_close() resets it:
+ *
+ *      bsl430_session_open(115200);
+ *      bsl430_session_unlock(password, &erased);
+ *      bsl430_session_write(0x1800, cal, sizeof(cal));
+ *      bsl430_session_read(0x1800, buf, sizeof(buf));
+ *      bsl430_session_version(&version);
+ *      bsl430_session_close();
+ *
+ * The GPIO and the platform are initialized once per process, the entry
+ * sequence, the 9600 baud probe and the baudrate change once per session.
+ * bsl430_program_ex() and bsl430_program_file() program within a session
+ * open, and leave it open; else they open and close one of their own.
+ *
+ * There is one session at a time, on the UART of bsl430_uart_port().
+ */
+
+#define BSL430_SESSION_CLOSED   0
+#define BSL430_SESSION_OPEN     1
+#define BSL430_SESSION_UNLOCKED 2
+
+int bsl430_session_open(uint32_t baudrate);
+int bsl430_session_unlock(const uint8_t *password, int *erased);
+int bsl430_session_read(uint32_t address, uint8_t *buf, uint16_t size);
+int bsl430_session_write(uint32_t address, const uint8_t *data, uint16_t size);
+int bsl430_session_crc(uint32_t address, uint16_t size, uint16_t *crc);
+int bsl430_session_erase(void);
+int bsl430_session_version(uint32_t *version);
+int bsl430_session_close(void);
+
+int bsl430_session_state(void);
+int bsl430_session_erased(void);
+void bsl430_session_dirty(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_SESSION_H__ */
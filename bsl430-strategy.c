@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-strategy"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-strategy.h"
+
+/* Frames on the wire: header, NL NH, command, address and CKL CKH. */
+#define COST_WRITE_TX       (3 + 4 + 2)
+/* ACK and the message back. */
+#define COST_WRITE_RX       (1 + 3 + 2 + 2)
+#define COST_CRC_TX         (3 + 6 + 2)
+#define COST_CRC_RX         (1 + 3 + 3 + 2)
+#define COST_ERASE_TX       (3 + 1 + 2)
+#define COST_PASSWORD_TX    (3 + 33 + 2)
+/* Bytes written before the achieved rate is taken. */
+#define COST_RATE_BYTES     4096
+/* The silence bsl430_uart_clear() waits for. */
+#define COST_CLEAR_US       10000
+
+#define CMD_MASS_ERASE      0x15
+#define CMD_CRC_CHECK       0x16
+
+/*
+ * 11 bits of 8E1 at 115200 baud, the sending delay of bsl430.c, and a lost
+ * frame costs the floor of the response timeout and the resync.
+ */
+#define COST_DEFAULT    { 95486, 5000, 1000, 1500, 10000, 0, 30000 }
+
+static const bsl430_cost_t cost_default = COST_DEFAULT;
+
+static const char *strategy_names[BSL430_STRATEGIES] = {
+    "full", "erase", "delta", "probe", "fast"
+};
+
+static bsl430_cost_t cost_model = COST_DEFAULT;
+static uint32_t cost_line_rate = 0;
+static int cost_measured = 0;
+
+static uint32_t cost_wire(const bsl430_cost_t *cost, uint32_t bytes);
+static uint32_t cost_write(const bsl430_cost_t *cost, uint32_t size);
+static uint32_t cost_fast(const bsl430_cost_t *cost, uint32_t size);
+static uint32_t cost_crc(const bsl430_cost_t *cost);
+static int strategy_changed(const bsl430_plan_t *plan, uint32_t address, uint32_t size);
+
+void bsl430_cost_get(bsl430_cost_t *cost)
+{
+    if (cost) {
+        memcpy(cost, &cost_model, sizeof(*cost));
+    }
+}
+
+void bsl430_cost_reset(void)
+{
+    memcpy(&cost_model, &cost_default, sizeof(cost_model));
+    cost_line_rate = 0;
+    cost_measured = 0;
+}
+
+/*
+ * Take the stats of the UART, the link and the response timeouts into the
+ * cost model, before they are reset. A part which is not measured keeps its
+ * value, the error rate is averaged over the programmings.
+ */
+void bsl430_cost_update(void)
+{
+    bsl430_uart_stats_t stats;
+    bsl430_link_stats_t link;
+    bsl430_timeout_stats_t timeout;
+    int i;
+
+    /*
+     * The rate achieved has the overshoots of the pacing in it, once there
+     * are enough bytes for the overhead of each write not to count. Until a
+     * programming measures it, the line rate and the RTT of the entry are
+     * taken.
+     */
+    bsl430_uart_get_stats(&stats);
+    if (stats.line_rate > 0 && stats.line_rate != cost_line_rate) {
+        cost_line_rate = stats.line_rate;
+        cost_model.byte_ns = 1000000000 / stats.line_rate;
+        cost_measured = 0;
+    }
+    if (stats.tx_bytes >= COST_RATE_BYTES || !cost_measured) {
+        if (stats.tx_bytes >= COST_RATE_BYTES && stats.tx_rate > 0) {
+            cost_model.byte_ns = 1000000000 / stats.tx_rate;
+            cost_measured = 1;
+        }
+        if (stats.rtt_count > 0) {
+            cost_model.turnaround_us = (stats.rtt_us > stats.rtt_wire_us)?
+                                       stats.rtt_us - stats.rtt_wire_us: 0;
+        }
+    }
+
+    bsl430_get_link_stats(&link);
+    if (link.frames > 0) {
+        cost_model.error_ppm = (cost_model.error_ppm * 3 + link.error_rate) / 4;
+    }
+
+    for (i = 0; bsl430_get_timeout_stats(i, &timeout) == 0; i++) {
+        if (timeout.samples == 0) {
+            continue;
+        }
+        if (timeout.cmd == CMD_CRC_CHECK) {
+            cost_model.crc_us = timeout.srtt_us;
+        } else if (timeout.cmd == CMD_MASS_ERASE) {
+            cost_model.erase_us = timeout.srtt_us;
+        }
+    }
+
+    debug("Cost: byte %u ns, turnaround %u us, CRC %u us, erase %u us, %u ppm lost.\n",
+          cost_model.byte_ns, cost_model.turnaround_us, cost_model.crc_us,
+          cost_model.erase_us, cost_model.error_ppm);
+}
+
+/*
+ * Predict the time of each strategy by the cost model, in the blocks of
+ * BSL430_MAX_DATA_SIZE bsl430_program_ex() writes. <plan> is the update
+ * from the image the device holds, or NULL if it's not known. Return the
+ * cheapest strategy.
+ */
+int bsl430_strategy_choose(titxt_header_t *header, const bsl430_plan_t *plan, int erased,
+                           bsl430_strategy_t *strategy)
+{
+    const bsl430_cost_t *cost = &cost_model;
+    uint64_t full = 0, erase = 0, probe = 0, fast = 0, delta = 0;
+    uint64_t segment_full, segment_fast;
+    uint32_t frames;
+    uint32_t i, offset, size;
+    uint32_t blocks = 0, changed = 0;
+    titxt_segment_t *segment = NULL;
+
+    if (!header || !strategy) {
+        return -1;
+    }
+
+    for (i = 0; i < header->segments; i++) {
+        segment = bsl430_ti_txt_segment(header, segment);
+
+        segment_full = segment_fast = 0;
+        frames = 0;
+
+        for (offset = 0; offset < segment->size; offset += size) {
+            size = (segment->size - offset > BSL430_MAX_DATA_SIZE)?
+                   BSL430_MAX_DATA_SIZE: segment->size - offset;
+
+            if (!bsl430_blank(segment->address + offset, segment->data + offset, size)) {
+                erase += cost_write(cost, size);
+            } else if (erased) {
+                continue;
+            }
+
+            segment_full += cost_write(cost, size);
+            segment_fast += cost_fast(cost, size);
+            frames++;
+
+            blocks++;
+            probe += cost_crc(cost);
+            if (!plan) {
+                probe += (uint64_t)cost_write(cost, size) * BSL430_PROBE_CHANGED / 100;
+            } else if (strategy_changed(plan, segment->address + offset, size)) {
+                probe += cost_write(cost, size);
+                changed++;
+            }
+        }
+
+        full += segment_full + cost_crc(cost);
+        erase += cost_crc(cost);
+        probe += cost_crc(cost);
+
+        /* A lost frame is found by the CRC check, and the segment written again. */
+        fast += segment_fast + BSL430_FAST_SETTLE_US(cost) + COST_CLEAR_US + cost_crc(cost) +
+                (segment_full + cost_crc(cost)) *
+                ((frames * cost->error_ppm < 1000000)? frames * cost->error_ppm: 1000000) / 1000000;
+    }
+
+    erase += cost->frame_us + cost_wire(cost, COST_ERASE_TX + COST_WRITE_RX) + cost->erase_us +
+             cost->frame_us + cost_wire(cost, COST_PASSWORD_TX + COST_WRITE_RX) +
+             cost->turnaround_us;
+
+    if (plan) {
+        for (i = 0; i < plan->writes; i++) {
+            delta += cost_write(cost, plan->write[i].size);
+        }
+        delta += (uint64_t)plan->checks * cost_crc(cost);
+    }
+
+    strategy->time_us[BSL430_STRATEGY_FULL]  = (uint32_t)full;
+    strategy->time_us[BSL430_STRATEGY_ERASE] = (erased)? BSL430_COST_NA: (uint32_t)erase;
+    strategy->time_us[BSL430_STRATEGY_DELTA] = (plan && !erased)? (uint32_t)delta: BSL430_COST_NA;
+    strategy->time_us[BSL430_STRATEGY_PROBE] = (erased)? BSL430_COST_NA: (uint32_t)probe;
+    strategy->time_us[BSL430_STRATEGY_FAST]  = (uint32_t)fast;
+
+    strategy->strategy = BSL430_STRATEGY_FULL;
+    for (i = 1; i < BSL430_STRATEGIES; i++) {
+        if (strategy->time_us[i] < strategy->time_us[strategy->strategy]) {
+            strategy->strategy = (int)i;
+        }
+    }
+
+    debug("Strategy: %u blocks, %u changed by the plan.\n", blocks, changed);
+
+    return strategy->strategy;
+}
+
+const char *bsl430_strategy_name(int strategy)
+{
+    if (strategy < 0 || strategy >= BSL430_STRATEGIES) {
+        return "unknown";
+    }
+
+    return strategy_names[strategy];
+}
+
+void bsl430_strategy_print(const bsl430_strategy_t *strategy)
+{
+    char buf[128];
+    int i, n = 0;
+
+    for (i = 0; i < BSL430_STRATEGIES; i++) {
+        if (strategy->time_us[i] == BSL430_COST_NA) {
+            continue;
+        }
+        n += snprintf(&buf[n], sizeof(buf) - n, " %s %u ms,", strategy_names[i],
+                      (strategy->time_us[i] + 999) / 1000);
+    }
+    if (n > 0) {
+        buf[n - 1] = '\0';
+    }
+
+    log("Strategy:%s. Cost byte %u ns, turnaround %u us, CRC %u us, %u ppm lost.\n",
+        (n > 0)? buf: " none", cost_model.byte_ns, cost_model.turnaround_us,
+        cost_model.crc_us, cost_model.error_ppm);
+}
+
+static uint32_t cost_wire(const bsl430_cost_t *cost, uint32_t bytes)
+{
+    return (uint32_t)((uint64_t)bytes * cost->byte_ns / 1000);
+}
+
+/*
+ * RX_DATA_BLOCK and its message, and the retry of the frames lost.
+ */
+static uint32_t cost_write(const bsl430_cost_t *cost, uint32_t size)
+{
+    uint32_t us = cost->frame_us + cost_wire(cost, size + COST_WRITE_TX + COST_WRITE_RX) +
+                  cost->turnaround_us;
+
+    return us + (uint32_t)((uint64_t)(us + cost->retry_us) * cost->error_ppm / 1000000);
+}
+
+static uint32_t cost_fast(const bsl430_cost_t *cost, uint32_t size)
+{
+    return cost->frame_us + cost_wire(cost, size + COST_WRITE_TX);
+}
+
+static uint32_t cost_crc(const bsl430_cost_t *cost)
+{
+    return cost->frame_us + cost_wire(cost, COST_CRC_TX + COST_CRC_RX - 1) + cost->crc_us;
+}
+
+static int strategy_changed(const bsl430_plan_t *plan, uint32_t address, uint32_t size)
+{
+    uint32_t i;
+
+    for (i = 0; i < plan->writes; i++) {
+        if (plan->write[i].address < address + size &&
+            plan->write[i].address + plan->write[i].size > address) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
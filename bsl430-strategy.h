@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_STRATEGY_H__
+#define __BSL430_STRATEGY_H__
+
+#include <stdint.h>
+
+#include "bsl430.h"
+#include "bsl430-program.h"
+#include "bsl430-plan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Programming strategy by cost
+ *
+ * The strategies of bsl430_program_ex() with optimize set:
+ *
+ * BSL430_STRATEGY_FULL:    RX_DATA_BLOCK of every block, blocks of 0xFF
+ *                          skipped on an erased device.
+ * BSL430_STRATEGY_ERASE:   MASS_ERASE first, then the blocks which are not
+ *                          0xFF. All code FRAM is erased, as for the loader.
+ * BSL430_STRATEGY_DELTA:   the writes of bsl430_plan_diff(), for a device
+ *                          holding the previous image.
+ * BSL430_STRATEGY_PROBE:   CRC_CHECK of each block first, only the blocks
+ *                          which differ are written.
+ * BSL430_STRATEGY_FAST:    RX_DATA_BLOCK_FAST, the blocks are not answered
+ *                          and a segment with a lost one fails its CRC check
+ *                          and is written again by RX_DATA_BLOCK.
+ *
+ * Each segment is checked by one CRC_CHECK at the end whatever the strategy.
+ *
+ * The cost model holds the time of each part of a frame. It starts from
+ * the defaults at 115200 baud and bsl430_cost_update() takes the measures
+ * of the UART, the link and the response timeouts into it, see bsl430.h,
+ * from the RTT measured on the entry or from the last programming.
+ *
+ * bsl430_strategy_choose() predicts the time of each strategy which applies
+ * to the image and the device, BSL430_COST_NA else, and picks the cheapest.
+ * The device content is known by the plan, if any. Without one, PROBE
+ * expects BSL430_PROBE_CHANGED percent of the blocks to differ.
+ */
+
+#define BSL430_STRATEGY_FULL    0
+#define BSL430_STRATEGY_ERASE   1
+#define BSL430_STRATEGY_DELTA   2
+#define BSL430_STRATEGY_PROBE   3
+#define BSL430_STRATEGY_FAST    4
+#define BSL430_STRATEGIES       5
+
+#define BSL430_COST_NA          0xFFFFFFFF
+#define BSL430_PROBE_CHANGED    50
+
+/* The fast frames may be ACKed, the input is cleared after this long. */
+#define BSL430_FAST_SETTLE_US(cost) (2000 + 2 * (cost)->turnaround_us)
+
+typedef struct bsl430_cost_s {
+    uint32_t byte_ns;       /* a character on the wire at the current baudrate */
+    uint32_t frame_us;      /* per frame sent, the sending delay */
+    uint32_t turnaround_us; /* a response besides the wire time, USB latency mostly */
+    uint32_t crc_us;        /* CRC_CHECK from the frame sent to its ACK */
+    uint32_t erase_us;      /* MASS_ERASE from the frame sent to its ACK */
+    uint32_t error_ppm;     /* data frames lost per million */
+    uint32_t retry_us;      /* a lost frame, the timeout and the resync */
+} bsl430_cost_t;
+
+typedef struct bsl430_strategy_s {
+    int strategy;                           /* the cheapest */
+    uint32_t time_us[BSL430_STRATEGIES];    /* predicted, or BSL430_COST_NA */
+} bsl430_strategy_t;
+
+void bsl430_cost_get(bsl430_cost_t *cost);
+void bsl430_cost_update(void);
+void bsl430_cost_reset(void);
+
+int bsl430_strategy_choose(titxt_header_t *header, const bsl430_plan_t *plan, int erased,
+                           bsl430_strategy_t *strategy);
+const char *bsl430_strategy_name(int strategy);
+void bsl430_strategy_print(const bsl430_strategy_t *strategy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_STRATEGY_H__ */
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-stream"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-stream.h"
+
+/* Header, NL NH, command and address before the data of a frame. */
+#define STREAM_DATA_OFFSET  7
+
+
+/*
+ * Return 0, or -1 if a segment is out of the writable memory, see
+ * bsl430_cmd_rx_data_block(), or overlapping. Free it by bsl430_stream_free().
+ */
+int bsl430_stream_encode(titxt_header_t *header, bsl430_stream_t *stream)
+{
+    uint32_t i;
+    uint32_t offset;
+    uint32_t frames = 0;
+    uint32_t size = 0;
+    uint32_t end = 0;
+    titxt_segment_t *seg = NULL;
+    bsl430_stream_segment_t *segment = NULL;
+    bsl430_stream_frame_t *index = NULL;
+    uint8_t *buf = NULL;
+    uint16_t write_size;
+    int n;
+
+    if (!header || !stream) {
+        return -1;
+    }
+
+    memset(stream, 0, sizeof(*stream));
+
+    /*
+     * Sizes first, for one allocation each. bsl430_ti_txt_load() and
+     * bsl430_merge() sort the segments, bsl430_stream_crc() needs them so.
+     */
+    for (i = 0; i < header->segments; i++) {
+        seg = bsl430_ti_txt_segment(header, seg);
+        if (seg->address < end) {
+            log("** Segment @%04X is overlapping or out of order!\n", seg->address);
+            return -1;
+        }
+        end = seg->address + seg->size;
+
+        n = (seg->size + BSL430_MAX_DATA_SIZE - 1) / BSL430_MAX_DATA_SIZE;
+        frames += n;
+        size   += n * (BSL430_RX_DATA_FRAME_SIZE - BSL430_MAX_DATA_SIZE) + seg->size;
+    }
+
+    segment = calloc(header->segments + 1, sizeof(*segment));
+    index = calloc(frames + 1, sizeof(*index));
+    buf = malloc(size + 1);
+    if (!segment || !index || !buf) {
+        log("** Allocating stream failed!\n");
+        goto error0;
+    }
+
+    frames = size = 0;
+    seg = NULL;
+
+    for (i = 0; i < header->segments; i++) {
+        seg = bsl430_ti_txt_segment(header, seg);
+
+        segment[i].address = seg->address;
+        segment[i].size    = seg->size;
+        segment[i].frame   = frames;
+        segment[i].crc     = bsl430_crc16(seg->data, seg->size, 0xFFFF);
+
+        for (offset = 0; offset < seg->size; offset += write_size) {
+            write_size = (seg->size - offset > BSL430_MAX_DATA_SIZE)?
+                         BSL430_MAX_DATA_SIZE: (uint16_t)(seg->size - offset);
+
+            n = bsl430_encode_rx_data_block(seg->address + offset, seg->data + offset,
+                                            write_size, &buf[size]);
+            if (n < 0) {
+                log("** Segment @%04X %u Bytes can't be written!\n", seg->address, seg->size);
+                goto error0;
+            }
+
+            index[frames].offset = size;
+            index[frames].len    = (uint16_t)n;
+            index[frames].size   = write_size;
+            index[frames].crc    = bsl430_crc16(seg->data + offset, write_size, 0xFFFF);
+            index[frames].flags  = (bsl430_blank(seg->address + offset, seg->data + offset,
+                                                 write_size))? BSL430_STREAM_BLANK: 0;
+            frames++;
+            size += n;
+        }
+
+        segment[i].frames = frames - segment[i].frame;
+    }
+
+    stream->image    = bsl430_ti_txt_hash(header);
+    stream->segments = header->segments;
+    stream->frames   = frames;
+    stream->size     = size;
+    stream->segment  = segment;
+    stream->index    = index;
+    stream->buf      = buf;
+
+    debug("Stream: %u segments, %u frames, %u Bytes.\n", stream->segments, frames, size);
+
+    return 0;
+
+error0:
+    free(segment);
+    free(index);
+    free(buf);
+    return -1;
+}
+
+int bsl430_stream_free(bsl430_stream_t *stream)
+{
+    if (!stream) {
+        return -1;
+    }
+
+    free((void *)stream->segment);
+    free((void *)stream->index);
+    free((void *)stream->buf);
+    memset(stream, 0, sizeof(*stream));
+
+    return 0;
+}
+
+const uint8_t *bsl430_stream_frame(const bsl430_stream_t *stream,
+                                  const bsl430_stream_frame_t *frame)
+{
+    return (frame->flags & BSL430_STREAM_PATCHED)? &stream->patch[frame->offset]:
+                                                    &stream->buf[frame->offset];
+}
+
+/*
+ * The CRC over <size> bytes at <address>, the gaps between the segments
+ * erased. A segment or a frame inside the range is taken by its CRC.
+ */
+uint16_t bsl430_stream_crc(const bsl430_stream_t *stream, uint32_t address, uint32_t size)
+{
+    uint16_t crc = 0xFFFF;
+    uint32_t end = address + size;
+    uint32_t i, j;
+    uint32_t start, to;
+    const bsl430_stream_segment_t *segment = NULL;
+    const bsl430_stream_frame_t *frame = NULL;
+
+    for (i = 0; i < stream->segments && address < end; i++) {
+        segment = &stream->segment[i];
+
+        if (segment->address + segment->size <= address) {
+            continue;
+        }
+        if (segment->address >= end) {
+            break;
+        }
+
+        if (segment->address > address) {
+            crc = bsl430_crc16_extend_const(crc, 0xFF, segment->address - address);
+            address = segment->address;
+        }
+
+        if (address == segment->address && segment->address + segment->size <= end) {
+            crc = bsl430_crc16_combine(crc, segment->crc, segment->size);
+            address += segment->size;
+            continue;
+        }
+
+        for (j = 0; j < segment->frames && address < end; j++) {
+            frame = &stream->index[segment->frame + j];
+            start = segment->address + j * BSL430_MAX_DATA_SIZE;
+
+            if (start + frame->size <= address) {
+                continue;
+            }
+
+            if (start == address && start + frame->size <= end) {
+                crc = bsl430_crc16_combine(crc, frame->crc, frame->size);
+                address += frame->size;
+                continue;
+            }
+
+            to = (start + frame->size < end)? start + frame->size: end;
+            crc = bsl430_crc16(bsl430_stream_frame(stream, frame) + STREAM_DATA_OFFSET +
+                               address - start, (int)(to - address), crc);
+            address = to;
+        }
+    }
+
+    if (address < end) {
+        crc = bsl430_crc16_extend_const(crc, 0xFF, end - address);
+    }
+
+    return crc;
+}
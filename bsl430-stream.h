@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_STREAM_H__
+#define __BSL430_STREAM_H__
+
+#include <stdint.h>
+
+#include "bsl430.h"
+#include "bsl430-program.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pre-encoded frame stream of an image
+ *
+ * bsl430_stream_encode() builds the RX_DATA_BLOCK frames of all segments
+ * once, header, payload and FCS, back to back in one buffer, with an index
+ * of the frames and of the segments with their CRC. The stream is not
+ * written after, so any number of sessions and threads can share it, each
+ * device only writes the frames and checks the responses.
+ *
+ * Frames of a segment are BSL430_MAX_DATA_SIZE blocks from its start, the
+ * block at <offset> is index[segment[i].frame + offset / BSL430_MAX_DATA_SIZE].
+ *
+ * bsl430_stream_crc() returns what CRC_CHECK over any range answers on a
+ * device holding the image with 0xFF around it, from the CRCs of the
+ * segments and the frames and bsl430_crc16_combine(). Only the bytes of a
+ * frame cut by the range are hashed, so the whole code FRAM costs as much
+ * as a segment. It needs the segments in order of address, as
+ * bsl430_ti_txt_load() and bsl430_merge() sort them; bsl430_stream_encode()
+ * fails on overlapping ones.
+ *
+ * A stream of a unit, see bsl430-patch.h, shares the frames of the base
+ * and has those it edits re-encoded in <patch>. Take the bytes of a frame
+ * by bsl430_stream_frame().
+ */
+
+/* All data bytes are 0xFF in code FRAM, nothing to write on an erased device. */
+#define BSL430_STREAM_BLANK     0x0001
+/* The frame is in patch, not in buf. */
+#define BSL430_STREAM_PATCHED   0x0002
+
+typedef struct bsl430_stream_frame_s {
+    uint32_t offset;        /* of the frame in buf */
+    uint16_t len;           /* of the frame on the wire */
+    uint16_t size;          /* data bytes */
+    uint16_t crc;           /* of the data bytes */
+    uint32_t flags;
+} bsl430_stream_frame_t;
+
+typedef struct bsl430_stream_segment_s {
+    uint32_t address;
+    uint32_t size;
+    uint32_t frame;         /* first frame */
+    uint32_t frames;
+    uint16_t crc;
+} bsl430_stream_segment_t;
+
+typedef struct bsl430_stream_s {
+    uint32_t image;         /* bsl430_ti_txt_hash() */
+    uint32_t segments;
+    uint32_t frames;
+    uint32_t size;
+    const bsl430_stream_segment_t *segment;
+    const bsl430_stream_frame_t *index;
+    const uint8_t *buf;
+    const uint8_t *patch;   /* frames re-encoded by bsl430_patch_apply(), or NULL */
+} bsl430_stream_t;
+
+int bsl430_stream_encode(titxt_header_t *header, bsl430_stream_t *stream);
+int bsl430_stream_free(bsl430_stream_t *stream);
+const uint8_t *bsl430_stream_frame(const bsl430_stream_t *stream,
+                                  const bsl430_stream_frame_t *frame);
+uint16_t bsl430_stream_crc(const bsl430_stream_t *stream, uint32_t address, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_STREAM_H__ */
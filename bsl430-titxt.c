@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-titxt"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-titxt.h"
+
+/* Parser states, the line so far. */
+#define TITXT_LINE      0       /* at the start, or blank */
+#define TITXT_ADDRESS   1       /* '@' and the address digits */
+#define TITXT_TAIL      2       /* the address, then only blanks */
+#define TITXT_DATA      3       /* data bytes */
+
+#define TITXT_EOF       (-1)
+#define TITXT_ERROR     (-2)
+
+static int titxt_getc(titxt_reader_t *reader);
+static int titxt_hex(int c);
+static int titxt_block(titxt_reader_t *reader, titxt_block_t *block, uint16_t flags);
+
+int bsl430_titxt_open(titxt_reader_t *reader, const char *path)
+{
+    memset(reader, 0, sizeof(*reader));
+
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0) {
+        log("Openning file error (%s). %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    reader->line = 1;
+    reader->state = TITXT_LINE;
+
+    return 0;
+}
+
+/*
+ * Return 1 with the next block, 0 at the end 'q' of the file, or -1 on a
+ * read or syntax error. The block data is valid until the next call.
+ */
+int bsl430_titxt_next(titxt_reader_t *reader, titxt_block_t *block)
+{
+    int c;
+    int d;
+
+    if (reader->fd < 0) {
+        return -1;
+    }
+
+    /* The block returned last is consumed. */
+    if (reader->returned) {
+        if ((reader->returned - 1) & TITXT_BLOCK_LAST) {
+            reader->open = 0;
+        }
+        reader->block_size = 0;
+        reader->returned = 0;
+    }
+
+    while (!reader->done) {
+        c = titxt_getc(reader);
+        if (c == TITXT_ERROR) {
+            return -1;
+        }
+
+        if (c == TITXT_EOF) {
+            log("** TI-TXT file ends without 'q' at line %u.\n", reader->line);
+            return -1;
+        }
+
+        if (c == '@' || c == 'q') {
+            if (reader->state != TITXT_LINE) {
+                goto syntax;
+            }
+
+            if (c == 'q') {
+                reader->done = 1;
+            } else {
+                reader->state = TITXT_ADDRESS;
+                reader->digits = 0;
+            }
+
+            /* End of the open segment. */
+            if (reader->open) {
+                return titxt_block(reader, block, TITXT_BLOCK_LAST);
+            }
+            continue;
+        }
+
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            if (reader->digits > 0 && reader->state == TITXT_ADDRESS) {
+                /* Start of new segment. */
+                reader->address = reader->value;
+                reader->size = 0;
+                reader->crc = 0xFFFF;
+                reader->open = 1;
+                reader->state = TITXT_TAIL;
+            } else if (reader->digits > 0) {
+                reader->block[reader->block_size++] = (uint8_t)reader->value;
+                reader->size++;
+            }
+            reader->digits = 0;
+
+            if (c == '\n') {
+                if (reader->state == TITXT_ADDRESS) {
+                    goto syntax;
+                }
+                reader->state = TITXT_LINE;
+                reader->line++;
+            }
+
+            if (reader->block_size == BSL430_MAX_DATA_SIZE) {
+                return titxt_block(reader, block, 0);
+            }
+            continue;
+        }
+
+        d = titxt_hex(c);
+        if (d < 0 || reader->state == TITXT_TAIL) {
+            goto syntax;
+        }
+
+        if (reader->state == TITXT_LINE) {
+            if (!reader->open) {
+                goto syntax;
+            }
+            reader->state = TITXT_DATA;
+        }
+
+        if ((reader->state == TITXT_DATA && reader->digits == 2) ||
+            (reader->state == TITXT_ADDRESS && reader->digits == 8)) {
+            goto syntax;
+        }
+
+        reader->value = (reader->digits)? (reader->value << 4) | (uint32_t)d: (uint32_t)d;
+        reader->digits++;
+    }
+
+    return 0;
+
+syntax:
+    log("** TI-TXT syntax error at line %u.\n", reader->line);
+    return -1;
+}
+
+/*
+ * Read the file again from the start.
+ */
+int bsl430_titxt_rewind(titxt_reader_t *reader)
+{
+    int fd = reader->fd;
+
+    if (fd < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        return -1;
+    }
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+    reader->line = 1;
+    reader->state = TITXT_LINE;
+
+    return 0;
+}
+
+void bsl430_titxt_close(titxt_reader_t *reader)
+{
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+    reader->fd = -1;
+}
+
+static int titxt_getc(titxt_reader_t *reader)
+{
+    ssize_t n;
+
+    if (reader->chunk_pos == reader->chunk_len) {
+        do {
+            n = read(reader->fd, reader->chunk, sizeof(reader->chunk));
+        } while (n < 0 && errno == EINTR);
+
+        if (n < 0) {
+            log("Reading file error. %s\n", strerror(errno));
+            return TITXT_ERROR;
+        }
+
+        if (n == 0) {
+            return TITXT_EOF;
+        }
+
+        reader->chunk_len = (uint16_t)n;
+        reader->chunk_pos = 0;
+    }
+
+    return reader->chunk[reader->chunk_pos++];
+}
+
+static int titxt_hex(int c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/*
+ * Return the block buffered, the segment CRC runs over it here.
+ */
+static int titxt_block(titxt_reader_t *reader, titxt_block_t *block, uint16_t flags)
+{
+    reader->crc = bsl430_crc16(reader->block, reader->block_size, reader->crc);
+    reader->returned = flags + 1;
+
+    block->address = reader->address + reader->size - reader->block_size;
+    block->size = reader->block_size;
+    block->flags = flags;
+    block->data = reader->block;
+    block->segment_address = reader->address;
+    block->segment_size = reader->size;
+    block->segment_crc = reader->crc;
+
+    return 1;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_TITXT_H__
+#define __BSL430_TITXT_H__
+
+#include <stdint.h>
+
+#include "bsl430.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Incremental TI-TXT reader
+ *
+ * The file is read TITXT_READER_CHUNK bytes at a time and parsed character
+ * by character, and the data is returned in blocks of up to
+ * BSL430_MAX_DATA_SIZE bytes from the start of each segment, as soon as
+ * they are complete, the same blocks bsl430_cmd_rx_data_block() is called
+ * with. The reader holds one chunk and one block, whatever the image size.
+ *
+ * The last block of a segment has TITXT_BLOCK_LAST set, with the address,
+ * size and CRC of the whole segment. It is empty if the segment size is a
+ * multiple of the block size.
+ */
+
+#define TITXT_READER_CHUNK  512
+
+/* Last block of its segment. */
+#define TITXT_BLOCK_LAST    0x0001
+
+typedef struct titxt_block_s {
+    uint32_t address;
+    uint16_t size;
+    uint16_t flags;
+    uint8_t *data;
+    /* Of the segment, complete with TITXT_BLOCK_LAST. */
+    uint32_t segment_address;
+    uint32_t segment_size;
+    uint16_t segment_crc;
+} titxt_block_t;
+
+typedef struct titxt_reader_s {
+    int fd;
+    uint32_t line;
+    int state;
+    int digits;
+    uint32_t value;
+    int open;                   /* a segment is open */
+    int done;
+    int returned;               /* flags + 1 of the block returned last, or 0 */
+    uint32_t address;           /* of the segment */
+    uint32_t size;              /* of the segment so far */
+    uint16_t crc;               /* of the segment so far */
+    uint16_t block_size;
+    uint16_t chunk_len;
+    uint16_t chunk_pos;
+    uint8_t block[BSL430_MAX_DATA_SIZE];
+    uint8_t chunk[TITXT_READER_CHUNK];
+} titxt_reader_t;
+
+int bsl430_titxt_open(titxt_reader_t *reader, const char *path);
+int bsl430_titxt_next(titxt_reader_t *reader, titxt_block_t *block);
+int bsl430_titxt_rewind(titxt_reader_t *reader);
+void bsl430_titxt_close(titxt_reader_t *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_TITXT_H__ */
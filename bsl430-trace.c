@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-trace"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-trace.h"
+
+#define TRACE_MAGIC         "BSL430TR"
+#define TRACE_MAGIC_SIZE    8
+/* Bytes of a TX record and of consecutive RX records on a line. */
+#define TRACE_LINE_BYTES    16
+
+typedef struct trace_name_s {
+    uint8_t     code;
+    const char *name;
+} trace_name_t;
+
+/* Commands, with the offset of the 3-byte address in the payload or 0. */
+typedef struct trace_cmd_s {
+    uint8_t     code;
+    const char *name;
+    int         addr;
+} trace_cmd_t;
+
+/* BSL commands, then the secondary loader commands. */
+static const trace_cmd_t trace_cmds[] = {
+    { 0x10, "RX_DATA_BLOCK",        1 },
+    { 0x11, "RX_PASSWORD",          0 },
+    { 0x15, "MASS_ERASE",           0 },
+    { 0x16, "CRC_CHECK",            1 },
+    { 0x17, "LOAD_PC",              1 },
+    { 0x18, "TX_DATA_BLOCK",        1 },
+    { 0x19, "TX_BSL_VERSION",       0 },
+    { 0x1B, "RX_DATA_BLOCK_FAST",   1 },
+    { 0x52, "CHANGE_BAUDRATE",      0 },
+    { 0x20, "LDR_SYNC",             0 },
+    { 0x21, "LDR_BAUDRATE",         0 },
+    { 0x22, "LDR_WRITE",            2 },
+    { 0x23, "LDR_CRC",              1 },
+    { 0x24, "LDR_EXIT",             0 },
+    { 0, NULL, 0 }
+};
+
+/* SLAU610A: BSL core messages and UART error ACKs. */
+static const trace_name_t trace_msgs[] = {
+    { 0x00, "SUCC" },
+    { 0x01, "FLASH_FAIL" },
+    { 0x04, "BSL_LOCKED" },
+    { 0x05, "PASSWD_ERROR" },
+    { 0x07, "UNKNOWN_CMD" },
+    { 0, NULL }
+};
+
+static const trace_name_t trace_acks[] = {
+    { 0x51, "HEADER_INCORRECT" },
+    { 0x52, "CHECKSUM_INCORRECT" },
+    { 0x53, "PACKET_SIZE_ZERO" },
+    { 0x54, "PACKET_SIZE_EXCEEDS" },
+    { 0x55, "UNKNOWN_ERROR" },
+    { 0x56, "UNKNOWN_BAUDRATE" },
+    { 0xFF, "ERROR" },        /* timeout or CKS error */
+    { 0, NULL }
+};
+
+static FILE *trace_fp = NULL;
+static uint64_t trace_last_us = 0;
+
+static uint64_t trace_now_us(void);
+static int trace_put_varint(FILE *fp, uint64_t v);
+static int trace_get_varint(FILE *fp, uint64_t *v);
+static const char *trace_name(const trace_name_t *names, uint8_t code);
+static void trace_decode_frame(FILE *out, const bsl430_trace_record_t *record);
+static void trace_decode_bytes(FILE *out, const uint8_t *data, int len);
+
+int bsl430_trace_open(const char *path)
+{
+    uint8_t version = BSL430_TRACE_VERSION;
+
+    bsl430_trace_close();
+
+    trace_fp = fopen(path, "wb");
+    if (trace_fp == NULL) {
+        log("Opening trace %s failed!\n", path);
+        return -1;
+    }
+
+    if (fwrite(TRACE_MAGIC, TRACE_MAGIC_SIZE, 1, trace_fp) != 1 ||
+        fwrite(&version, 1, 1, trace_fp) != 1) {
+        log("Writing trace %s failed!\n", path);
+        fclose(trace_fp);
+        trace_fp = NULL;
+        return -1;
+    }
+
+    trace_last_us = trace_now_us();
+
+    return 0;
+}
+
+int bsl430_trace_close(void)
+{
+    if (trace_fp) {
+        fclose(trace_fp);
+        trace_fp = NULL;
+    }
+    return 0;
+}
+
+/*
+ * Append a record, nothing but a test when no trace is open. The file is
+ * buffered by stdio, so a record costs no system call on the UART path.
+ */
+int bsl430_trace_record(int type, const uint8_t *data, int len)
+{
+    uint64_t now;
+    int n;
+
+    if (trace_fp == NULL) {
+        return 0;
+    }
+
+    do {
+        n = (len > BSL430_TRACE_MAX_DATA)? BSL430_TRACE_MAX_DATA: len;
+
+        now = trace_now_us();
+        fputc(type, trace_fp);
+        trace_put_varint(trace_fp, now - trace_last_us);
+        trace_put_varint(trace_fp, (uint64_t)n);
+        if (n > 0 && fwrite(data, (size_t)n, 1, trace_fp) != 1) {
+            log("Writing trace failed! Tracing stopped.\n");
+            bsl430_trace_close();
+            return -1;
+        }
+        trace_last_us = now;
+
+        data += n;
+        len  -= n;
+    } while (len > 0);
+
+    return 0;
+}
+
+int bsl430_trace_frame(int type, int status, const uint8_t *payload, uint16_t len)
+{
+    uint8_t buf[3 + BSL430_TRACE_FRAME_HEAD];
+    uint16_t n = (len > BSL430_TRACE_FRAME_HEAD)? BSL430_TRACE_FRAME_HEAD: len;
+
+    if (trace_fp == NULL) {
+        return 0;
+    }
+
+    buf[0] = (uint8_t)status;
+    buf[1] = (uint8_t)(len >> 0 & 0x00FF);
+    buf[2] = (uint8_t)(len >> 8 & 0x00FF);
+    if (n > 0) {
+        memcpy(&buf[3], payload, n);
+    }
+
+    return bsl430_trace_record(type, buf, 3 + n);
+}
+
+int bsl430_trace_reader_open(bsl430_trace_reader_t *reader, const char *path)
+{
+    char magic[TRACE_MAGIC_SIZE];
+    int version;
+
+    if (!reader || !path) {
+        return -1;
+    }
+
+    memset(reader, 0, sizeof(*reader));
+
+    reader->fp = fopen(path, "rb");
+    if (reader->fp == NULL) {
+        log("Opening trace %s failed!\n", path);
+        return -1;
+    }
+
+    if (fread(magic, TRACE_MAGIC_SIZE, 1, reader->fp) != 1 ||
+        memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0 ||
+        (version = fgetc(reader->fp)) != BSL430_TRACE_VERSION) {
+        log("%s is not a trace of version %d!\n", path, BSL430_TRACE_VERSION);
+        bsl430_trace_reader_close(reader);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Return 0, or -1 at the end of the trace.
+ */
+int bsl430_trace_reader_next(bsl430_trace_reader_t *reader, bsl430_trace_record_t *record)
+{
+    uint64_t time_us = 0;
+    uint64_t len = 0;
+    int type;
+
+    if (!reader || !reader->fp || !record) {
+        return -1;
+    }
+
+    type = fgetc(reader->fp);
+    if (type == EOF) {
+        return -1;
+    }
+
+    if (trace_get_varint(reader->fp, &time_us) != 0 ||
+        trace_get_varint(reader->fp, &len) != 0 || len > BSL430_TRACE_MAX_DATA) {
+        log("** Trace record corrupted.\n");
+        return -1;
+    }
+
+    if (len > 0 && fread(record->data, (size_t)len, 1, reader->fp) != 1) {
+        log("** Trace record truncated.\n");
+        return -1;
+    }
+
+    reader->time_us += time_us;
+
+    record->type    = type;
+    record->time_us = reader->time_us;
+    record->len     = (uint16_t)len;
+
+    return 0;
+}
+
+int bsl430_trace_reader_close(bsl430_trace_reader_t *reader)
+{
+    if (reader && reader->fp) {
+        fclose(reader->fp);
+        reader->fp = NULL;
+    }
+    return 0;
+}
+
+/*
+ * Print the trace, one line per record, frames annotated with the command
+ * and the response. Consecutive RX bytes are put on one line.
+ */
+int bsl430_trace_decode(const char *path, FILE *out)
+{
+    bsl430_trace_reader_t reader;
+    static bsl430_trace_record_t record;
+    uint8_t rx[TRACE_LINE_BYTES];
+    uint64_t rx_time = 0;
+    int rx_len = 0;
+    uint32_t tx_bytes = 0;
+    uint32_t rx_bytes = 0;
+    uint32_t frames = 0;
+    uint32_t timeouts = 0;
+    uint32_t baudrate;
+
+    if (bsl430_trace_reader_open(&reader, path) != 0) {
+        return -1;
+    }
+
+    while (bsl430_trace_reader_next(&reader, &record) == 0) {
+        if (record.type == BSL430_TRACE_RX && record.len == 1) {
+            if (rx_len == 0) {
+                rx_time = record.time_us;
+            }
+            rx[rx_len++] = record.data[0];
+            rx_bytes++;
+            if (rx_len < TRACE_LINE_BYTES) {
+                continue;
+            }
+        }
+
+        if (rx_len > 0) {
+            fprintf(out, "%12.3f  RX       ", rx_time / 1000.0);
+            trace_decode_bytes(out, rx, rx_len);
+            rx_len = 0;
+            if (record.type == BSL430_TRACE_RX) {
+                continue;
+            }
+        }
+
+        fprintf(out, "%12.3f  ", record.time_us / 1000.0);
+
+        switch (record.type) {
+        case BSL430_TRACE_OPEN:
+            baudrate = (uint32_t)record.data[0] << 0  | (uint32_t)record.data[1] << 8 |
+                       (uint32_t)record.data[2] << 16 | (uint32_t)record.data[3] << 24;
+            fprintf(out, "OPEN     %u baud, parity %s\n", baudrate,
+                    (record.data[4] == 0)? "even": (record.data[4] == 1)? "odd": "none");
+            break;
+        case BSL430_TRACE_TX:
+            fprintf(out, "TX       ");
+            trace_decode_bytes(out, record.data, record.len);
+            tx_bytes += record.len;
+            break;
+        case BSL430_TRACE_TIMEOUT:
+            fprintf(out, "TIMEOUT\n");
+            timeouts++;
+            break;
+        case BSL430_TRACE_FRAME_TX:
+        case BSL430_TRACE_FRAME_RX:
+            trace_decode_frame(out, &record);
+            frames++;
+            break;
+        default:
+            fprintf(out, "UNKNOWN  '%c' %u bytes\n", record.type, record.len);
+            break;
+        }
+    }
+
+    if (rx_len > 0) {
+        fprintf(out, "%12.3f  RX       ", rx_time / 1000.0);
+        trace_decode_bytes(out, rx, rx_len);
+    }
+
+    fprintf(out, "\n%u ms, TX %u Bytes, RX %u Bytes, %u frames, %u timeouts.\n",
+            (uint32_t)(reader.time_us / 1000), tx_bytes, rx_bytes, frames, timeouts);
+
+    bsl430_trace_reader_close(&reader);
+
+    return 0;
+}
+
+static uint64_t trace_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static int trace_put_varint(FILE *fp, uint64_t v)
+{
+    while (v >= 0x80) {
+        fputc((int)(v & 0x7F) | 0x80, fp);
+        v >>= 7;
+    }
+    fputc((int)v, fp);
+
+    return 0;
+}
+
+static int trace_get_varint(FILE *fp, uint64_t *v)
+{
+    int c;
+    int shift = 0;
+
+    *v = 0;
+    do {
+        c = fgetc(fp);
+        if (c == EOF || shift > 63) {
+            return -1;
+        }
+        *v |= (uint64_t)(c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return 0;
+}
+
+static const char *trace_name(const trace_name_t *names, uint8_t code)
+{
+    for (; names->name; names++) {
+        if (names->code == code) {
+            return names->name;
+        }
+    }
+    return "?";
+}
+
+static void trace_decode_frame(FILE *out, const bsl430_trace_record_t *record)
+{
+    const trace_cmd_t *cmd;
+    const uint8_t *p = &record->data[3];
+    int n = record->len - 3;
+    uint8_t status = record->data[0];
+    uint16_t len = (uint16_t)record->data[1] | (uint16_t)record->data[2] << 8;
+
+    if (n < 0) {
+        fprintf(out, "FRAME    corrupted\n");
+        return;
+    }
+
+    if (record->type == BSL430_TRACE_FRAME_TX) {
+        for (cmd = trace_cmds; cmd->name && (n == 0 || cmd->code != p[0]); cmd++) ;
+
+        fprintf(out, "-> %s", (cmd->name)? cmd->name: "?");
+        if (cmd->name && cmd->addr > 0 && n >= cmd->addr + 3) {
+            p += cmd->addr;
+            fprintf(out, " @0x%05X", (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16);
+        }
+        fprintf(out, ", %u Bytes payload\n", len);
+        return;
+    }
+
+    if (status != 0) {
+        fprintf(out, "<- %s (0x%02X)\n", trace_name(trace_acks, status), status);
+    } else if (len == 0) {
+        fprintf(out, "<- ACK\n");
+    } else if (n >= 2 && p[0] == 0x3B) {
+        fprintf(out, "<- MSG %s (0x%02X)\n", trace_name(trace_msgs, p[1]), p[1]);
+    } else {
+        fprintf(out, "<- DATA %u Bytes\n", len - 1);
+    }
+}
+
+static void trace_decode_bytes(FILE *out, const uint8_t *data, int len)
+{
+    int i;
+
+    for (i = 0; i < len && i < TRACE_LINE_BYTES; i++) {
+        fprintf(out, "%02X ", data[i]);
+    }
+
+    if (len > TRACE_LINE_BYTES) {
+        fprintf(out, "... (%d Bytes)", len);
+    }
+    fprintf(out, "\n");
+}
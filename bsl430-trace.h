@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_TRACE_H__
+#define __BSL430_TRACE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * UART trace file
+ *
+ *      "BSL430TR" VERSION
+ *      TYPE TIME LEN D1...Dn
+ *      ...
+ *
+ * TIME is the time in us since the previous record, TIME and LEN are
+ * LEB128 varints. The platform records the UART bytes, the protocol records
+ * a frame summary after it has been sent or received:
+ *
+ *   OPEN      'U'  B0 B1 B2 B3 PARITY      bsl430_uart_init()
+ *   TX        'T'  D1...Dn                 bytes written
+ *   RX        'R'  D1                      a byte read
+ *   TIMEOUT   'O'                          a read timed out
+ *   FRAME_TX  'F'  STATUS NL NH D1...Dn    frame sent, D is the payload head
+ *   FRAME_RX  'f'  STATUS NL NH D1...Dn    frame received, STATUS 0 for
+ *                                          success, else the ACK or 0xFF
+ */
+#define BSL430_TRACE_VERSION        1
+#define BSL430_TRACE_MAX_DATA       2048
+/* Payload bytes of a frame kept in the trace, command and address. */
+#define BSL430_TRACE_FRAME_HEAD     8
+
+#define BSL430_TRACE_OPEN           'U'
+#define BSL430_TRACE_TX             'T'
+#define BSL430_TRACE_RX             'R'
+#define BSL430_TRACE_TIMEOUT        'O'
+#define BSL430_TRACE_FRAME_TX       'F'
+#define BSL430_TRACE_FRAME_RX       'f'
+
+typedef struct bsl430_trace_record_s {
+    int      type;
+    uint64_t time_us;       /* since the start of the trace */
+    uint16_t len;
+    uint8_t  data[BSL430_TRACE_MAX_DATA];
+} bsl430_trace_record_t;
+
+typedef struct bsl430_trace_reader_s {
+    FILE    *fp;
+    uint64_t time_us;
+} bsl430_trace_reader_t;
+
+int bsl430_trace_open(const char *path);
+int bsl430_trace_close(void);
+int bsl430_trace_record(int type, const uint8_t *data, int len);
+int bsl430_trace_frame(int type, int status, const uint8_t *payload, uint16_t len);
+
+int bsl430_trace_reader_open(bsl430_trace_reader_t *reader, const char *path);
+int bsl430_trace_reader_next(bsl430_trace_reader_t *reader, bsl430_trace_record_t *record);
+int bsl430_trace_reader_close(bsl430_trace_reader_t *reader);
+
+int bsl430_trace_decode(const char *path, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_TRACE_H__ */
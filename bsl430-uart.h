@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_UART_H__
+#define __BSL430_UART_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * UART of the BSL, implemented in bsl430-platform.c. Declared apart from
+ * the logging of bsl430-platform.h for the C++ layer, see bsl430.hpp.
+ */
+
+/*
+ * Inter-character pacing of bsl430_uart_write(), see bsl430_uart_set_pacing().
+ *
+ * BSL430_PACING_SOFT:      Each character is written one character time plus
+ *                          a short guard after the previous one. The deadline
+ *                          is kept by clock_nanosleep() and a calibrated spin.
+ * BSL430_PACING_STOPBITS:  The UART is configured with two stop bits and the
+ *                          characters are written back to back.
+ * BSL430_PACING_NONE:      Back to back, for a receiver with a deeper buffer,
+ *                          e.g. a secondary loader receiving by DMA.
+ *
+ * bsl430_uart_set_pacing() returns the previous mode.
+ */
+#define BSL430_PACING_SOFT      0
+#define BSL430_PACING_STOPBITS  1
+#define BSL430_PACING_NONE      2
+
+typedef struct bsl430_uart_stats_s {
+    uint32_t tx_bytes;
+    uint64_t tx_ns;         /* time spent in pacing and writing */
+    uint32_t tx_rate;       /* achieved Bytes/s */
+    uint32_t line_rate;     /* paced Bytes/s at current baudrate and framing */
+    uint32_t rx_bytes;
+    uint32_t rtt_count;     /* round trips, a write to the first byte read after it */
+    uint32_t rtt_us;        /* mean round trip time */
+    uint32_t rtt_max_us;
+    uint32_t rtt_wire_us;   /* mean wire time of the round trips */
+    uint32_t tx_gap_max_us; /* worst gap between two paced characters of a write */
+    uint32_t tx_late_max_us;/* worst overshoot of a pacing deadline */
+} bsl430_uart_stats_t;
+
+int bsl430_uart_init(int baudrate, int parity);
+int bsl430_uart_term(void);
+int bsl430_uart_readb(uint16_t timeout);
+int bsl430_uart_writeb(uint8_t c);
+int bsl430_uart_write(const uint8_t *buf, int len);
+int bsl430_uart_clear(void);
+int bsl430_uart_drain(uint16_t quiet, uint16_t limit);
+
+int bsl430_uart_set_pacing(int mode);
+int bsl430_uart_set_low_latency(int enable);
+int bsl430_uart_get_stats(bsl430_uart_stats_t *stats);
+int bsl430_uart_reset_stats(void);
+int bsl430_uart_port(const char *path);
+int bsl430_uart_replay(const char *path);
+int bsl430_uart_config(int fd, int baudrate, int parity, int stopbits);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_UART_H__ */
@@ -0,0 +1,763 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430-uring"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+
+#include "bsl430-platform.h"
+#include "bsl430-uring.h"
+
+#ifdef BSL430_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define HEAD    0x80
+#define INITFCS 0xFFFF
+#define ACK     0x00
+
+#define RESP_TIMEOUT   100  /* ms */
+
+/* Delay before each command, as bsl430_frame_write(). */
+#define URING_SENDING_DELAY     5   /* ms */
+
+#define BSL430_CMD_RX_PASSWORD      0x11
+#define BSL430_CMD_CRC_CHECK        0x16
+#define BSL430_CMD_TX_BSL_VERSION   0x19
+#define BSL430_CMD_CHANGE_BAUDRATE  0x52
+
+#define BSL430_RESP_DATA            0x3A
+#define BSL430_RESP_MSG             0x3B
+
+/* ACK + Header + NL NH + response + CKL CKH */
+#define URING_RX_SIZE       (4 + 1 + BSL430_MAX_DATA_SIZE + 2 + 8)
+#define URING_TX_SIZE       BSL430_RX_DATA_FRAME_SIZE
+
+/* user_data of an SQE: port << 2 | op */
+#define URING_OP_WRITE      0
+#define URING_OP_READ       1
+#define URING_OP_TIMEOUT    2
+
+#define URING_PENDING       (-2)
+
+typedef struct uring_port_s {
+    const char *tty;
+    int fd;
+    int status;             /* 0 while the port is fine */
+    int send;               /* in the current command */
+    int erased;             /* by a wrong password */
+    int result;             /* of the current command */
+    int inflight;           /* SQEs not completed */
+    uint16_t got;           /* response bytes */
+    uint16_t want;          /* to read next, 0: complete */
+    uint64_t deadline;
+    struct __kernel_timespec ts;
+    uint8_t *rx;
+} uring_port_t;
+
+struct bsl430_uring_s {
+    int fd;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    uint32_t tail;          /* SQ tail not published yet */
+    uint32_t queued;
+
+    int baudrate;
+    uint8_t *tx;            /* registered buffer 0 */
+    uint16_t tx_len;
+    uint8_t *rx;            /* registered buffer 1, URING_RX_SIZE per port */
+
+    int ports;
+    uring_port_t port[BSL430_URING_MAX_PORTS];
+};
+
+static int uring_setup(bsl430_uring_t *ring, uint32_t entries);
+static struct io_uring_sqe *uring_sqe(bsl430_uring_t *ring, int port, int op);
+static int uring_submit(bsl430_uring_t *ring, uint32_t wait);
+static void uring_queue_read(bsl430_uring_t *ring, int i, int linked);
+static int uring_parse(uring_port_t *port, int resp);
+static int uring_transact(bsl430_uring_t *ring, int resp, uint32_t timeout);
+static int uring_command(bsl430_uring_t *ring, const uint8_t *payload, uint16_t len, int resp);
+static int uring_select(bsl430_uring_t *ring, int result);
+static int uring_drop(bsl430_uring_t *ring, const char *what);
+static int uring_baudrate(bsl430_uring_t *ring, int baudrate);
+static uint64_t uring_now_ns(void);
+
+/*
+ * Open the ttys, NULL if none can be or io_uring is not available. A port
+ * which can't be opened has a status of -1.
+ */
+bsl430_uring_t *bsl430_uring_open(const char **ttys, int ports)
+{
+    bsl430_uring_t *ring = NULL;
+    struct iovec iov[2];
+    uint32_t entries = 4;
+    int i;
+    int opened = 0;
+
+    if (ttys == NULL || ports <= 0 || ports > BSL430_URING_MAX_PORTS) {
+        return NULL;
+    }
+
+    ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->fd = -1;
+
+    /* A WRITE, a READ and a LINK_TIMEOUT per port. */
+    while (entries < (uint32_t)ports * 3) {
+        entries <<= 1;
+    }
+
+    if (uring_setup(ring, entries) != 0) {
+        goto error0;
+    }
+
+    ring->tx = calloc(1, URING_TX_SIZE);
+    ring->rx = calloc((size_t)ports, URING_RX_SIZE);
+    if (ring->tx == NULL || ring->rx == NULL) {
+        goto error0;
+    }
+
+    iov[0].iov_base = ring->tx;
+    iov[0].iov_len  = URING_TX_SIZE;
+    iov[1].iov_base = ring->rx;
+    iov[1].iov_len  = (size_t)ports * URING_RX_SIZE;
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, 2) < 0) {
+        log("Registering buffers failed! %s\n", strerror(errno));
+        goto error0;
+    }
+
+    ring->ports = ports;
+    for (i = 0; i < ports; i++) {
+        ring->port[i].tty = ttys[i];
+        ring->port[i].rx = ring->rx + (size_t)i * URING_RX_SIZE;
+        /* Non-blocking, so the reads are driven by io_uring poll, not by workers. */
+        ring->port[i].fd = open(ttys[i], O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (ring->port[i].fd < 0) {
+            log("** %s: Open UART failed! %s\n", ttys[i], strerror(errno));
+            ring->port[i].status = -1;
+        } else {
+            opened++;
+        }
+    }
+
+    if (opened == 0) {
+        goto error0;
+    }
+
+    return ring;
+
+error0:
+    bsl430_uring_close(ring);
+    return NULL;
+}
+
+int bsl430_uring_close(bsl430_uring_t *ring)
+{
+    int i;
+
+    if (ring == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < ring->ports; i++) {
+        if (ring->port[i].fd >= 0) {
+            close(ring->port[i].fd);
+        }
+    }
+
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+
+    free(ring->tx);
+    free(ring->rx);
+    free(ring);
+
+    return 0;
+}
+
+/*
+ * Program the stream on all ports, the devices in the BSL, e.g. by
+ * bsl430_entry_sequence(). password is tried first, 32 bytes, a device
+ * erased by a wrong one is unlocked by the erased password.
+ *
+ * Return the number of ports failed, see bsl430_uring_status().
+ */
+int bsl430_uring_program(bsl430_uring_t *ring, const bsl430_stream_t *stream,
+                         const uint8_t *password)
+{
+    uint8_t cmd[1 + 32];
+    uint32_t i, j;
+    int erased = 0;
+    int active = 0;
+    int failed = 0;
+    uint64_t start = uring_now_ns();
+    const bsl430_stream_segment_t *segment = NULL;
+    const bsl430_stream_frame_t *frame = NULL;
+    uring_port_t *port = NULL;
+
+    if (ring == NULL || stream == NULL || password == NULL) {
+        return -1;
+    }
+
+    /*
+     * SLAU610A: UART Protocol Definition
+     * 9600 baud, an even parity bit, here 2 stop bits as the pacing.
+     */
+    uring_baudrate(ring, 9600);
+    mdelay(100);
+
+    /* Recover the UART, as bsl430_enter(). */
+    cmd[0] = BSL430_CMD_TX_BSL_VERSION;
+    uring_select(ring, 0);
+    uring_command(ring, cmd, 1, 1);
+
+    cmd[0] = BSL430_CMD_CHANGE_BAUDRATE;
+    cmd[1] = 0x06;
+    uring_select(ring, 0);
+    uring_command(ring, cmd, 2, 0);
+    uring_drop(ring, "Change baudrate");
+    uring_baudrate(ring, 115200);
+
+    cmd[0] = BSL430_CMD_RX_PASSWORD;
+    memcpy(&cmd[1], password, 32);
+    uring_select(ring, 0);
+    uring_command(ring, cmd, sizeof(cmd), 1);
+
+    /* A wrong password erases the device, the erased one unlocks it then. */
+    for (i = 0; i < (uint32_t)ring->ports; i++) {
+        port = &ring->port[i];
+        port->erased = (port->send && port->result == BSL430_MSG_PASSWD_ERROR);
+        if (port->erased) {
+            port->result = 0;
+            erased++;
+        }
+    }
+    uring_drop(ring, "Password");
+
+    if (erased > 0) {
+        log("** Password Error on %d ports! All code FRAM is erased!\n", erased);
+        memset(&cmd[1], 0xFF, 32);
+        for (i = 0; i < (uint32_t)ring->ports; i++) {
+            port = &ring->port[i];
+            port->send = (port->status == 0 && port->erased);
+        }
+        uring_command(ring, cmd, sizeof(cmd), 1);
+        uring_drop(ring, "Password");
+    }
+
+    for (i = 0; i < stream->segments; i++) {
+        segment = &stream->segment[i];
+
+        active = uring_select(ring, 0);
+        if (active == 0) {
+            break;
+        }
+
+        erased = 0;
+        for (j = 0; j < (uint32_t)ring->ports; j++) {
+            erased += (ring->port[j].send && ring->port[j].erased);
+        }
+
+        log("<<< Segment: @%04X %u Bytes, Crc %04X, %d ports >>>\n",
+            segment->address, segment->size, segment->crc, active);
+
+        for (j = 0; j < segment->frames; j++) {
+            frame = &stream->index[segment->frame + j];
+
+            /* Nothing to write if all devices are erased. */
+            if (erased == active && (frame->flags & BSL430_STREAM_BLANK)) {
+                continue;
+            }
+
+            memcpy(ring->tx, bsl430_stream_frame(stream, frame), frame->len);
+            ring->tx_len = frame->len;
+
+            uring_select(ring, 0);
+            uring_transact(ring, 1, RESP_TIMEOUT);
+            uring_drop(ring, "Programing");
+        }
+
+        cmd[0] = BSL430_CMD_CRC_CHECK;
+        cmd[1] = (uint8_t)(segment->address >>  0 & 0xFF);
+        cmd[2] = (uint8_t)(segment->address >>  8 & 0xFF);
+        cmd[3] = (uint8_t)(segment->address >> 16 & 0xFF);
+        cmd[4] = (uint8_t)(segment->size >> 0 & 0xFF);
+        cmd[5] = (uint8_t)(segment->size >> 8 & 0xFF);
+
+        uring_select(ring, 0);
+        uring_command(ring, cmd, 6, 1);
+
+        for (j = 0; j < (uint32_t)ring->ports; j++) {
+            port = &ring->port[j];
+
+            if (!port->send || port->result != 0) {
+                continue;
+            }
+            if (port->rx[4] != BSL430_RESP_DATA ||
+                (uint16_t)(port->rx[5] | port->rx[6] << 8) != segment->crc) {
+                log("** %s: CRC mismatch!\n", port->tty);
+                port->result = 1;
+            }
+        }
+        uring_drop(ring, "Checking CRC");
+    }
+
+    for (i = 0; i < (uint32_t)ring->ports; i++) {
+        if (ring->port[i].status != 0) {
+            failed++;
+        }
+    }
+
+    log("%d of %d ports programmed in %u ms.\n", ring->ports - failed, ring->ports,
+        (uint32_t)((uring_now_ns() - start) / 1000000));
+
+    return failed;
+}
+
+/*
+ * 0 if the port is fine, else the error of the command it failed: the BSL
+ * ACK or message, 1 on a CRC mismatch, or -1 on a timeout or I/O error.
+ */
+int bsl430_uring_status(bsl430_uring_t *ring, int port)
+{
+    if (ring == NULL || port < 0 || port >= ring->ports) {
+        return -1;
+    }
+
+    return ring->port[port].status;
+}
+
+static int uring_setup(bsl430_uring_t *ring, uint32_t entries)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) {
+        log("io_uring is not available! %s\n", strerror(errno));
+        return -1;
+    }
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        log("Mapping io_uring failed! %s\n", strerror(errno));
+        ring->sq_ring = (ring->sq_ring == MAP_FAILED)? NULL: ring->sq_ring;
+        ring->cq_ring = (ring->cq_ring == MAP_FAILED)? NULL: ring->cq_ring;
+        ring->sqes = (ring->sqes == MAP_FAILED)? NULL: ring->sqes;
+        return -1;
+    }
+
+    ring->sq_head  = (uint32_t *)((uint8_t *)ring->sq_ring + p.sq_off.head);
+    ring->sq_tail  = (uint32_t *)((uint8_t *)ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask  = (uint32_t *)((uint8_t *)ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_array = (uint32_t *)((uint8_t *)ring->sq_ring + p.sq_off.array);
+    ring->cq_head  = (uint32_t *)((uint8_t *)ring->cq_ring + p.cq_off.head);
+    ring->cq_tail  = (uint32_t *)((uint8_t *)ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask  = (uint32_t *)((uint8_t *)ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((uint8_t *)ring->cq_ring + p.cq_off.cqes);
+    ring->tail = *ring->sq_tail;
+
+    return 0;
+}
+
+static struct io_uring_sqe *uring_sqe(bsl430_uring_t *ring, int port, int op)
+{
+    uint32_t index = ring->tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t)port << 2 | (uint64_t)op;
+
+    ring->sq_array[index] = index;
+    ring->tail++;
+    ring->queued++;
+
+    return sqe;
+}
+
+/*
+ * Submit the SQEs queued, and wait for <wait> completions.
+ */
+static int uring_submit(bsl430_uring_t *ring, uint32_t wait)
+{
+    long n;
+
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+
+    do {
+        n = syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait,
+                    (wait)? IORING_ENTER_GETEVENTS: 0, NULL, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        log("io_uring_enter failed! %s\n", strerror(errno));
+        return -1;
+    }
+
+    ring->queued -= (uint32_t)n;
+
+    return 0;
+}
+
+/*
+ * Read the rest of the response into the registered buffer, within the
+ * deadline by a LINK_TIMEOUT, after the write if linked.
+ */
+static void uring_queue_read(bsl430_uring_t *ring, int i, int linked)
+{
+    uring_port_t *port = &ring->port[i];
+    struct io_uring_sqe *sqe = NULL;
+    uint64_t now = uring_now_ns();
+    uint64_t left = (port->deadline > now)? port->deadline - now: 1000000;
+
+    port->ts.tv_sec  = (int64_t)(left / 1000000000ULL);
+    port->ts.tv_nsec = (long long)(left % 1000000000ULL);
+
+    sqe = uring_sqe(ring, i, URING_OP_READ);
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = port->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(port->rx + port->got);
+    sqe->len = port->want;
+    sqe->buf_index = 1;
+    sqe->flags = IOSQE_IO_LINK;
+
+    sqe = uring_sqe(ring, i, URING_OP_TIMEOUT);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&port->ts;
+    sqe->len = 1;
+
+    port->inflight += 2 + linked;
+}
+
+/*
+ * Return 1 once the response is complete with its result, else 0 with the
+ * bytes still wanted. The response is ACK, and unless it's the ACK only,
+ * the frame: HEAD NL NH payload CKL CKH.
+ */
+static int uring_parse(uring_port_t *port, int resp)
+{
+    uint16_t len = 0;
+    uint16_t need = (resp)? 4: 1;
+    uint16_t cks;
+
+    if (port->got >= 1 && port->rx[0] != ACK) {
+        port->result = port->rx[0];
+        return 1;
+    }
+
+    if (port->got >= 4) {
+        len = (uint16_t)(port->rx[2] | port->rx[3] << 8);
+        if (port->rx[1] != HEAD || len > URING_RX_SIZE - 6) {
+            port->result = -1;
+            return 1;
+        }
+        need = 4 + len + 2;
+    }
+
+    if (port->got < need) {
+        port->want = need - port->got;
+        return 0;
+    }
+
+    port->want = 0;
+
+    if (!resp) {
+        port->result = 0;
+        return 1;
+    }
+
+    cks = (uint16_t)(port->rx[4 + len] | port->rx[5 + len] << 8);
+    if (bsl430_crc16(&port->rx[4], len, INITFCS) != cks) {
+        port->result = -1;
+    } else if (port->rx[4] == BSL430_RESP_MSG) {
+        port->result = port->rx[5];
+    } else {
+        port->result = 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Write the frame in ring->tx to the ports selected and read their
+ * responses, all in one ring. The result of each port is set.
+ */
+static int uring_transact(bsl430_uring_t *ring, int resp, uint32_t timeout)
+{
+    struct io_uring_sqe *sqe = NULL;
+    struct io_uring_cqe *cqe = NULL;
+    uring_port_t *port = NULL;
+    uint32_t head, tail;
+    uint64_t deadline;
+    int pending = 0;
+    int flush = 0;
+    int i, op;
+
+    mdelay(URING_SENDING_DELAY);
+
+    /* write() returns once queued, the response comes after the wire time. */
+    deadline = uring_now_ns() + (uint64_t)timeout * 1000000ULL +
+               (uint64_t)ring->tx_len * 12 * 1000000000ULL / (uint64_t)ring->baudrate;
+
+    for (i = 0; i < ring->ports; i++) {
+        port = &ring->port[i];
+        if (!port->send) {
+            continue;
+        }
+
+        port->result = URING_PENDING;
+        port->got = 0;
+        port->want = (resp)? 4: 1;
+        port->inflight = 0;
+        port->deadline = deadline;
+
+        sqe = uring_sqe(ring, i, URING_OP_WRITE);
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = port->fd;
+        sqe->addr = (uint64_t)(uintptr_t)ring->tx;
+        sqe->len = ring->tx_len;
+        sqe->buf_index = 0;
+        sqe->flags = IOSQE_IO_LINK;
+
+        uring_queue_read(ring, i, 1);
+        pending++;
+    }
+
+    while (pending > 0) {
+        if (uring_submit(ring, 1) != 0) {
+            break;
+        }
+
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++) {
+            cqe = &ring->cqes[head & *ring->cq_mask];
+            port = &ring->port[cqe->user_data >> 2];
+            op = (int)(cqe->user_data & 3);
+
+            port->inflight--;
+
+            if (op == URING_OP_READ && cqe->res > 0 && port->result == URING_PENDING) {
+                port->got += (uint16_t)cqe->res;
+                uring_parse(port, resp);
+            } else if (op != URING_OP_TIMEOUT && cqe->res <= 0 &&
+                       port->result == URING_PENDING) {
+                /* -ECANCELED: the LINK_TIMEOUT fired, or the write failed. */
+                debug("%s: %s %d\n", port->tty, (op == URING_OP_READ)? "read": "write", cqe->res);
+                port->result = -1;
+            }
+
+            if (port->inflight > 0) {
+                continue;
+            }
+
+            if (port->result == URING_PENDING && port->want > 0) {
+                /* A part of the response, read on. */
+                uring_queue_read(ring, (int)(port - ring->port), 0);
+            } else {
+                pending--;
+            }
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    /* Clear all subsequence characters for frame SYNC recovery. */
+    for (i = 0; i < ring->ports; i++) {
+        port = &ring->port[i];
+        if (port->send && port->result != 0) {
+            if (port->result == URING_PENDING) {
+                port->result = -1;
+            }
+            flush = 1;
+        }
+    }
+
+    if (flush) {
+        mdelay(RESP_TIMEOUT);
+        for (i = 0; i < ring->ports; i++) {
+            port = &ring->port[i];
+            if (port->send && port->result != 0) {
+                tcflush(port->fd, TCIFLUSH);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int uring_command(bsl430_uring_t *ring, const uint8_t *payload, uint16_t len, int resp)
+{
+    uint16_t fcs = bsl430_crc16(payload, len, INITFCS);
+    int n = 0;
+
+    ring->tx[n++] = HEAD;
+    ring->tx[n++] = (uint8_t)(len >> 0 & 0x00FF);
+    ring->tx[n++] = (uint8_t)(len >> 8 & 0x00FF);
+    memcpy(&ring->tx[n], payload, len);
+    n += len;
+    ring->tx[n++] = (uint8_t)(fcs >> 0 & 0x00FF);
+    ring->tx[n++] = (uint8_t)(fcs >> 8 & 0x00FF);
+    ring->tx_len = (uint16_t)n;
+
+    return uring_transact(ring, resp, RESP_TIMEOUT);
+}
+
+/*
+ * Select the ports fine so far whose last result is <result> for the next
+ * command. Return the number selected.
+ */
+static int uring_select(bsl430_uring_t *ring, int result)
+{
+    int i;
+    int n = 0;
+
+    for (i = 0; i < ring->ports; i++) {
+        ring->port[i].send = (ring->port[i].status == 0 &&
+                              (result == 0 || ring->port[i].result == result));
+        n += ring->port[i].send;
+    }
+
+    return n;
+}
+
+/*
+ * Drop the ports which failed the command from the next ones.
+ */
+static int uring_drop(bsl430_uring_t *ring, const char *what)
+{
+    int i;
+    int n = 0;
+
+    for (i = 0; i < ring->ports; i++) {
+        if (ring->port[i].send && ring->port[i].result != 0) {
+            log("** %s: %s failed! 0x%02X\n", ring->port[i].tty, what,
+                (uint8_t)ring->port[i].result);
+            ring->port[i].status = ring->port[i].result;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+static int uring_baudrate(bsl430_uring_t *ring, int baudrate)
+{
+    int i;
+
+    ring->baudrate = baudrate;
+
+    for (i = 0; i < ring->ports; i++) {
+        if (ring->port[i].status == 0 && bsl430_uart_config(ring->port[i].fd, baudrate, 0, 2) != 0) {
+            log("** %s: Config UART failed!\n", ring->port[i].tty);
+            ring->port[i].status = -1;
+        }
+    }
+
+    return 0;
+}
+
+static uint64_t uring_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#else   /* BSL430_URING */
+
+bsl430_uring_t *bsl430_uring_open(const char **ttys, int ports)
+{
+    (void)ttys;
+    (void)ports;
+    log("io_uring transport is not built, see BSL430_URING.\n");
+    return NULL;
+}
+
+int bsl430_uring_close(bsl430_uring_t *ring)
+{
+    (void)ring;
+    return -1;
+}
+
+int bsl430_uring_program(bsl430_uring_t *ring, const bsl430_stream_t *stream,
+                         const uint8_t *password)
+{
+    (void)ring;
+    (void)stream;
+    (void)password;
+    return -1;
+}
+
+int bsl430_uring_status(bsl430_uring_t *ring, int port)
+{
+    (void)ring;
+    (void)port;
+    return -1;
+}
+
+#endif  /* BSL430_URING */
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BSL430_URING_H__
+#define __BSL430_URING_H__
+
+#include <stdint.h>
+
+#include "bsl430.h"
+#include "bsl430-stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * io_uring transport for many ports
+ *
+ * One thread drives the BSL of the devices on up to BSL430_URING_MAX_PORTS
+ * ttys in lockstep, e.g. the boards of a fixture which enter the BSL
+ * together by shared RST/TST lines. Each command is encoded once into a
+ * registered buffer and written to all ports, and the responses are read
+ * into registered buffers, by one io_uring_enter() per round for all
+ * ports. Each port gets a WRITE_FIXED linked to a READ_FIXED linked to a
+ * LINK_TIMEOUT, so the response deadline is enforced by the kernel and a
+ * silent device costs no thread and no syscall.
+ *
+ * The characters are written back to back, the ports are configured with
+ * two stop bits for the ONE-byte FIFO of MSP430, see
+ * BSL430_PACING_STOPBITS.
+ *
+ * A port that fails a command is dropped from the following ones, and its
+ * status is kept, see bsl430_uring_status().
+ *
+ * It needs Linux 5.5 or later, and is built with BSL430_URING defined.
+ * Otherwise bsl430_uring_open() fails.
+ */
+
+#define BSL430_URING_MAX_PORTS  64
+
+typedef struct bsl430_uring_s bsl430_uring_t;
+
+bsl430_uring_t *bsl430_uring_open(const char **ttys, int ports);
+int bsl430_uring_close(bsl430_uring_t *ring);
+int bsl430_uring_program(bsl430_uring_t *ring, const bsl430_stream_t *stream,
+                         const uint8_t *password);
+int bsl430_uring_status(bsl430_uring_t *ring, int port);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __BSL430_URING_H__ */
@@ -22,9 +22,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "bsl430-platform.h"
 #include "bsl430.h"
+#include "bsl430-trace.h"
 
 #define HEAD    0x80
 #define INITFCS 0xFFFF
@@ -33,7 +35,16 @@
 #define CHAR_TIMEOUT    10  /* ms */
 #define RESP_TIMEOUT   100  /* ms */
 
-#define STATE_INTERVAL  20  /* ms */
+/*
+ * The response timeout of each command follows the latency of its
+ * responses, from the frame written to the ACK read, the way TCP sets its
+ * retransmission timeout (RFC 6298): SRTT + 4 * RTTVAR, within the floor
+ * and the ceiling, doubled after each timeout until the next response.
+ * It is RESP_TIMEOUT before the first response.
+ */
+#define BSL430_RTO_MIN_MS       20
+#define BSL430_RTO_MAX_MS       1000
+#define BSL430_RTO_COMMANDS     8
 
 /*
  * The minimum time delay before sending new characters
@@ -41,11 +52,30 @@
  */
 #define BSL430_SENDING_DELAY    5   /* ms */
 
-#define BSL430_ADDR_LOW     0xC400
-#define BSL430_ADDR_HIGH    0xFFFF
+/* Round trips measured, and how far above the wire time is worth a warning. */
+#define BSL430_RTT_PROBES       3
+#define BSL430_RTT_WARN_FACTOR  4
+#define BSL430_RTT_WARN_US      2000
+
+/*
+ * A data frame lost or corrupted on the line is sent again, up to
+ * BSL430_RETRIES times, each time with half the data down to
+ * BSL430_MIN_DATA_SIZE. The data size doubles again after BSL430_GROW_AFTER
+ * frames acknowledged in a row.
+ */
+#define BSL430_RETRIES          3
+#define BSL430_MIN_DATA_SIZE    32
+#define BSL430_GROW_AFTER       16
+
+/* RAM, writable for a secondary loader. */
+#define BSL430_RAM_LOW      0x2000
+#define BSL430_RAM_HIGH     0x2FFF
+
+/* Device Descriptors (TLV), readable only. */
+#define BSL430_TLV_LOW      0x1A00
+#define BSL430_TLV_HIGH     0x1AFF
+#define BSL430_TLV_DEVICE_ID    0x1A04
 
-/* D1...Dn */
-#define BSL430_MAX_DATA_SIZE    256
 /* CMD + AL AM AH + D1...Dn */
 #define BSL430_MAX_PAYLOADSIZE  (1 + 3 + BSL430_MAX_DATA_SIZE)
 /* ACK + Header + NL NH + Payload + CKL CKH */
@@ -71,8 +101,36 @@ typedef struct bsl430_frame_s {
     uint16_t fcs;
 } bsl430_frame_t;
 
+static const uint8_t rto_commands[BSL430_RTO_COMMANDS] = {
+    BSL430_CMD_RX_DATA_BLOCK, BSL430_CMD_RX_PASSWORD, BSL430_CMD_MASS_ERASE,
+    BSL430_CMD_CRC_CHECK, BSL430_CMD_LOAD_PC, BSL430_CMD_TX_DATA_BLOCK,
+    BSL430_CMD_TX_BSL_VERSION, BSL430_CMD_CHANGE_BAUDRATE
+};
+
+static bsl430_timeout_config_t rto_config = { BSL430_RTO_MIN_MS, BSL430_RTO_MAX_MS, CHAR_TIMEOUT };
+static bsl430_timeout_stats_t rto[BSL430_RTO_COMMANDS];
+static uint32_t rto_backoff[BSL430_RTO_COMMANDS];
+static uint64_t sent_us = 0;    /* when the last frame was written */
+
+static uint16_t data_size = BSL430_MAX_DATA_SIZE;
+static uint32_t clean_frames = 0;
+static bsl430_link_stats_t link_stats;
+
 static int bsl430_frame_send(bsl430_frame_t *frame);
-static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint16_t timeout);
+static int bsl430_frame_write(const uint8_t *buf, int n);
+static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint8_t cmd);
+static int bsl430_addr_check(uint32_t address, uint32_t size, int readonly);
+static int bsl430_rto_index(uint8_t cmd);
+static uint16_t bsl430_rto(int index);
+static void bsl430_rto_sample(int index, uint64_t us);
+static void bsl430_rto_timeout(int index);
+static uint64_t bsl430_now_us(void);
+static void bsl430_entry_hold(int ms, uint32_t *late_us);
+static void bsl430_link_error(void);
+static void bsl430_link_ok(void);
+static void bsl430_crc16_zero(uint16_t *mat);
+static uint16_t bsl430_crc16_times(const uint16_t *mat, uint16_t vec);
+static void bsl430_crc16_square(uint16_t *square, const uint16_t *mat);
 
 int bsl430_enter(int entry_seq)
 {
@@ -82,28 +140,7 @@ int bsl430_enter(int entry_seq)
     bsl430_gpio_init();
 
     if (entry_seq) {
-        /*                      ___________________
-         * RST ________________|
-         *            __      ____
-         * TST ______|  |____|    |________________
-         */
-        bsl430_gpio_rst(0);
-        bsl430_gpio_tst(0);
-        mdelay(STATE_INTERVAL * 2);
-
-        bsl430_gpio_tst(1);
-        mdelay(STATE_INTERVAL);
-        bsl430_gpio_tst(0);
-
-        mdelay(STATE_INTERVAL * 2);
-
-        bsl430_gpio_tst(1);
-
-        mdelay(STATE_INTERVAL);
-        bsl430_gpio_rst(1);
-
-        mdelay(STATE_INTERVAL);
-        bsl430_gpio_tst(0);
+        bsl430_entry_sequence();
     }
 
     /*
@@ -129,6 +166,42 @@ int bsl430_enter(int entry_seq)
     return 0;
 }
 
+/*
+ * Drive RST/TST through the BSL entry sequence, the GPIO initialized. The
+ * devices sharing the lines, e.g. on a fixture, enter the BSL together.
+ */
+int bsl430_entry_sequence(void)
+{
+    int interval = bsl430_gpio_interval();
+    uint32_t late_us = 0;
+
+    /*                      ___________________
+     * RST ________________|
+     *            __      ____
+     * TST ______|  |____|    |________________
+     */
+    bsl430_gpio_set(0, 0);
+    bsl430_entry_hold(interval * 2, &late_us);
+
+    bsl430_gpio_set(0, 1);
+    bsl430_entry_hold(interval, &late_us);
+    bsl430_gpio_set(0, 0);
+
+    bsl430_entry_hold(interval * 2, &late_us);
+
+    bsl430_gpio_set(0, 1);
+
+    bsl430_entry_hold(interval, &late_us);
+    bsl430_gpio_set(1, 1);
+
+    bsl430_entry_hold(interval, &late_us);
+    bsl430_gpio_set(1, 0);
+
+    debug("Entry sequence: a state held %u us too long at worst.\n", late_us);
+
+    return 0;
+}
+
 int bsl430_exit(void)
 {
     bsl430_uart_term();
@@ -137,26 +210,28 @@ int bsl430_exit(void)
      * RST       |____|
      */
     bsl430_gpio_rst(0);
-    mdelay(STATE_INTERVAL);
+    mdelay(bsl430_gpio_interval());
     bsl430_gpio_rst(1);
 
     return 0;
 }
 
+/*
+ * Write the data in frames of the current data size. A frame without a
+ * valid response, e.g. corrupted by noise on the line, is sent again with
+ * a smaller size after the input is cleared. RX_DATA_BLOCK writes the same
+ * data at the same address again, so it's safe. An error message of the
+ * BSL is not retried.
+ */
 int bsl430_cmd_rx_data_block(uint32_t address, uint8_t *data, uint16_t size)
 {
     int status = 0;
     bsl430_frame_t txframe;
     bsl430_frame_t rxframe;
     uint16_t write_size = 0;
+    int retry = 0;
 
-    if (address < BSL430_ADDR_LOW || address > BSL430_ADDR_HIGH) {
-        log("** Start address out of range.\n");
-        return -1;
-    }
-
-    if ((address + size) > (BSL430_ADDR_HIGH + 1)) {
-        log("** Access out of range.\n");
+    if (bsl430_addr_check(address, size, 0) != 0) {
         return -1;
     }
 
@@ -165,7 +240,7 @@ int bsl430_cmd_rx_data_block(uint32_t address, uint8_t *data, uint16_t size)
     }
 
     while (size > 0) {
-        write_size = (size > BSL430_MAX_DATA_SIZE)? BSL430_MAX_DATA_SIZE: size;
+        write_size = (size > data_size)? data_size: size;
 
         memset(&txframe, 0, sizeof(rxframe));
         memset(&rxframe, 0, sizeof(rxframe));
@@ -180,8 +255,16 @@ int bsl430_cmd_rx_data_block(uint32_t address, uint8_t *data, uint16_t size)
         txframe.len = 1 + 3 + write_size;
 
         bsl430_frame_send(&txframe);
+        link_stats.frames++;
+
+        status = bsl430_frame_recv(&rxframe, 1, BSL430_CMD_RX_DATA_BLOCK);
+        if (status != 0 && retry < BSL430_RETRIES) {
+            bsl430_link_error();
+            retry++;
+            log("** RX_DATA_BLOCK lost, retry %d with %u Bytes.\n", retry, data_size);
+            continue;
+        }
 
-        status = bsl430_frame_recv(&rxframe, 1, RESP_TIMEOUT);
         if (status == 0) {
             status = rxframe.payload[1];
         }
@@ -191,6 +274,104 @@ int bsl430_cmd_rx_data_block(uint32_t address, uint8_t *data, uint16_t size)
             break;
         }
 
+        bsl430_link_ok();
+        retry = 0;
+
+        address += write_size;
+        data    += write_size;
+        size    -= write_size;
+    }
+
+    return status;
+}
+
+/*
+ * Send an RX_DATA_BLOCK frame of bsl430_encode_rx_data_block() as is, e.g.
+ * from a stream encoded once for many devices.
+ */
+int bsl430_cmd_rx_data_frame(const uint8_t *frame, uint16_t len)
+{
+    int status = 0;
+    bsl430_frame_t rxframe;
+
+    if (!frame || len < 3 + 4 + 1 + 2 || len > BSL430_RX_DATA_FRAME_SIZE ||
+        frame[0] != HEAD || frame[3] != BSL430_CMD_RX_DATA_BLOCK) {
+        return -1;
+    }
+
+    memset(&rxframe, 0, sizeof(rxframe));
+
+    /* Smaller frames on a noisy line, the data is sent as a block then. */
+    if (len - (3 + 4 + 2) > data_size) {
+        return bsl430_cmd_rx_data_block((uint32_t)frame[4] | (uint32_t)frame[5] << 8 |
+                                        (uint32_t)frame[6] << 16,
+                                        (uint8_t *)&frame[7], (uint16_t)(len - (3 + 4 + 2)));
+    }
+
+    bsl430_frame_write(frame, len);
+    link_stats.frames++;
+
+    status = bsl430_frame_recv(&rxframe, 1, BSL430_CMD_RX_DATA_BLOCK);
+    if (status != 0) {
+        bsl430_link_error();
+        log("** RX_DATA_BLOCK lost, retry with %u Bytes.\n", data_size);
+        return bsl430_cmd_rx_data_block((uint32_t)frame[4] | (uint32_t)frame[5] << 8 |
+                                        (uint32_t)frame[6] << 16,
+                                        (uint8_t *)&frame[7], (uint16_t)(len - (3 + 4 + 2)));
+    }
+
+    status = rxframe.payload[1];
+    if (status != 0) {
+        log("** RX_DATA_BLOCK failed! 0x%02X\n", (uint8_t)status);
+    } else {
+        bsl430_link_ok();
+    }
+
+    return status;
+}
+
+/*
+ * RX_DATA_BLOCK_FAST is not answered by the BSL core, so the frames follow
+ * each other after the sending delay without a round trip. A frame lost on
+ * the line is not known here, the caller checks the CRC of the data. The
+ * UART interface may ACK each frame, the input is to be cleared before the
+ * next command.
+ */
+int bsl430_cmd_rx_data_block_fast(uint32_t address, const uint8_t *data, uint16_t size)
+{
+    int status = 0;
+    bsl430_frame_t txframe;
+    uint16_t write_size = 0;
+
+    if (bsl430_addr_check(address, size, 0) != 0) {
+        return -1;
+    }
+
+    if (!data) {
+        return -1;
+    }
+
+    while (size > 0) {
+        write_size = (size > BSL430_MAX_DATA_SIZE)? BSL430_MAX_DATA_SIZE: size;
+
+        memset(&txframe, 0, sizeof(txframe));
+
+        log("RX_DATA_FAST: @%04X %3u Bytes\n", address, write_size);
+
+        txframe.payload[0] = BSL430_CMD_RX_DATA_BLOCK_F;
+        txframe.payload[1] = (uint8_t)(address >>  0 & 0xFF);
+        txframe.payload[2] = (uint8_t)(address >>  8 & 0xFF);
+        txframe.payload[3] = (uint8_t)(address >> 16 & 0xFF);
+        memcpy(&txframe.payload[4], data, write_size);
+        txframe.len = 1 + 3 + write_size;
+
+        status = bsl430_frame_send(&txframe);
+        if (status < 0) {
+            log("** RX_DATA_BLOCK_FAST failed!\n");
+            break;
+        }
+        status = 0;
+
         address += write_size;
         data    += write_size;
         size    -= write_size;
@@ -218,7 +399,7 @@ int bsl430_cmd_rx_password(uint8_t *password, uint16_t len)
 
     bsl430_frame_send(&txframe);
 
-    status = bsl430_frame_recv(&rxframe, 1, RESP_TIMEOUT);
+    status = bsl430_frame_recv(&rxframe, 1, BSL430_CMD_RX_PASSWORD);
     if (status == 0) {
         status = rxframe.payload[1];
     }
@@ -226,19 +407,35 @@ int bsl430_cmd_rx_password(uint8_t *password, uint16_t len)
     return status;
 }
 
-int bsl430_cmd_crc_check(uint32_t address, uint16_t size, uint16_t *crc)
+int bsl430_cmd_mass_erase(void)
 {
     int status = 0;
     bsl430_frame_t txframe;
     bsl430_frame_t rxframe;
 
-    if (address < BSL430_ADDR_LOW || address > BSL430_ADDR_HIGH) {
-        log("** Start address out of range.\n");
-        return -1;
+    memset(&txframe, 0, sizeof(rxframe));
+    memset(&rxframe, 0, sizeof(rxframe));
+
+    txframe.payload[0] = BSL430_CMD_MASS_ERASE;
+    txframe.len = 1;
+
+    bsl430_frame_send(&txframe);
+
+    status = bsl430_frame_recv(&rxframe, 1, BSL430_CMD_MASS_ERASE);
+    if (status == 0) {
+        status = rxframe.payload[1];
     }
 
-    if ((address + size) > (BSL430_ADDR_HIGH + 1)) {
-        log("** Access out of range.\n");
+    return status;
+}
+
+int bsl430_cmd_crc_check(uint32_t address, uint16_t size, uint16_t *crc)
+{
+    int status = 0;
+    bsl430_frame_t txframe;
+    bsl430_frame_t rxframe;
+
+    if (bsl430_addr_check(address, size, 1) != 0) {
         return -1;
     }
 
@@ -259,7 +456,7 @@ int bsl430_cmd_crc_check(uint32_t address, uint16_t size, uint16_t *crc)
 
     bsl430_frame_send(&txframe);
 
-    status = bsl430_frame_recv(&rxframe, 1, RESP_TIMEOUT);
+    status = bsl430_frame_recv(&rxframe, 1, BSL430_CMD_CRC_CHECK);
     if (status == 0) {
         if (rxframe.payload[0] == BSL430_RESP_DATA) {
             *crc = (uint16_t)rxframe.payload[1] << 0 |
@@ -279,13 +476,7 @@ int bsl430_cmd_tx_data_block(uint32_t address, uint16_t size, uint8_t *buf)
     bsl430_frame_t rxframe;
     uint16_t read_size = 0;
 
-    if (address < BSL430_ADDR_LOW || address > BSL430_ADDR_HIGH) {
-        log("** Start address out of range.\n");
-        return -1;
-    }
-
-    if ((address + size) > (BSL430_ADDR_HIGH + 1)) {
-        log("** Access out of range.\n");
+    if (bsl430_addr_check(address, size, 1) != 0) {
         return -1;
     }
 
@@ -311,7 +502,7 @@ int bsl430_cmd_tx_data_block(uint32_t address, uint16_t size, uint8_t *buf)
 
         bsl430_frame_send(&txframe);
 
-        status = bsl430_frame_recv(&rxframe, 1, RESP_TIMEOUT);
+        status = bsl430_frame_recv(&rxframe, 1, BSL430_CMD_TX_DATA_BLOCK);
         if (status == 0) {
             if (rxframe.payload[0] == BSL430_RESP_DATA) {
                 memcpy(buf, &rxframe.payload[1], read_size);
@@ -333,6 +524,31 @@ int bsl430_cmd_tx_data_block(uint32_t address, uint16_t size, uint8_t *buf)
     return status;
 }
 
+int bsl430_cmd_load_pc(uint32_t address)
+{
+    bsl430_frame_t txframe;
+    bsl430_frame_t rxframe;
+
+    if (bsl430_addr_check(address, 0, 1) != 0 &&
+        bsl430_addr_check(address, 0, 0) != 0) {
+        return -1;
+    }
+
+    memset(&txframe, 0, sizeof(rxframe));
+    memset(&rxframe, 0, sizeof(rxframe));
+
+    txframe.payload[0] = BSL430_CMD_LOAD_PC;
+    txframe.payload[1] = (uint8_t)(address >>  0 & 0xFF);
+    txframe.payload[2] = (uint8_t)(address >>  8 & 0xFF);
+    txframe.payload[3] = (uint8_t)(address >> 16 & 0xFF);
+    txframe.len = 4;
+
+    bsl430_frame_send(&txframe);
+
+    /* The BSL jumps to the address, only the ACK comes back. */
+    return bsl430_frame_recv(&rxframe, 0, BSL430_CMD_LOAD_PC);
+}
+
 int bsl430_cmd_tx_version(uint32_t *version)
 {
     int status = 0;
@@ -351,7 +567,7 @@ int bsl430_cmd_tx_version(uint32_t *version)
 
     bsl430_frame_send(&txframe);
 
-    status = bsl430_frame_recv(&rxframe, 1, RESP_TIMEOUT);
+    status = bsl430_frame_recv(&rxframe, 1, BSL430_CMD_TX_BSL_VERSION);
     if (status == 0) {
         if (rxframe.payload[0] == BSL430_RESP_DATA) {
             *version = (uint32_t)rxframe.payload[1] << 24 |
@@ -396,7 +612,7 @@ int bsl430_cmd_change_baudrate(uint32_t baudrate)
 
     bsl430_frame_send(&txframe);
 
-    status = bsl430_frame_recv(&rxframe, 0, RESP_TIMEOUT);
+    status = bsl430_frame_recv(&rxframe, 0, BSL430_CMD_CHANGE_BAUDRATE);
     if (status == 0) {
         log("Change baudrate to %d.\n", baudrate);
         bsl430_uart_init(baudrate, 0);
@@ -405,6 +621,169 @@ int bsl430_cmd_change_baudrate(uint32_t baudrate)
     return status;
 }
 
+int bsl430_device_id(uint8_t *id, uint16_t len)
+{
+    if (!id || len < BSL430_DEVICE_ID_SIZE) {
+        return -1;
+    }
+
+    /*
+     * SLAU445: Device Descriptors
+     * Device ID, hardware and firmware revision followed by the die record
+     * (lot/wafer ID, die X/Y position and test results) identify a unit.
+     */
+    return bsl430_cmd_tx_data_block(BSL430_TLV_DEVICE_ID, BSL430_DEVICE_ID_SIZE, id);
+}
+
+/*
+ * Encode an RX_DATA_BLOCK frame of up to BSL430_MAX_DATA_SIZE bytes into
+ * frame, BSL430_RX_DATA_FRAME_SIZE bytes at most.
+ *
+ * Return the length of the frame, or -1.
+ */
+int bsl430_encode_rx_data_block(uint32_t address, const uint8_t *data, uint16_t size,
+                                uint8_t *frame)
+{
+    uint16_t len = 1 + 3 + size;
+    uint16_t fcs;
+    int n = 0;
+
+    if (!data || !frame || size == 0 || size > BSL430_MAX_DATA_SIZE ||
+        bsl430_addr_check(address, size, 0) != 0) {
+        return -1;
+    }
+
+    frame[n++] = HEAD;
+    frame[n++] = (uint8_t)(len >> 0 & 0x00FF);
+    frame[n++] = (uint8_t)(len >> 8 & 0x00FF);
+
+    frame[n++] = BSL430_CMD_RX_DATA_BLOCK;
+    frame[n++] = (uint8_t)(address >>  0 & 0xFF);
+    frame[n++] = (uint8_t)(address >>  8 & 0xFF);
+    frame[n++] = (uint8_t)(address >> 16 & 0xFF);
+    memcpy(&frame[n], data, size);
+    n += size;
+
+    fcs = bsl430_crc16(&frame[3], len, INITFCS);
+    frame[n++] = (uint8_t)(fcs >> 0 & 0x00FF);
+    frame[n++] = (uint8_t)(fcs >> 8 & 0x00FF);
+
+    return n;
+}
+
+/*
+ * Time a few TX_BSL_VERSION at the current baudrate, the BSL answers it by
+ * a frame whether it is locked or not. Every RX_DATA_BLOCK waits for such a
+ * round trip. The UART stats are reset.
+ *
+ * Return the mean round trip time in us, or -1.
+ */
+int bsl430_measure_rtt(void)
+{
+    bsl430_uart_stats_t stats;
+    uint32_t version = 0;
+    int i;
+
+    bsl430_uart_reset_stats();
+
+    for (i = 0; i < BSL430_RTT_PROBES; i++) {
+        bsl430_cmd_tx_version(&version);
+    }
+
+    bsl430_uart_get_stats(&stats);
+    if (stats.rtt_count == 0) {
+        log("** No response to measure the RTT.\n");
+        return -1;
+    }
+
+    log("RTT: %u us (max %u us), wire time %u us.\n",
+        stats.rtt_us, stats.rtt_max_us, stats.rtt_wire_us);
+
+    /* e.g. the latency timer of a USB-serial adapter. */
+    if (stats.rtt_us > stats.rtt_wire_us * BSL430_RTT_WARN_FACTOR &&
+        stats.rtt_us - stats.rtt_wire_us > BSL430_RTT_WARN_US) {
+        log("** RTT is far above the wire time! Try the low latency mode of the UART.\n");
+    }
+
+    return (int)stats.rtt_us;
+}
+
+/*
+ * Set the floor and the ceiling of the response timeouts, and the timeout
+ * between the characters of a response. 0 keeps a value as it is.
+ */
+int bsl430_set_timeouts(const bsl430_timeout_config_t *config)
+{
+    if (!config) {
+        return -1;
+    }
+
+    rto_config.min_ms  = (config->min_ms)? config->min_ms: rto_config.min_ms;
+    rto_config.max_ms  = (config->max_ms)? config->max_ms: rto_config.max_ms;
+    rto_config.char_ms = (config->char_ms)? config->char_ms: rto_config.char_ms;
+
+    if (rto_config.max_ms < rto_config.min_ms) {
+        rto_config.max_ms = rto_config.min_ms;
+    }
+
+    return 0;
+}
+
+/*
+ * The estimate of the <index>th command, 0 to BSL430_RTO_COMMANDS - 1, or
+ * -1 past the last one.
+ */
+int bsl430_get_timeout_stats(int index, bsl430_timeout_stats_t *stats)
+{
+    if (!stats || index < 0 || index >= BSL430_RTO_COMMANDS) {
+        return -1;
+    }
+
+    *stats = rto[index];
+    stats->cmd = rto_commands[index];
+    stats->rto_ms = bsl430_rto(index);
+
+    return 0;
+}
+
+/*
+ * Forget the estimates, e.g. on another link.
+ */
+int bsl430_reset_timeouts(void)
+{
+    memset(rto, 0, sizeof(rto));
+    memset(rto_backoff, 0, sizeof(rto_backoff));
+
+    return 0;
+}
+
+int bsl430_get_link_stats(bsl430_link_stats_t *stats)
+{
+    if (!stats) {
+        return -1;
+    }
+
+    *stats = link_stats;
+    stats->data_size = data_size;
+    stats->error_rate = (link_stats.frames)?
+                        (uint32_t)((uint64_t)link_stats.errors * 1000000 / link_stats.frames): 0;
+
+    return 0;
+}
+
+/*
+ * Reset the statistics, and the data size to BSL430_MAX_DATA_SIZE, e.g.
+ * for the next device.
+ */
+int bsl430_reset_link_stats(void)
+{
+    memset(&link_stats, 0, sizeof(link_stats));
+    data_size = BSL430_MAX_DATA_SIZE;
+    clean_frames = 0;
+
+    return 0;
+}
+
 /*
  * CRC-CCITT (0xFFFF) polynomial ^16 + ^12 + ^5 + 1
  *
@@ -432,30 +811,131 @@ uint16_t bsl430_crc16(const uint8_t *data, int len, uint16_t acc)
     return acc;
 }
 
-static int bsl430_frame_send(bsl430_frame_t *frame)
+/*
+ * CRC of ranges without their bytes, the way zlib combines CRC-32. The CRC
+ * register after a byte of 0 is a linear map of the register before, a
+ * 16x16 matrix over GF(2) of one column per bit, so the register after n
+ * bytes of 0 is its n-th power, by log2(n) squarings. The CRC is linear in
+ * the register and the data together, so ranges add up by XOR.
+ */
+uint16_t bsl430_crc16_shift(uint16_t crc, uint32_t len)
 {
-    int i;
+    uint16_t power[16];
+    uint16_t square[16];
 
-    mdelay(BSL430_SENDING_DELAY);
+    bsl430_crc16_zero(power);
 
-    bsl430_uart_writeb(HEAD);
+    while (len > 0) {
+        if (len & 1) {
+            crc = bsl430_crc16_times(power, crc);
+        }
+        len >>= 1;
+        if (len > 0) {
+            bsl430_crc16_square(square, power);
+            memcpy(power, square, sizeof(power));
+        }
+    }
 
-    bsl430_uart_writeb((uint8_t)(frame->len >> 0 & 0x00FF));
-    bsl430_uart_writeb((uint8_t)(frame->len >> 8 & 0x00FF));
+    return crc;
+}
 
-    for (i = 0; i < frame->len; i++) {
-        bsl430_uart_writeb(frame->payload[i]);
+/*
+ * CRC of A followed by B, from the CRCs of A and of B of <len2> bytes, both
+ * seeded by INITFCS as CRC_CHECK does.
+ */
+uint16_t bsl430_crc16_combine(uint16_t crc1, uint16_t crc2, uint32_t len2)
+{
+    return bsl430_crc16_shift(crc1 ^ INITFCS, len2) ^ crc2;
+}
+
+/*
+ * <crc> continued over <len> bytes of <b>, e.g. erased FRAM. A run of 2^k
+ * bytes is the run of 2^(k-1) twice, the bits of <len> add them up.
+ */
+uint16_t bsl430_crc16_extend_const(uint16_t crc, uint8_t b, uint32_t len)
+{
+    uint16_t power[16];
+    uint16_t square[16];
+    uint16_t run = bsl430_crc16_add(b, 0);
+    uint16_t acc = 0;
+
+    bsl430_crc16_zero(power);
+
+    while (len > 0) {
+        if (len & 1) {
+            crc = bsl430_crc16_times(power, crc);
+            acc = bsl430_crc16_times(power, acc) ^ run;
+        }
+        len >>= 1;
+        if (len > 0) {
+            run = bsl430_crc16_times(power, run) ^ run;
+            bsl430_crc16_square(square, power);
+            memcpy(power, square, sizeof(power));
+        }
+    }
+
+    return crc ^ acc;
+}
+
+/*
+ * Return 1 if the <size> bytes at <data>, written at <address>, are what
+ * MASS_ERASE leaves there: all 0xFF in code FRAM. The information FRAM is
+ * kept by the erase, nothing is blank there.
+ */
+int bsl430_blank(uint32_t address, const uint8_t *data, uint32_t size)
+{
+    uint32_t i;
+
+    if (address < BSL430_FRAM_LOW) {
+        return 0;
     }
 
+    for (i = 0; i < size; i++) {
+        if (data[i] != 0xFF) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int bsl430_frame_send(bsl430_frame_t *frame)
+{
+    uint8_t buf[BSL430_MAX_FRAME_SIZE];
+    int n = 0;
+
     frame->fcs = bsl430_crc16(frame->payload, frame->len, INITFCS);
 
-    bsl430_uart_writeb((uint8_t)(frame->fcs >> 0 & 0x00FF));
-    bsl430_uart_writeb((uint8_t)(frame->fcs >> 8 & 0x00FF));
+    buf[n++] = HEAD;
 
-    return 0;
+    buf[n++] = (uint8_t)(frame->len >> 0 & 0x00FF);
+    buf[n++] = (uint8_t)(frame->len >> 8 & 0x00FF);
+
+    memcpy(&buf[n], frame->payload, frame->len);
+    n += frame->len;
+
+    buf[n++] = (uint8_t)(frame->fcs >> 0 & 0x00FF);
+    buf[n++] = (uint8_t)(frame->fcs >> 8 & 0x00FF);
+
+    return bsl430_frame_write(buf, n);
 }
 
-static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint16_t timeout)
+static int bsl430_frame_write(const uint8_t *buf, int n)
+{
+    int status = 0;
+
+    mdelay(BSL430_SENDING_DELAY);
+
+    bsl430_trace_frame(BSL430_TRACE_FRAME_TX, 0, &buf[3], (uint16_t)(n - 5));
+
+    /* The platform paces the characters for the ONE-byte FIFO of MSP430. */
+    status = bsl430_uart_write(buf, n);
+    sent_us = bsl430_now_us();
+
+    return status;
+}
+
+static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint8_t cmd)
 {
     int status = 0;
     int i;
@@ -464,8 +944,17 @@ static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint16_t timeout)
     uint16_t len;
     uint8_t ckl, ckh;
     uint16_t cks;
+    int index = bsl430_rto_index(cmd);
+    uint16_t timeout = bsl430_rto(index);
+    uint16_t char_timeout = rto_config.char_ms;
 
     c = bsl430_uart_readb(timeout);
+    if (c == -1) {
+        bsl430_rto_timeout(index);
+    } else {
+        bsl430_rto_sample(index, bsl430_now_us() - sent_us);
+    }
+
     if ((uint8_t)c != ACK) {
         log("** Wrong ACK. 0x%02x\n", (uint8_t)c);
         status = (uint8_t)c;
@@ -473,6 +962,7 @@ static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint16_t timeout)
     }
 
     if (!resp) {
+        bsl430_trace_frame(BSL430_TRACE_FRAME_RX, 0, NULL, 0);
         return 0;
     }
 
@@ -485,7 +975,7 @@ static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint16_t timeout)
     }
 
     /* NL NH */
-    c = bsl430_uart_readb(CHAR_TIMEOUT);
+    c = bsl430_uart_readb(char_timeout);
     if (c == -1) {
         log("** NL timeout.\n");
         status = -1;
@@ -493,7 +983,7 @@ static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint16_t timeout)
     }
     nl = (uint8_t)c;
 
-    c = bsl430_uart_readb(CHAR_TIMEOUT);
+    c = bsl430_uart_readb(char_timeout);
     if (c == -1) {
         log("** NH timeout.\n");
         status = -1;
@@ -512,7 +1002,7 @@ static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint16_t timeout)
 
     /* Response */
     for (i = 0; i < len; i++) {
-        c = bsl430_uart_readb(CHAR_TIMEOUT);
+        c = bsl430_uart_readb(char_timeout);
         if (c == -1) {
             log("** Response data timeout. %d\n", i);
             status = -1;
@@ -522,7 +1012,7 @@ static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint16_t timeout)
     }
 
     /* CKL CKH */
-    c = bsl430_uart_readb(CHAR_TIMEOUT);
+    c = bsl430_uart_readb(char_timeout);
     if (c == -1) {
         log("** CKL timeout.\n");
         status = -1;
@@ -530,7 +1020,7 @@ static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint16_t timeout)
     }
     ckl = (uint8_t)c;
 
-    c = bsl430_uart_readb(CHAR_TIMEOUT);
+    c = bsl430_uart_readb(char_timeout);
     if (c == -1) {
         log("** CKH timeout.\n");
         status = -1;
@@ -550,14 +1040,213 @@ static int bsl430_frame_recv(bsl430_frame_t *frame, int resp, uint16_t timeout)
 
     frame->len = len;
 
+    bsl430_trace_frame(BSL430_TRACE_FRAME_RX, 0, frame->payload, len);
+
     return 0;
 
 err_exit:
+    bsl430_trace_frame(BSL430_TRACE_FRAME_RX, (status != 0)? status: -1, NULL, 0);
+
     /*
-     * Clear all subsequence characters for frame SYNC recovery.
+     * Clear all subsequence characters for frame SYNC recovery, until the
+     * line is quiet for a character timeout, for the RTO of the command at
+     * most.
      */
-    mdelay(RESP_TIMEOUT);
-    bsl430_uart_clear();
+    bsl430_uart_drain(char_timeout, timeout);
 
     return status;
 }
+
+static int bsl430_addr_check(uint32_t address, uint32_t size, int readonly)
+{
+    uint32_t low  = BSL430_FRAM_LOW;
+    uint32_t high = BSL430_FRAM_HIGH;
+
+    if (address >= BSL430_INFO_LOW && address <= BSL430_INFO_HIGH) {
+        low  = BSL430_INFO_LOW;
+        high = BSL430_INFO_HIGH;
+    } else if (address >= BSL430_RAM_LOW && address <= BSL430_RAM_HIGH) {
+        low  = BSL430_RAM_LOW;
+        high = BSL430_RAM_HIGH;
+    } else if (readonly && address >= BSL430_TLV_LOW && address <= BSL430_TLV_HIGH) {
+        low  = BSL430_TLV_LOW;
+        high = BSL430_TLV_HIGH;
+    }
+
+    if (address < low || address > high) {
+        log("** Start address out of range.\n");
+        return -1;
+    }
+
+    if ((address + size) > (high + 1)) {
+        log("** Access out of range.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * A data frame got no valid response, halve the data size.
+ */
+static void bsl430_link_error(void)
+{
+    link_stats.errors++;
+    link_stats.retries++;
+    clean_frames = 0;
+
+    if (data_size > BSL430_MIN_DATA_SIZE) {
+        data_size /= 2;
+        link_stats.shrinks++;
+    }
+}
+
+/*
+ * A data frame is acknowledged, grow the data size back on a clean line.
+ */
+static void bsl430_link_ok(void)
+{
+    if (data_size < BSL430_MAX_DATA_SIZE && ++clean_frames >= BSL430_GROW_AFTER) {
+        data_size *= 2;
+        clean_frames = 0;
+    }
+}
+
+static int bsl430_rto_index(uint8_t cmd)
+{
+    int i;
+
+    for (i = 0; i < BSL430_RTO_COMMANDS; i++) {
+        if (rto_commands[i] == cmd) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Response timeout of the command in ms.
+ */
+static uint16_t bsl430_rto(int index)
+{
+    uint64_t us = RESP_TIMEOUT * 1000;
+
+    if (index < 0) {
+        return RESP_TIMEOUT;
+    }
+
+    if (rto[index].samples > 0) {
+        us = rto[index].srtt_us + 4 * (uint64_t)rto[index].rttvar_us;
+    }
+
+    us <<= rto_backoff[index];
+
+    if (us < (uint64_t)rto_config.min_ms * 1000) {
+        us = (uint64_t)rto_config.min_ms * 1000;
+    }
+    if (us > (uint64_t)rto_config.max_ms * 1000) {
+        us = (uint64_t)rto_config.max_ms * 1000;
+    }
+
+    return (uint16_t)((us + 999) / 1000);
+}
+
+static void bsl430_rto_sample(int index, uint64_t us)
+{
+    bsl430_timeout_stats_t *s = NULL;
+    uint32_t r = (us > 0xFFFFFFFF)? 0xFFFFFFFF: (uint32_t)us;
+    uint32_t delta;
+
+    if (index < 0) {
+        return;
+    }
+
+    s = &rto[index];
+
+    if (s->samples == 0) {
+        s->srtt_us = r;
+        s->rttvar_us = r / 2;
+    } else {
+        delta = (s->srtt_us > r)? s->srtt_us - r: r - s->srtt_us;
+        s->rttvar_us = s->rttvar_us - s->rttvar_us / 4 + delta / 4;
+        s->srtt_us = s->srtt_us - s->srtt_us / 8 + r / 8;
+    }
+
+    s->samples++;
+    s->max_us = (r > s->max_us)? r: s->max_us;
+    rto_backoff[index] = 0;
+}
+
+static void bsl430_rto_timeout(int index)
+{
+    if (index < 0) {
+        return;
+    }
+
+    rto[index].timeouts++;
+    if (bsl430_rto(index) < rto_config.max_ms) {
+        rto_backoff[index]++;
+    }
+}
+
+static uint64_t bsl430_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/*
+ * Hold a state of the entry sequence for <ms>, the overshoot is the jitter
+ * of the host.
+ */
+static void bsl430_entry_hold(int ms, uint32_t *late_us)
+{
+    uint64_t start = bsl430_now_us();
+    uint64_t held;
+
+    mdelay(ms);
+
+    held = bsl430_now_us() - start;
+    if (held > (uint64_t)ms * 1000 && held - (uint64_t)ms * 1000 > *late_us) {
+        *late_us = (uint32_t)(held - (uint64_t)ms * 1000);
+    }
+}
+
+/*
+ * The matrix of a byte of 0, the register after it for each bit set alone.
+ */
+static void bsl430_crc16_zero(uint16_t *mat)
+{
+    int n;
+
+    for (n = 0; n < 16; n++) {
+        mat[n] = bsl430_crc16_add(0, (uint16_t)(1 << n));
+    }
+}
+
+static uint16_t bsl430_crc16_times(const uint16_t *mat, uint16_t vec)
+{
+    uint16_t sum = 0;
+
+    while (vec) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        mat++;
+    }
+
+    return sum;
+}
+
+static void bsl430_crc16_square(uint16_t *square, const uint16_t *mat)
+{
+    int n;
+
+    for (n = 0; n < 16; n++) {
+        square[n] = bsl430_crc16_times(mat, mat[n]);
+    }
+}
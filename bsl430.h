@@ -39,18 +39,89 @@ extern "C" {
 #define BSL430_MSG_PASSWD_ERROR     0x05
 #define BSL430_MSG_UNKNOWN_CMD      0x07
 
+/* D1...Dn */
+#define BSL430_MAX_DATA_SIZE        256
+
+/* Device ID .. die record test results in TLV. */
+#define BSL430_DEVICE_ID_SIZE       16
+
+/* Header + NL NH + CMD AL AM AH + D1...Dn + CKL CKH */
+#define BSL430_RX_DATA_FRAME_SIZE   (3 + 4 + BSL430_MAX_DATA_SIZE + 2)
+
+/* Code FRAM, cleared to 0xFF by MASS_ERASE. */
+#define BSL430_FRAM_LOW             0xC400
+#define BSL430_FRAM_HIGH            0xFFFF
+
+/* Information FRAM, e.g. calibration, writable and kept by MASS_ERASE. */
+#define BSL430_INFO_LOW             0x1800
+#define BSL430_INFO_HIGH            0x19FF
+
+/*
+ * Data frames on the line, see bsl430_cmd_rx_data_block(). <error_rate> is
+ * the frames without a valid response per million, <data_size> the size
+ * the data is sent in now.
+ */
+typedef struct bsl430_link_stats_s {
+    uint32_t frames;
+    uint32_t errors;
+    uint32_t retries;
+    uint32_t shrinks;
+    uint32_t error_rate;
+    uint16_t data_size;
+} bsl430_link_stats_t;
+
+/*
+ * Response timeouts, see bsl430_set_timeouts(). The estimate of each
+ * command is kept from its responses, <rto_ms> is the timeout in use.
+ */
+typedef struct bsl430_timeout_config_s {
+    uint16_t min_ms;        /* floor of the response timeouts */
+    uint16_t max_ms;        /* ceiling */
+    uint16_t char_ms;       /* between the characters of a response */
+} bsl430_timeout_config_t;
+
+typedef struct bsl430_timeout_stats_s {
+    uint8_t  cmd;
+    uint32_t samples;
+    uint32_t timeouts;
+    uint32_t srtt_us;
+    uint32_t rttvar_us;
+    uint32_t max_us;
+    uint32_t rto_ms;
+} bsl430_timeout_stats_t;
+
 int bsl430_enter(int entry_seq);
 int bsl430_exit(void);
+int bsl430_entry_sequence(void);
 
 int bsl430_cmd_rx_data_block(uint32_t address, uint8_t *data, uint16_t size);
+int bsl430_cmd_rx_data_frame(const uint8_t *frame, uint16_t len);
+int bsl430_cmd_rx_data_block_fast(uint32_t address, const uint8_t *data, uint16_t size);
 int bsl430_cmd_rx_password(uint8_t *password, uint16_t len);
+int bsl430_cmd_mass_erase(void);
 int bsl430_cmd_crc_check(uint32_t address, uint16_t size, uint16_t *crc);
 int bsl430_cmd_tx_data_block(uint32_t address, uint16_t size, uint8_t *buf);
+int bsl430_cmd_load_pc(uint32_t address);
 int bsl430_cmd_tx_version(uint32_t *version);
 int bsl430_cmd_change_baudrate(uint32_t baudrate);
 
+int bsl430_device_id(uint8_t *id, uint16_t len);
+int bsl430_encode_rx_data_block(uint32_t address, const uint8_t *data, uint16_t size,
+                                uint8_t *frame);
+int bsl430_measure_rtt(void);
+int bsl430_get_link_stats(bsl430_link_stats_t *stats);
+int bsl430_reset_link_stats(void);
+int bsl430_set_timeouts(const bsl430_timeout_config_t *config);
+int bsl430_get_timeout_stats(int index, bsl430_timeout_stats_t *stats);
+int bsl430_reset_timeouts(void);
+
 uint16_t bsl430_crc16_add(uint8_t b, uint16_t acc);
 uint16_t bsl430_crc16(const uint8_t *data, int len, uint16_t acc);
+uint16_t bsl430_crc16_shift(uint16_t crc, uint32_t len);
+uint16_t bsl430_crc16_combine(uint16_t crc1, uint16_t crc2, uint32_t len2);
+uint16_t bsl430_crc16_extend_const(uint16_t crc, uint8_t b, uint32_t len);
+
+int bsl430_blank(uint32_t address, const uint8_t *data, uint32_t size);
 
 #ifdef __cplusplus
 }
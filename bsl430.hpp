@@ -0,0 +1,603 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * bsl430.hpp:
+ *      Header only C++17 layer of the BSL protocol.
+ *
+ *      A session<Transport> owns its link, nothing is global. The transport
+ *      is a policy class, so its read and write are inlined into the frame
+ *      codec. Frames without variable fields are encoded at compile time.
+ *      The status codes are the same as of the C API.
+ *
+ *      struct Transport {
+ *          int  open();                            // enter BSL, 9600 8E1
+ *          void close();                           // leave BSL
+ *          int  set_baudrate(uint32_t baudrate);
+ *          int  write(const uint8_t *buf, size_t len);
+ *          int  readb(uint16_t timeout);           // byte or -1
+ *          void clear();
+ *      };
+ */
+
+#ifndef __BSL430_HPP__
+#define __BSL430_HPP__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+#endif
+
+#include "bsl430.h"
+#include "bsl430-uart.h"
+#include "bsl430-stream.h"
+
+namespace bsl430 {
+
+#if defined(__cpp_lib_span)
+template <class T>
+using span = std::span<T>;
+#else
+/* The subset of std::span used here, until C++20. */
+template <class T>
+class span {
+public:
+    constexpr span() noexcept : data_(nullptr), size_(0) {}
+    constexpr span(T *data, size_t size) noexcept : data_(data), size_(size) {}
+    template <size_t N>
+    constexpr span(T (&array)[N]) noexcept : data_(array), size_(N) {}
+    template <class U, size_t N>
+    constexpr span(const std::array<U, N> &array) noexcept : data_(array.data()), size_(N) {}
+    template <class U, size_t N>
+    constexpr span(std::array<U, N> &array) noexcept : data_(array.data()), size_(N) {}
+
+    constexpr T *data() const noexcept { return data_; }
+    constexpr size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr T &operator[](size_t i) const noexcept { return data_[i]; }
+    constexpr T *begin() const noexcept { return data_; }
+    constexpr T *end() const noexcept { return data_ + size_; }
+
+    constexpr span subspan(size_t offset, size_t count) const noexcept
+    {
+        return span(data_ + offset, count);
+    }
+
+private:
+    T *data_;
+    size_t size_;
+};
+#endif
+
+constexpr uint8_t HEAD    = 0x80;
+constexpr uint8_t ACK     = 0x00;
+constexpr uint16_t INITFCS = 0xFFFF;
+
+constexpr uint16_t CHAR_TIMEOUT = 10;   /* ms */
+constexpr uint16_t RESP_TIMEOUT = 100;  /* ms */
+
+/* The minimum delay before sending after receiving is 1.2 ms. */
+constexpr long SENDING_DELAY_US = 5000;
+
+constexpr uint8_t CMD_RX_DATA_BLOCK   = 0x10;
+constexpr uint8_t CMD_RX_PASSWORD     = 0x11;
+constexpr uint8_t CMD_MASS_ERASE      = 0x15;
+constexpr uint8_t CMD_CRC_CHECK       = 0x16;
+constexpr uint8_t CMD_LOAD_PC         = 0x17;
+constexpr uint8_t CMD_TX_DATA_BLOCK   = 0x18;
+constexpr uint8_t CMD_TX_BSL_VERSION  = 0x19;
+constexpr uint8_t CMD_CHANGE_BAUDRATE = 0x52;
+
+constexpr uint8_t RESP_DATA = 0x3A;
+constexpr uint8_t RESP_MSG  = 0x3B;
+
+constexpr size_t MAX_PAYLOADSIZE = 1 + 3 + BSL430_MAX_DATA_SIZE;
+
+/* Same CRC-CCITT as bsl430_crc16_add(), usable in constant expressions. */
+constexpr uint16_t crc16_add(uint8_t b, uint16_t acc) noexcept
+{
+    acc  = (uint16_t)((uint8_t)(acc >> 8) | (uint16_t)(acc << 8));
+    acc ^= b;
+    acc ^= (uint8_t)(acc & 0xff) >> 4;
+    acc ^= (uint16_t)((uint16_t)(acc << 8) << 4);
+    acc ^= (uint16_t)(((acc & 0xff) << 4) << 1);
+    return acc;
+}
+
+constexpr uint16_t crc16(const uint8_t *data, size_t len, uint16_t acc = INITFCS) noexcept
+{
+    for (size_t i = 0; i < len; i++) {
+        acc = crc16_add(data[i], acc);
+    }
+    return acc;
+}
+
+/* Header + NL NH + Payload + CKL CKH, all known at compile time. */
+template <size_t N>
+constexpr std::array<uint8_t, N + 5> encode(const std::array<uint8_t, N> &payload) noexcept
+{
+    std::array<uint8_t, N + 5> frame{};
+    uint16_t fcs = crc16(payload.data(), N);
+
+    frame[0] = HEAD;
+    frame[1] = (uint8_t)(N >> 0 & 0xFF);
+    frame[2] = (uint8_t)(N >> 8 & 0xFF);
+    for (size_t i = 0; i < N; i++) {
+        frame[3 + i] = payload[i];
+    }
+    frame[3 + N] = (uint8_t)(fcs >> 0 & 0xFF);
+    frame[4 + N] = (uint8_t)(fcs >> 8 & 0xFF);
+
+    return frame;
+}
+
+namespace frames {
+
+constexpr auto tx_bsl_version = encode<1>({{CMD_TX_BSL_VERSION}});
+constexpr auto mass_erase     = encode<1>({{CMD_MASS_ERASE}});
+
+constexpr auto change_baudrate_9600   = encode<2>({{CMD_CHANGE_BAUDRATE, 0x02}});
+constexpr auto change_baudrate_19200  = encode<2>({{CMD_CHANGE_BAUDRATE, 0x03}});
+constexpr auto change_baudrate_38400  = encode<2>({{CMD_CHANGE_BAUDRATE, 0x04}});
+constexpr auto change_baudrate_57600  = encode<2>({{CMD_CHANGE_BAUDRATE, 0x05}});
+constexpr auto change_baudrate_115200 = encode<2>({{CMD_CHANGE_BAUDRATE, 0x06}});
+
+}  /* namespace frames */
+
+/* SLAU550: TX BSL version is 80 01 00 19 E8 62. */
+static_assert(frames::tx_bsl_version[4] == 0xE8 && frames::tx_bsl_version[5] == 0x62,
+              "CRC-CCITT (0xFFFF)");
+
+/*
+ * Transport over the C platform layer, i.e. bsl430-platform.c.
+ * The platform is process wide, so only one session may use it at a time.
+ */
+class platform_transport {
+public:
+    int open() { return bsl430_enter(1); }
+    void close() { bsl430_exit(); }
+    int set_baudrate(uint32_t baudrate) { return bsl430_uart_init((int)baudrate, 0); }
+    int write(const uint8_t *buf, size_t len) { return bsl430_uart_write(buf, (int)len); }
+    int readb(uint16_t timeout) { return bsl430_uart_readb(timeout); }
+    void clear() { bsl430_uart_clear(); }
+};
+
+/*
+ * Transport over a tty of its own, 8E1, paced by the character time for
+ * the ONE-byte FIFO of MSP430. Entering the BSL (RST/TST) is left to the
+ * caller, derive from it to add one.
+ */
+class fd_transport {
+public:
+    explicit fd_transport(const char *path) noexcept : path_(path) {}
+    fd_transport(const fd_transport &) = delete;
+    fd_transport &operator=(const fd_transport &) = delete;
+    ~fd_transport() { close(); }
+
+    int open()
+    {
+        fd_ = ::open(path_, O_RDWR | O_NOCTTY);
+        if (fd_ < 0) {
+            return -1;
+        }
+        return set_baudrate(9600);
+    }
+
+    void close()
+    {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int set_baudrate(uint32_t baudrate)
+    {
+        struct termios option;
+        speed_t speed;
+
+        switch (baudrate) {
+        case 9600:   speed = B9600;   break;
+        case 19200:  speed = B19200;  break;
+        case 38400:  speed = B38400;  break;
+        case 57600:  speed = B57600;  break;
+        case 115200: speed = B115200; break;
+        default:     return -1;
+        }
+
+        if (fd_ < 0 || tcgetattr(fd_, &option) != 0) {
+            return -1;
+        }
+
+        cfmakeraw(&option);
+        option.c_cflag |= PARENB | CLOCAL | CREAD;
+        option.c_cflag &= ~(PARODD | CSTOPB);
+        option.c_iflag |= INPCK;
+        option.c_cc[VMIN]  = 0;
+        option.c_cc[VTIME] = 0;
+        cfsetispeed(&option, speed);
+        cfsetospeed(&option, speed);
+
+        tcflush(fd_, TCIOFLUSH);
+        if (tcsetattr(fd_, TCSANOW, &option) != 0) {
+            return -1;
+        }
+
+        /* Start + 8 data + parity + stop bits, plus 20us guard. */
+        char_ns_ = 11LL * 1000000000LL / baudrate + 20000;
+        return 0;
+    }
+
+    int write(const uint8_t *buf, size_t len)
+    {
+        struct timespec next;
+
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        for (size_t i = 0; i < len; i++) {
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr) == EINTR) ;
+            if (::write(fd_, &buf[i], 1) != 1) {
+                return -1;
+            }
+            next.tv_nsec += char_ns_;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+        }
+        return 0;
+    }
+
+    int readb(uint16_t timeout)
+    {
+        struct pollfd pfd = { fd_, POLLIN, 0 };
+        uint8_t c;
+
+        if (poll(&pfd, 1, timeout) <= 0 || ::read(fd_, &c, 1) != 1) {
+            return -1;
+        }
+        return c;
+    }
+
+    void clear()
+    {
+        while (readb(CHAR_TIMEOUT) != -1) ;
+    }
+
+private:
+    const char *path_;
+    int fd_ = -1;
+    long char_ns_ = 0;
+};
+
+/*
+ * A BSL session, entered on construction and left on destruction.
+ */
+template <class Transport>
+class session {
+public:
+    explicit session(Transport &transport) : t_(transport)
+    {
+        status_ = t_.open();
+    }
+
+    session(const session &) = delete;
+    session &operator=(const session &) = delete;
+
+    ~session() { t_.close(); }
+
+    /* Result of entering the BSL. */
+    int status() const noexcept { return status_; }
+
+    int rx_password(span<const uint8_t> password)
+    {
+        if (password.size() != 32) {
+            return -1;
+        }
+        send(std::array<uint8_t, 1>{{CMD_RX_PASSWORD}}, password);
+        return recv_msg();
+    }
+
+    int mass_erase()
+    {
+        send_frame(frames::mass_erase);
+        return recv_msg();
+    }
+
+    int rx_data_block(uint32_t address, span<const uint8_t> data)
+    {
+        int status = 0;
+
+        while (!data.empty()) {
+            size_t n = (data.size() > BSL430_MAX_DATA_SIZE)? BSL430_MAX_DATA_SIZE: data.size();
+
+            send(command(CMD_RX_DATA_BLOCK, address), data.subspan(0, n));
+            status = recv_msg();
+            if (status != 0) {
+                break;
+            }
+
+            address += (uint32_t)n;
+            data = data.subspan(n, data.size() - n);
+        }
+
+        return status;
+    }
+
+    /* A frame of bsl430_encode_rx_data_block(), sent as it is. */
+    int rx_data_frame(span<const uint8_t> frame)
+    {
+        turnaround();
+        t_.write(frame.data(), frame.size());
+        return recv_msg();
+    }
+
+    /*
+     * All frames of a stream, each segment verified by CRC_CHECK. The stream
+     * is only read, so sessions on many ports can share one. On an erased
+     * device, the frames of 0xFF are left out.
+     */
+    int program(const bsl430_stream_t &stream, bool erased = false)
+    {
+        int status = 0;
+
+        for (uint32_t i = 0; i < stream.segments && status == 0; i++) {
+            const bsl430_stream_segment_t &segment = stream.segment[i];
+            uint16_t crc = 0;
+
+            for (uint32_t f = segment.frame; f < segment.frame + segment.frames; f++) {
+                const bsl430_stream_frame_t &frame = stream.index[f];
+
+                if (erased && (frame.flags & BSL430_STREAM_BLANK)) {
+                    continue;
+                }
+
+                status = rx_data_frame(span<const uint8_t>(bsl430_stream_frame(&stream, &frame),
+                                                           frame.len));
+                if (status != 0) {
+                    return status;
+                }
+            }
+
+            status = crc_check(segment.address, (uint16_t)segment.size, crc);
+            if (status == 0 && crc != segment.crc) {
+                status = 1;
+            }
+        }
+
+        return status;
+    }
+
+    int tx_data_block(uint32_t address, span<uint8_t> buf)
+    {
+        int status = 0;
+
+        while (!buf.empty()) {
+            size_t n = (buf.size() > BSL430_MAX_DATA_SIZE)? BSL430_MAX_DATA_SIZE: buf.size();
+
+            send(command(CMD_TX_DATA_BLOCK, address, (uint16_t)n));
+            status = recv(buf.subspan(0, n));
+            if (status != 0) {
+                break;
+            }
+
+            address += (uint32_t)n;
+            buf = buf.subspan(n, buf.size() - n);
+        }
+
+        return status;
+    }
+
+    int crc_check(uint32_t address, uint16_t size, uint16_t &crc)
+    {
+        std::array<uint8_t, 2> data{};
+
+        send(command(CMD_CRC_CHECK, address, size));
+        int status = recv(data);
+        if (status == 0) {
+            crc = (uint16_t)(data[0] | data[1] << 8);
+        }
+        return status;
+    }
+
+    int tx_version(uint32_t &version)
+    {
+        std::array<uint8_t, 4> data{};
+
+        send_frame(frames::tx_bsl_version);
+        int status = recv(data);
+        if (status == 0) {
+            version = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+                      (uint32_t)data[2] <<  8 | (uint32_t)data[3] <<  0;
+        }
+        return status;
+    }
+
+    int change_baudrate(uint32_t baudrate)
+    {
+        switch (baudrate) {
+        case 9600:   send_frame(frames::change_baudrate_9600);   break;
+        case 19200:  send_frame(frames::change_baudrate_19200);  break;
+        case 38400:  send_frame(frames::change_baudrate_38400);  break;
+        case 57600:  send_frame(frames::change_baudrate_57600);  break;
+        case 115200: send_frame(frames::change_baudrate_115200); break;
+        default:     return -1;
+        }
+
+        int status = recv_ack();
+        if (status == 0) {
+            status = t_.set_baudrate(baudrate);
+        }
+        return status;
+    }
+
+    int load_pc(uint32_t address)
+    {
+        send(std::array<uint8_t, 4>{{CMD_LOAD_PC, (uint8_t)(address >> 0), (uint8_t)(address >> 8),
+                                     (uint8_t)(address >> 16)}});
+        return recv_ack();
+    }
+
+private:
+    static std::array<uint8_t, 4> command(uint8_t cmd, uint32_t address) noexcept
+    {
+        return {{cmd, (uint8_t)(address >> 0), (uint8_t)(address >> 8), (uint8_t)(address >> 16)}};
+    }
+
+    static std::array<uint8_t, 6> command(uint8_t cmd, uint32_t address, uint16_t size) noexcept
+    {
+        return {{cmd, (uint8_t)(address >> 0), (uint8_t)(address >> 8), (uint8_t)(address >> 16),
+                 (uint8_t)(size >> 0), (uint8_t)(size >> 8)}};
+    }
+
+    static void turnaround()
+    {
+        struct timespec ts = { 0, SENDING_DELAY_US * 1000 };
+        while (nanosleep(&ts, &ts) == EINTR) ;
+    }
+
+    /* A precomputed frame. */
+    template <size_t N>
+    void send_frame(const std::array<uint8_t, N> &frame)
+    {
+        turnaround();
+        t_.write(frame.data(), N);
+    }
+
+    /* Command fields and the data, streamed without a frame buffer. */
+    template <size_t N>
+    void send(const std::array<uint8_t, N> &fields, span<const uint8_t> data = {})
+    {
+        uint16_t len = (uint16_t)(N + data.size());
+        uint16_t fcs = crc16(data.data(), data.size(), crc16(fields.data(), N));
+        uint8_t head[3] = { HEAD, (uint8_t)(len >> 0), (uint8_t)(len >> 8) };
+        uint8_t tail[2] = { (uint8_t)(fcs >> 0), (uint8_t)(fcs >> 8) };
+
+        turnaround();
+        t_.write(head, sizeof(head));
+        t_.write(fields.data(), N);
+        if (!data.empty()) {
+            t_.write(data.data(), data.size());
+        }
+        t_.write(tail, sizeof(tail));
+    }
+
+    int recv_ack()
+    {
+        int c = t_.readb(RESP_TIMEOUT);
+        if (c != ACK) {
+            resync();
+            return (c < 0)? -1: c;
+        }
+        return 0;
+    }
+
+    /* A message response, its MSG byte is the status. */
+    int recv_msg()
+    {
+        std::array<uint8_t, 1> msg{};
+        int status = recv_frame(RESP_MSG, msg);
+        return (status == 0)? msg[0]: status;
+    }
+
+    /* A data response into the buffer, or the MSG byte of an error. */
+    int recv(span<uint8_t> buf)
+    {
+        return recv_frame(RESP_DATA, buf);
+    }
+
+    int recv_frame(uint8_t type, span<uint8_t> buf)
+    {
+        int status = recv_ack();
+        if (status != 0) {
+            return status;
+        }
+
+        if (t_.readb(RESP_TIMEOUT) != HEAD) {
+            return resync();
+        }
+
+        int nl = t_.readb(CHAR_TIMEOUT);
+        int nh = t_.readb(CHAR_TIMEOUT);
+        if (nl < 0 || nh < 0) {
+            return resync();
+        }
+
+        size_t len = (size_t)(nl | nh << 8);
+        if (len < 1 || len > MAX_PAYLOADSIZE) {
+            return resync();
+        }
+
+        int c = t_.readb(CHAR_TIMEOUT);
+        if (c < 0) {
+            return resync();
+        }
+        uint8_t resp = (uint8_t)c;
+        uint16_t fcs = crc16_add(resp, INITFCS);
+        uint8_t msg = 0;
+
+        /* The response data goes straight into the caller's buffer. */
+        for (size_t i = 1; i < len; i++) {
+            c = t_.readb(CHAR_TIMEOUT);
+            if (c < 0) {
+                return resync();
+            }
+            fcs = crc16_add((uint8_t)c, fcs);
+            if (resp == type && i - 1 < buf.size()) {
+                buf[i - 1] = (uint8_t)c;
+            } else if (i == 1) {
+                msg = (uint8_t)c;
+            }
+        }
+
+        int ckl = t_.readb(CHAR_TIMEOUT);
+        int ckh = t_.readb(CHAR_TIMEOUT);
+        if (ckl < 0 || ckh < 0 || (uint16_t)(ckl | ckh << 8) != fcs) {
+            return resync();
+        }
+
+        if (resp != type) {
+            return (resp == RESP_MSG && msg != 0)? msg: -1;
+        }
+
+        return (len - 1 >= buf.size())? 0: -1;
+    }
+
+    /* Clear all subsequent characters for frame SYNC recovery. */
+    int resync()
+    {
+        struct timespec ts = { 0, (long)RESP_TIMEOUT * 1000000L };
+        while (nanosleep(&ts, &ts) == EINTR) ;
+        t_.clear();
+        return -1;
+    }
+
+    Transport &t_;
+    int status_ = 0;
+};
+
+}  /* namespace bsl430 */
+
+#endif  /* __BSL430_HPP__ */
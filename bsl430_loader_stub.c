@@ -0,0 +1,569 @@
+/*
+ * Copyright (C) 2016 Whaley Technology Co., Ltd.
+ * Min Chen <chen.min@whaley.cn>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "bsl430_loader_stub"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+
+#include "bsl430-platform.h"
+#include "bsl430.h"
+#include "bsl430-loader.h"
+
+#define PROGRAM_NAME "bsl430_loader_stub"
+#define VERSION "$Revision 1.00 $"
+
+/*
+ * Host-side stand-in of a device for bsl430-loader.c
+ *
+ * It serves a pty as the UART of a MSP430FR2xx would be: the ROM BSL
+ * commands the programming sends before LOAD_PC, then the secondary loader
+ * protocol of bsl430-loader.h, on 64KB of memory. Run the programming on
+ * the pty it prints:
+ *
+ *      bsl430_test -g modem -p /dev/pts/N -l loader.txt image.txt
+ *
+ * The modem lines of a pty can't be set, the GPIO failure is logged and the
+ * entry goes on. RST can't be seen either, so a BSL command received by the
+ * loader stands for a reset into the BSL. The baudrate switches are
+ * acknowledged, a pty has no line rate.
+ */
+
+#define HEAD    0x80
+#define ACK     0x00
+
+/* The BSL answers a broken frame by one of these in place of the ACK. */
+#define STUB_ACK_HEADER_ERROR   0x51
+#define STUB_ACK_CKS_ERROR      0x52
+#define STUB_ACK_SIZE_ERROR     0x54
+
+#define STUB_CHAR_TIMEOUT   100 /* ms */
+/* The host reopens the pty, a hang up in between is polled this often. */
+#define STUB_HUP_POLL       1   /* ms */
+
+#define STUB_CMD_RX_DATA_BLOCK      0x10
+#define STUB_CMD_RX_PASSWORD        0x11
+#define STUB_CMD_MASS_ERASE         0x15
+#define STUB_CMD_CRC_CHECK          0x16
+#define STUB_CMD_LOAD_PC            0x17
+#define STUB_CMD_TX_DATA_BLOCK      0x18
+#define STUB_CMD_TX_BSL_VERSION     0x19
+#define STUB_CMD_RX_DATA_BLOCK_F    0x1B
+#define STUB_CMD_CHANGE_BAUDRATE    0x52
+
+#define STUB_RESP_DATA  0x3A
+#define STUB_RESP_MSG   0x3B
+
+#define STUB_MEMORY_SIZE    0x10000
+#define STUB_VECTORS        0xFFE0
+#define STUB_TLV_DEVICE_ID  0x1A04
+
+/* The largest frame either side sends, a loader write. */
+#define STUB_MAX_PAYLOAD    BSL430_LOADER_MAX_PAYLOAD
+
+typedef struct stub_s {
+    int fd;
+    const char *memory_path;
+    int verbose;
+    int fail_write;     /* the loader write failed, counted from 1, or 0 */
+    int writes;
+    int locked;
+    int loader;
+    uint8_t memory[STUB_MEMORY_SIZE];
+    uint32_t written;
+    uint32_t wire;
+} stub_t;
+
+static stub_t stub;
+
+static const struct option long_options[] = {
+    {"memory",  required_argument, NULL, 'm'},
+    {"link",    required_argument, NULL, 'l'},
+    {"fail-write", required_argument, NULL, 'f'},
+    {"verbose", no_argument,       NULL, 'v'},
+    {"help",    no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+static void stub_help(void);
+static int stub_open(const char *link);
+static int stub_read(uint8_t *buf, int len, int timeout);
+static int stub_recv(uint8_t *payload, uint16_t *len);
+static void stub_send(uint8_t ack, const uint8_t *payload, uint16_t len);
+static void stub_message(uint8_t msg);
+static void stub_bsl(const uint8_t *payload, uint16_t len);
+static void stub_loader(const uint8_t *payload, uint16_t len);
+static uint32_t stub_address(const uint8_t *p);
+static void stub_erase(void);
+static void stub_save(void);
+
+int main(int argc, char *argv[])
+{
+    int c;
+    const char *link = NULL;
+    uint8_t payload[STUB_MAX_PAYLOAD];
+    uint16_t len = 0;
+    FILE *fp = NULL;
+    int status = 0;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    memset(&stub, 0, sizeof(stub));
+    memset(stub.memory, 0xFF, sizeof(stub.memory));
+    stub.locked = 1;
+
+    while ((c = getopt_long(argc, argv, "m:l:f:vh", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'm':
+            stub.memory_path = optarg;
+            break;
+        case 'l':
+            link = optarg;
+            break;
+        case 'f':
+            stub.fail_write = atoi(optarg);
+            break;
+        case 'v':
+            stub.verbose = 1;
+            break;
+        case 'h':
+        default:
+            stub_help();
+            return (c == 'h')? 0: 1;
+        }
+    }
+
+    /* A device ID in the TLV, for the journal and the cache. */
+    for (c = 0; c < BSL430_DEVICE_ID_SIZE; c++) {
+        stub.memory[STUB_TLV_DEVICE_ID + c] = (uint8_t)(0x30 + c);
+    }
+
+    if (stub.memory_path) {
+        fp = fopen(stub.memory_path, "rb");
+        if (fp != NULL) {
+            if (fread(stub.memory, 1, sizeof(stub.memory), fp) != sizeof(stub.memory)) {
+                log("** %s is not of %u Bytes!\n", stub.memory_path, STUB_MEMORY_SIZE);
+                status = -1;
+            }
+            fclose(fp);
+            if (status != 0) {
+                return 1;
+            }
+        }
+    }
+
+    if (stub_open(link) != 0) {
+        return 1;
+    }
+
+    for (;;) {
+        status = stub_recv(payload, &len);
+        if (status < 0) {
+            continue;
+        }
+
+        if (stub.verbose) {
+            log("%s 0x%02X, %u Bytes\n", (stub.loader)? "LDR": "BSL", payload[0], len);
+        }
+
+        if (stub.loader && payload[0] >= BSL430_LOADER_CMD_SYNC &&
+            payload[0] <= BSL430_LOADER_CMD_EXIT) {
+            stub_loader(payload, len);
+            continue;
+        }
+
+        if (stub.loader) {
+            log("Reset into the BSL.\n");
+            stub.loader = 0;
+            stub.locked = 1;
+        }
+        stub_bsl(payload, len);
+    }
+
+    return 0;
+}
+
+static void stub_help(void)
+{
+    printf(
+"| " VERSION PROGRAM_NAME " (" __DATE__ " " __TIME__ ")\n"
+"Usage: " PROGRAM_NAME " [OPTION]...\n"
+"\n"
+"Stand in for a device running the BSL and the secondary loader on a pty.\n"
+"  -m, --memory=FILE          64KB memory image, loaded if it exists and saved\n"
+"                             as it is written.\n"
+"  -l, --link=PATH            symlink PATH to the pty, e.g. /dev/ttyAMA2.\n"
+"  -f, --fail-write=N         fail the Nth write to the loader, once.\n"
+"  -v, --verbose              print each frame.\n"
+"  -h, --help                 print this help.\n");
+}
+
+static int stub_open(const char *link)
+{
+    struct termios option;
+    const char *name = NULL;
+
+    stub.fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (stub.fd < 0 || grantpt(stub.fd) != 0 || unlockpt(stub.fd) != 0) {
+        log("** Open pty failed! %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (tcgetattr(stub.fd, &option) == 0) {
+        cfmakeraw(&option);
+        tcsetattr(stub.fd, TCSANOW, &option);
+    }
+
+    name = ptsname(stub.fd);
+    if (link) {
+        unlink(link);
+        if (symlink(name, link) != 0) {
+            log("** Link %s failed! %s\n", link, strerror(errno));
+            return -1;
+        }
+    }
+
+    log("Serving %s%s%s.\n", name, (link)? " as ": "", (link)? link: "");
+    return 0;
+}
+
+/*
+ * Read <len> bytes, each within <timeout> ms, or -1. A pty with no slave
+ * open reads EIO, it is polled until the host opens it again.
+ */
+static int stub_read(uint8_t *buf, int len, int timeout)
+{
+    struct pollfd pfd;
+    int n = 0;
+    int ret;
+
+    while (n < len) {
+        pfd.fd = stub.fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        ret = poll(&pfd, 1, timeout);
+        if (ret == 0) {
+            return -1;
+        }
+        if (ret < 0 || (pfd.revents & POLLHUP)) {
+            usleep(STUB_HUP_POLL * 1000);
+            if (timeout >= 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        ret = read(stub.fd, buf + n, len - n);
+        if (ret <= 0) {
+            if (timeout >= 0) {
+                return -1;
+            }
+            usleep(STUB_HUP_POLL * 1000);
+            continue;
+        }
+        n += ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Receive a frame as the BSL does: HEAD NL NH payload CKL CKH. A broken one
+ * is answered by the error in place of the ACK, and -1.
+ */
+static int stub_recv(uint8_t *payload, uint16_t *len)
+{
+    uint8_t head[3];
+    uint8_t cks[2];
+
+    if (stub_read(head, 1, -1) != 0) {
+        return -1;
+    }
+
+    if (head[0] != HEAD) {
+        /* The host recovers the UART after the entry by a byte or two. */
+        if (stub.verbose) {
+            log("Junk 0x%02X.\n", head[0]);
+        }
+        return -1;
+    }
+
+    if (stub_read(&head[1], 2, STUB_CHAR_TIMEOUT) != 0) {
+        stub_send(STUB_ACK_HEADER_ERROR, NULL, 0);
+        return -1;
+    }
+
+    *len = (uint16_t)head[1] | (uint16_t)head[2] << 8;
+    if (*len == 0 || *len > STUB_MAX_PAYLOAD) {
+        stub_send(STUB_ACK_SIZE_ERROR, NULL, 0);
+        return -1;
+    }
+
+    if (stub_read(payload, *len, STUB_CHAR_TIMEOUT) != 0 ||
+        stub_read(cks, 2, STUB_CHAR_TIMEOUT) != 0) {
+        stub_send(STUB_ACK_CKS_ERROR, NULL, 0);
+        return -1;
+    }
+
+    if (bsl430_crc16(payload, *len, 0xFFFF) != ((uint16_t)cks[0] | (uint16_t)cks[1] << 8)) {
+        stub_send(STUB_ACK_CKS_ERROR, NULL, 0);
+        return -1;
+    }
+
+    stub.wire += 3 + *len + 2;
+    return 0;
+}
+
+/*
+ * Send the ACK, then a response frame if <payload>.
+ */
+static void stub_send(uint8_t ack, const uint8_t *payload, uint16_t len)
+{
+    uint8_t buf[1 + 3 + STUB_MAX_PAYLOAD + 2];
+    uint16_t fcs;
+    int n = 0;
+
+    buf[n++] = ack;
+
+    if (payload) {
+        fcs = bsl430_crc16(payload, len, 0xFFFF);
+
+        buf[n++] = HEAD;
+        buf[n++] = (uint8_t)(len >> 0 & 0xFF);
+        buf[n++] = (uint8_t)(len >> 8 & 0xFF);
+        memcpy(&buf[n], payload, len);
+        n += len;
+        buf[n++] = (uint8_t)(fcs >> 0 & 0xFF);
+        buf[n++] = (uint8_t)(fcs >> 8 & 0xFF);
+    }
+
+    if (write(stub.fd, buf, n) != n) {
+        log("** Write pty failed! %s\n", strerror(errno));
+    }
+}
+
+static void stub_message(uint8_t msg)
+{
+    uint8_t payload[2];
+
+    payload[0] = STUB_RESP_MSG;
+    payload[1] = msg;
+    stub_send(ACK, payload, sizeof(payload));
+}
+
+static void stub_bsl(const uint8_t *payload, uint16_t len)
+{
+    uint8_t resp[1 + BSL430_MAX_DATA_SIZE];
+    uint32_t address = (len >= 4)? stub_address(&payload[1]): 0;
+    uint32_t size = (len >= 6)? ((uint32_t)payload[4] | (uint32_t)payload[5] << 8): 0;
+    uint16_t crc;
+
+    switch (payload[0]) {
+    case STUB_CMD_CHANGE_BAUDRATE:
+        stub_send(ACK, NULL, 0);
+        return;
+    case STUB_CMD_RX_PASSWORD:
+        if (len == 33 && memcmp(&payload[1], &stub.memory[STUB_VECTORS], 32) == 0) {
+            stub.locked = 0;
+            stub_message(BSL430_MSG_SUCC);
+        } else {
+            /* A wrong password erases the device, as the ROM BSL does. */
+            stub_erase();
+            stub_message(BSL430_MSG_PASSWD_ERROR);
+        }
+        return;
+    default:
+        break;
+    }
+
+    if (stub.locked) {
+        stub_message(BSL430_MSG_BSL_LOCKED);
+        return;
+    }
+
+    switch (payload[0]) {
+    case STUB_CMD_TX_BSL_VERSION:
+        resp[0] = STUB_RESP_DATA;
+        resp[1] = 0x00;
+        resp[2] = 0x08;
+        resp[3] = 0x35;
+        resp[4] = 0xB3;
+        stub_send(ACK, resp, 5);
+        break;
+    case STUB_CMD_RX_DATA_BLOCK:
+    case STUB_CMD_RX_DATA_BLOCK_F:
+        if (len < 4 || address + (len - 4) > STUB_MEMORY_SIZE) {
+            stub_message(BSL430_MSG_FLASH_FAIL);
+            break;
+        }
+        memcpy(&stub.memory[address], &payload[4], len - 4);
+        stub.written += len - 4;
+        stub_save();
+        if (payload[0] == STUB_CMD_RX_DATA_BLOCK) {
+            stub_message(BSL430_MSG_SUCC);
+        }
+        break;
+    case STUB_CMD_MASS_ERASE:
+        stub_erase();
+        stub_message(BSL430_MSG_SUCC);
+        break;
+    case STUB_CMD_CRC_CHECK:
+        if (address + size > STUB_MEMORY_SIZE) {
+            stub_message(BSL430_MSG_UNKNOWN_CMD);
+            break;
+        }
+        crc = bsl430_crc16(&stub.memory[address], (int)size, 0xFFFF);
+        resp[0] = STUB_RESP_DATA;
+        resp[1] = (uint8_t)(crc >> 0 & 0xFF);
+        resp[2] = (uint8_t)(crc >> 8 & 0xFF);
+        stub_send(ACK, resp, 3);
+        break;
+    case STUB_CMD_TX_DATA_BLOCK:
+        if (size > BSL430_MAX_DATA_SIZE || address + size > STUB_MEMORY_SIZE) {
+            stub_message(BSL430_MSG_UNKNOWN_CMD);
+            break;
+        }
+        resp[0] = STUB_RESP_DATA;
+        memcpy(&resp[1], &stub.memory[address], size);
+        stub_send(ACK, resp, (uint16_t)(1 + size));
+        break;
+    case STUB_CMD_LOAD_PC:
+        stub_send(ACK, NULL, 0);
+        log("LOAD_PC: @%04X, the loader runs.\n", address);
+        stub.loader = 1;
+        stub.wire = 0;
+        stub.written = 0;
+        break;
+    default:
+        stub_message(BSL430_MSG_UNKNOWN_CMD);
+        break;
+    }
+}
+
+static void stub_loader(const uint8_t *payload, uint16_t len)
+{
+    uint8_t resp[4];
+    uint8_t data[BSL430_LOADER_BLOCK];
+    uint32_t address = 0;
+    uint32_t size = 0;
+    uint16_t crc;
+    int n = 0;
+
+    switch (payload[0]) {
+    case BSL430_LOADER_CMD_SYNC:
+        resp[0] = BSL430_LOADER_RESP_DATA;
+        resp[1] = 0x01;
+        resp[2] = (uint8_t)(BSL430_LOADER_BLOCK >> 0 & 0xFF);
+        resp[3] = (uint8_t)(BSL430_LOADER_BLOCK >> 8 & 0xFF);
+        stub_send(ACK, resp, 4);
+        break;
+    case BSL430_LOADER_CMD_BAUDRATE:
+        stub_send(ACK, NULL, 0);
+        break;
+    case BSL430_LOADER_CMD_WRITE:
+        resp[0] = BSL430_LOADER_RESP_MSG;
+        resp[1] = BSL430_MSG_SUCC;
+        resp[2] = (len >= 2)? payload[1]: 0;
+
+        if (len < 6) {
+            n = -1;
+        } else if (payload[5] == BSL430_LOADER_RLE) {
+            n = bsl430_loader_unrle(&payload[6], len - 6, data, sizeof(data));
+        } else {
+            n = len - 6;
+            if (n > (int)sizeof(data)) {
+                n = -1;
+            } else {
+                memcpy(data, &payload[6], n);
+            }
+        }
+
+        address = (len >= 6)? stub_address(&payload[2]): 0;
+        if (n < 0 || address + (uint32_t)n > STUB_MEMORY_SIZE ||
+            ++stub.writes == stub.fail_write) {
+            resp[1] = BSL430_MSG_FLASH_FAIL;
+        } else {
+            memcpy(&stub.memory[address], data, n);
+            stub.written += n;
+            stub_save();
+        }
+        stub_send(ACK, resp, 3);
+        break;
+    case BSL430_LOADER_CMD_CRC:
+        address = (len >= 7)? stub_address(&payload[1]): STUB_MEMORY_SIZE;
+        size = (len >= 7)? stub_address(&payload[4]): 0;
+        if (address + size > STUB_MEMORY_SIZE) {
+            size = 0;
+        }
+        crc = bsl430_crc16(&stub.memory[address % STUB_MEMORY_SIZE], (int)size, 0xFFFF);
+        resp[0] = BSL430_LOADER_RESP_DATA;
+        resp[1] = (uint8_t)(crc >> 0 & 0xFF);
+        resp[2] = (uint8_t)(crc >> 8 & 0xFF);
+        stub_send(ACK, resp, 3);
+        break;
+    case BSL430_LOADER_CMD_EXIT:
+        stub_send(ACK, NULL, 0);
+        log("Loader done: %u Bytes written from %u on the wire.\n", stub.written, stub.wire);
+        stub.loader = 0;
+        stub.locked = 1;
+        break;
+    default:
+        break;
+    }
+}
+
+static uint32_t stub_address(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+}
+
+/* A mass erase clears the code FRAM, the information memory stays. */
+static void stub_erase(void)
+{
+    memset(&stub.memory[BSL430_FRAM_LOW], 0xFF, STUB_MEMORY_SIZE - BSL430_FRAM_LOW);
+    stub_save();
+}
+
+static void stub_save(void)
+{
+    FILE *fp = NULL;
+
+    if (!stub.memory_path) {
+        return;
+    }
+
+    fp = fopen(stub.memory_path, "wb");
+    if (fp == NULL) {
+        log("** Save %s failed! %s\n", stub.memory_path, strerror(errno));
+        return;
+    }
+    fwrite(stub.memory, 1, sizeof(stub.memory), fp);
+    fclose(fp);
+}
@@ -22,36 +22,350 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
+#include <time.h>
 
+#include <sys/ioctl.h>
+
+#include "bsl430-platform.h"
+#include "bsl430.h"
 #include "bsl430-program.h"
+#include "bsl430-trace.h"
+#include "bsl430-stream.h"
+#include "bsl430-uring.h"
+#include "bsl430-session.h"
+#include "bsl430-daemon.h"
+#include "bsl430-plan.h"
+#include "bsl430-strategy.h"
+#include "bsl430-audit.h"
+#include "bsl430-merge.h"
+#include "bsl430-patch.h"
+#include "bsl430-rt.h"
 
 #define PROGRAM_NAME "bsl430_test"
 #define VERSION "$Revision 1.00 $"
 
-#define log(...)    printf(LOG_TAG ": " __VA_ARGS__)
+/* The secondary loader runs in RAM, 4KB on MSP430FR2633. */
+#define BSL430_MAX_LOADER_SIZE  (4 * 1024)
 
-#define BSL430_MAX_FW_SIZE  (64 * 1024)
-/* 16KB is enough for MSP430FR2633. */
-#define BSL430_MAX_CODE_SIZE    (32 * 1024)
+/* The programming run on the real-time I/O thread of -X. */
+typedef struct bsl430_test_job_s {
+    char *const *files;
+    int count;
+    bsl430_program_config_t *config;
+    int repeat;
+    int streaming;
+} bsl430_test_job_t;
 
-static uint8_t txt_buf[BSL430_MAX_FW_SIZE];
-static uint8_t segments_buf[BSL430_MAX_CODE_SIZE];
+/* The edits of -x, patched over the image for each device. */
+static bsl430_patch_edit_t test_edit[BSL430_PATCH_MAX_EDITS];
+static uint8_t test_edit_data[BSL430_PATCH_MAX_EDITS][BSL430_PATCH_MAX_SIZE];
+static uint32_t test_edits = 0;
 
 static void bsl430_test_version(void);
 static void bsl430_test_help(void);
 
-static int bsl430_test_program(const char *filename);
+static int bsl430_test_gpio_line(const char *arg, int modem, uint32_t *line, int *invert, int flag);
+static int bsl430_test_gpio(char *spec, bsl430_gpio_config_t *gpio);
+static titxt_header_t *bsl430_test_load(char *const *files, int count);
+static int bsl430_test_program(char *const *files, int count, bsl430_program_config_t *config,
+                               int repeat, int streaming);
+static int bsl430_test_uring(char *const *files, int count, char *ttys,
+                             bsl430_program_config_t *config);
+static int bsl430_test_read(const char *spec);
+static int bsl430_test_plan(char *const *files, int count, bsl430_program_config_t *config);
+static int bsl430_test_audit(char *const *files, int count, char *ttys, int flags);
+static int bsl430_test_crc(char *const *files, int count, const char *spec);
+static int bsl430_test_patch(char *spec);
+static int bsl430_test_realtime(char *spec, bsl430_rt_config_t *rt);
+static int bsl430_test_job(void *arg);
+static uint32_t bsl430_test_us(void);
+
+static const struct option long_options[] = {
+    {"journal", required_argument, NULL, 'j'},
+    {"cache",   required_argument, NULL, 'c'},
+    {"loader",  required_argument, NULL, 'l'},
+    {"loader-baudrate", required_argument, NULL, 'b'},
+    {"port",    required_argument, NULL, 'p'},
+    {"gpio",    required_argument, NULL, 'g'},
+    {"entry-interval", required_argument, NULL, 'i'},
+    {"low-latency", no_argument,     NULL, 'L'},
+    {"trace",   required_argument, NULL, 't'},
+    {"replay",  required_argument, NULL, 'r'},
+    {"decode",  required_argument, NULL, 'd'},
+    {"repeat",  required_argument, NULL, 'n'},
+    {"previous", required_argument, NULL, 'P'},
+    {"streaming", no_argument,     NULL, 's'},
+    {"uring",   required_argument, NULL, 'U'},
+    {"timeouts", required_argument, NULL, 'T'},
+    {"read",    required_argument, NULL, 'R'},
+    {"daemon",  required_argument, NULL, 'D'},
+    {"workers", required_argument, NULL, 'w'},
+    {"submit",  required_argument, NULL, 'J'},
+    {"plan",    no_argument,       NULL, 'E'},
+    {"audit",   required_argument, NULL, 'A'},
+    {"unlock",  no_argument,       NULL, 'u'},
+    {"optimize", no_argument,      NULL, 'O'},
+    {"crc",     required_argument, NULL, 'C'},
+    {"patch",   required_argument, NULL, 'x'},
+    {"realtime", required_argument, NULL, 'X'},
+    {"help",    no_argument,       NULL, 'h'},
+    {NULL,      0,                 NULL,  0 }
+};
 
 int main(int argc, char** argv)
 {
-    if (argc != 2 || strcmp(argv[1], "--help") == 0) {
+    int c;
+    bsl430_program_config_t config;
+    const char *loader = NULL;
+    const char *previous = NULL;
+    bsl430_gpio_config_t gpio;
+    int gpio_set = 0;
+    const char *trace = NULL;
+    const char *replay = NULL;
+    int status = 0;
+    int repeat = 1;
+    int streaming = 0;
+    int plan = 0;
+    char *uring = NULL;
+    char *audit = NULL;
+    int audit_flags = 0;
+    const char *read = NULL;
+    const char *crc = NULL;
+    const char *submit = NULL;
+    char *const *files = NULL;
+    int count = 0;
+    int realtime = 0;
+    bsl430_rt_config_t rt;
+    bsl430_test_job_t test_job;
+    char job[1024];
+    bsl430_timeout_config_t timeouts;
+    bsl430_daemon_config_t daemon;
+
+    memset(&config, 0, sizeof(config));
+    /* -i alone keeps the built-in lines. */
+    bsl430_gpio_get_config(&gpio);
+    memset(&timeouts, 0, sizeof(timeouts));
+    memset(&daemon, 0, sizeof(daemon));
+    memset(&rt, 0, sizeof(rt));
+
+    while ((c = getopt_long(argc, argv, "j:c:l:b:p:g:i:Lt:r:d:n:P:sU:T:R:D:w:J:EA:uOC:x:X:h", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'j':
+            config.journal = optarg;
+            break;
+        case 'c':
+            config.cache = optarg;
+            break;
+        case 'l':
+            loader = optarg;
+            break;
+        case 'b':
+            config.loader_baudrate = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            bsl430_uart_port(optarg);
+            break;
+        case 'g':
+            if (bsl430_test_gpio(optarg, &gpio) != 0) {
+                bsl430_test_help();
+            }
+            gpio_set = 1;
+            break;
+        case 'i':
+            gpio.interval = atoi(optarg);
+            gpio_set = 1;
+            break;
+        case 'L':
+            bsl430_uart_set_low_latency(1);
+            break;
+        case 't':
+            trace = optarg;
+            break;
+        case 'r':
+            replay = optarg;
+            break;
+        case 'd':
+            return bsl430_trace_decode(optarg, stdout);
+        case 'n':
+            repeat = atoi(optarg);
+            break;
+        case 'P':
+            previous = optarg;
+            break;
+        case 's':
+            streaming = 1;
+            break;
+        case 'U':
+            uring = optarg;
+            break;
+        case 'T':
+            /* MIN[:MAX[:CHAR]] in ms, an empty field keeps the default. */
+            timeouts.min_ms = (uint16_t)strtoul(optarg, &optarg, 0);
+            if (*optarg == ':') {
+                timeouts.max_ms = (uint16_t)strtoul(optarg + 1, &optarg, 0);
+            }
+            if (*optarg == ':') {
+                timeouts.char_ms = (uint16_t)strtoul(optarg + 1, &optarg, 0);
+            }
+            bsl430_set_timeouts(&timeouts);
+            break;
+        case 'R':
+            read = optarg;
+            break;
+        case 'D':
+            daemon.socket = optarg;
+            break;
+        case 'w':
+            daemon.workers = atoi(optarg);
+            break;
+        case 'J':
+            submit = optarg;
+            break;
+        case 'E':
+            plan = 1;
+            break;
+        case 'A':
+            audit = optarg;
+            break;
+        case 'u':
+            audit_flags |= BSL430_AUDIT_UNLOCK;
+            break;
+        case 'O':
+            config.optimize = 1;
+            break;
+        case 'C':
+            crc = optarg;
+            break;
+        case 'x':
+            if (bsl430_test_patch(optarg) != 0) {
+                bsl430_test_help();
+            }
+            break;
+        case 'X':
+            if (bsl430_test_realtime(optarg, &rt) != 0) {
+                bsl430_test_help();
+            }
+            realtime = 1;
+            break;
+        case 'h':
+        default:
+            bsl430_test_help();
+            break;
+        }
+    }
+
+    /* The words left are the job. */
+    if (submit) {
+        job[0] = '\0';
+        for (; optind < argc; optind++) {
+            if (strlen(job) + strlen(argv[optind]) + 2 > sizeof(job)) {
+                bsl430_test_help();
+            }
+            strcat(job, argv[optind]);
+            strcat(job, (optind < argc - 1)? " ": "");
+        }
+        return bsl430_daemon_submit(submit, job);
+    }
+
+    if (gpio_set) {
+        bsl430_gpio_config(&gpio);
+    }
+
+    /* The GPIO of the workers is set up by the options above. */
+    if (daemon.socket) {
+        return bsl430_daemon_run(&daemon);
+    }
+
+    /* The files left are programmed together, merged into one image. */
+    files = &argv[optind];
+    count = argc - optind;
+    if (count < 1 || count > BSL430_MERGE_MAX_IMAGES) {
         bsl430_test_help();
     }
 
-    return bsl430_test_program(argv[1]);
+    if (crc) {
+        return bsl430_test_crc(files, count, crc);
+    }
+
+    if (test_edits > 0 && (plan || uring || audit || streaming)) {
+        log("** Patches are applied by programming and -C only.\n");
+        return -1;
+    }
+
+    if (loader) {
+        config.loader = bsl430_ti_txt_load(loader, BSL430_MAX_LOADER_SIZE + 256);
+        if (config.loader == NULL) {
+            return -1;
+        }
+    }
+
+    if (previous) {
+        config.previous = bsl430_ti_txt_load(previous, BSL430_MAX_CODE_SIZE);
+        if (config.previous == NULL) {
+            return -1;
+        }
+    }
+
+    if (plan) {
+        status = bsl430_test_plan(files, count, &config);
+        free(config.loader);
+        free(config.previous);
+        return status;
+    }
+
+    if (replay && bsl430_uart_replay(replay) != 0) {
+        return -1;
+    }
+
+    if (trace && bsl430_trace_open(trace) != 0) {
+        return -1;
+    }
+
+    if (read && (uring || audit || repeat > 1)) {
+        log("** Reading back is for one device, ignored.\n");
+        read = NULL;
+    }
+
+    /* Programming runs in the session, the read back follows without re-entry. */
+    if (read && bsl430_session_open(115200) != 0) {
+        return -1;
+    }
+
+    if (audit) {
+        status = bsl430_test_audit(files, count, audit, audit_flags);
+    } else if (uring) {
+        status = bsl430_test_uring(files, count, uring, &config);
+    } else if (realtime) {
+        test_job.files = files;
+        test_job.count = count;
+        test_job.config = &config;
+        test_job.repeat = repeat;
+        test_job.streaming = streaming;
+        status = bsl430_rt_run(&rt, bsl430_test_job, &test_job);
+    } else {
+        status = bsl430_test_program(files, count, &config, repeat, streaming);
+    }
+
+    if (read) {
+        if (status == 0) {
+            status = bsl430_test_read(read);
+        }
+        bsl430_session_close();
+    }
+
+    bsl430_trace_close();
+    bsl430_uart_replay(NULL);
+
+    free(config.loader);
+    free(config.previous);
+
+    return status;
 }
 
 static void bsl430_test_version(void)
@@ -69,62 +383,489 @@ static void bsl430_test_help(void)
     bsl430_test_version();
 
     printf(
-"Usage: " PROGRAM_NAME " <TI-TXT File>\n"
+"Usage: " PROGRAM_NAME " [OPTION]... <TI-TXT File>...\n"
 "\n"
-"libbsl430 test code.\n"
+"libbsl430 test code. Several TI-TXT files are merged and programmed together.\n"
+"  -j, --journal=FILE         resume an interrupted programming from FILE.\n"
+"  -c, --cache=FILE           skip devices FILE records up to date.\n"
+"  -l, --loader=FILE          write by the secondary loader FILE in RAM.\n"
+"  -b, --loader-baudrate=RATE switch the secondary loader to RATE.\n"
+"  -p, --port=TTY             UART of the BSL, /dev/ttyAMA2 by default.\n"
+"  -g, --gpio=SPEC            RST/TST by SPEC, one of\n"
+"                               hisi\n"
+"                               chip:<gpiochip>:<rst line>:<tst line>\n"
+"                               modem[:<rst dtr|rts>:<tst dtr|rts>]\n"
+"                             prefix a line with '~' to invert it.\n"
+"  -i, --entry-interval=MS    time between entry sequence states.\n"
+"  -L, --low-latency          poll-driven reads, low latency USB-serial.\n"
+"  -t, --trace=FILE           record the UART bytes into FILE.\n"
+"  -r, --replay=FILE          replay the trace FILE in place of the UART.\n"
+"  -d, --decode=FILE          print the trace FILE and exit.\n"
+"  -n, --repeat=N             program N devices in turn, by one encoded stream.\n"
+"  -P, --previous=FILE        unlock by the password of the deployed image FILE.\n"
+"  -s, --streaming            program the file as it is read, in constant memory.\n"
+"  -U, --uring=TTY,TTY...     program the devices on all TTYs at once by io_uring.\n"
+"  -T, --timeouts=MIN:MAX:CHR floor and ceiling of the response timeouts, and\n"
+"                             the timeout between characters, in ms.\n"
+"  -R, --read=ADDR:SIZE       read SIZE bytes at ADDR back after programming,\n"
+"                             in the same BSL session.\n"
+"  -D, --daemon=SOCKET        serve jobs on the Unix SOCKET, see bsl430-daemon.h.\n"
+"  -w, --workers=N            ttys the daemon serves at once.\n"
+"  -J, --submit=SOCKET        send the job of the words left to the daemon.\n"
+"  -E, --plan                 print the writes of the update from -P and exit.\n"
+"  -A, --audit=TTY,TTY...     check the devices on all TTYs at once hold the\n"
+"                             image by CRC only, a JSON line each. Several TTYs\n"
+"                             need RST/TST lines of their own, -g modem.\n"
+"  -u, --unlock               with -A, unlock a locked BSL by the password of\n"
+"                             the image, a device with other vectors is erased.\n"
+"  -O, --optimize             program by the strategy predicted fastest, see\n"
+"                             bsl430-strategy.h. With -E, print the predictions.\n"
+"  -C, --crc=ADDR:SIZE        print the CRC_CHECK of the range on a device holding\n"
+"                             the image, 0xFF around it, and exit.\n"
+"  -x, --patch=ADDR:HEX,...   write the bytes HEX at ADDR over the image, see\n"
+"                             bsl430-patch.h. Only the frames edited are encoded\n"
+"                             again for each device.\n"
+"  -X, --realtime=PRIO[:CPU]  program on a SCHED_FIFO thread of PRIO on CPU with\n"
+"                             the memory locked, see bsl430-rt.h.\n"
 "      --help                 show help.\n");
 
     exit(EXIT_SUCCESS);
 }
 
-static int bsl430_test_program(const char *filename)
+static int bsl430_test_program(char *const *files, int count, bsl430_program_config_t *config,
+                               int repeat, int streaming)
 {
     int status = 0;
-    int fd = -1;
-    uint8_t *buf = NULL;
-    off_t size = 0;
+    int i;
+    uint32_t start;
+    titxt_header_t *header = NULL;
+    bsl430_stream_t stream;
+    bsl430_patch_t patch;
 
-    fd = open(filename, O_RDONLY);
-    if (fd < 0) {
-        log("Openning file error (%s). %s\n", filename, strerror(errno));
+    /* The file is read as it is programmed, nothing is held in memory. */
+    if (streaming) {
+        if (count > 1) {
+            log("** Streaming takes one file, merging needs the images in memory.\n");
+            return -1;
+        }
+        if (repeat <= 1) {
+            return bsl430_program_file(files[0], config);
+        }
+        for (i = 0; i < repeat; i++) {
+            log("Device %d/%d\n", i + 1, repeat);
+            status |= bsl430_program_file(files[0], config);
+        }
+        return status;
+    }
+
+    /* Parse the TI-TXT image while the device enters the BSL, and program. */
+    if (repeat <= 1 && test_edits == 0) {
+        return bsl430_program_load((const char *const *)files, (uint32_t)count, config);
+    }
+
+    header = bsl430_test_load(files, count);
+    if (header == NULL) {
         return -1;
     }
 
-    size = lseek(fd, 0, SEEK_END);
-    if (size < 0) {
-        log("Getting file size error. %s\n", strerror(errno));
-        goto error0;
+    /* The frames are encoded once for all devices, the edits over them for each. */
+    status = bsl430_stream_encode(header, &stream);
+    if (status != 0) {
+        free(header);
+        return status;
     }
+    config->stream = &stream;
+
+    for (i = 0; i < repeat; i++) {
+        if (repeat > 1) {
+            log("Device %d/%d\n", i + 1, repeat);
+        }
+        if (test_edits == 0) {
+            status |= bsl430_program_ex(header, config);
+            continue;
+        }
+
+        start = bsl430_test_us();
+        if (bsl430_patch_apply(header, &stream, test_edit, test_edits, &patch) != 0) {
+            status = -1;
+            break;
+        }
+        log("Patch: %u frames encoded again in %u us.\n", patch.frames, bsl430_test_us() - start);
 
-    log("File size: %u Byte.\n", (uint32_t)size);
-    if (size > BSL430_MAX_FW_SIZE) {
-        log("FW size error.\n");
-        goto error0;
+        config->stream = &patch.stream;
+        status |= bsl430_program_ex(patch.header, config);
+        config->stream = &stream;
+        bsl430_patch_free(&patch);
     }
 
-    lseek(fd, 0, SEEK_SET);
+    config->stream = NULL;
+    bsl430_stream_free(&stream);
+    free(header);
 
-    memset(txt_buf, 0, sizeof(txt_buf));
-    memset(segments_buf, 0, sizeof(segments_buf));
+    return status;
+}
+
+/*
+ * The devices on the ttys share RST/TST, they enter the BSL together and
+ * are programmed in lockstep.
+ */
+static int bsl430_test_uring(char *const *files, int count, char *ttys,
+                             bsl430_program_config_t *config)
+{
+    int status = 0;
+    int i;
+    int ports = 0;
+    const char *tty[BSL430_URING_MAX_PORTS];
+    char *name = NULL;
+    uint8_t password[32];
+    titxt_header_t *header = NULL;
+    bsl430_uring_t *ring = NULL;
+    bsl430_stream_t stream;
 
-    if (read(fd, txt_buf, (size_t)size) != (ssize_t)size) {
-        log("Reading file error. %s\n", strerror(errno));
-        goto error0;
+    for (name = strtok(ttys, ","); name && ports < BSL430_URING_MAX_PORTS; name = strtok(NULL, ",")) {
+        tty[ports++] = name;
     }
 
-    /* Parse the TI-TXT image and program. */
-    status = bsl430_parse_ti_txt(txt_buf, (uint32_t)size, segments_buf, sizeof(segments_buf));
-    if (status == 0) {
-        status = bsl430_program((titxt_header_t *)segments_buf);
+    header = bsl430_test_load(files, count);
+    if (header == NULL) {
+        return -1;
+    }
+
+    status = bsl430_stream_encode(header, &stream);
+    if (status != 0) {
+        free(header);
+        return status;
+    }
+
+    memset(password, 0xFF, sizeof(password));
+    if (config->previous) {
+        bsl430_ti_txt_password(config->previous, password);
+    }
+
+    ring = bsl430_uring_open(tty, ports);
+    if (ring == NULL) {
+        status = -1;
+        goto done;
+    }
+
+    bsl430_gpio_init();
+    bsl430_entry_sequence();
+
+    status = bsl430_uring_program(ring, &stream, password);
+    for (i = 0; i < ports; i++) {
+        log("%s: %s\n", tty[i], (bsl430_uring_status(ring, i) == 0)? "SUCC": "FAIL");
+    }
+
+    bsl430_uring_close(ring);
+    bsl430_exit();
+
+done:
+    bsl430_stream_free(&stream);
+    free(header);
+
+    return status;
+}
+
+static int bsl430_test_gpio_line(const char *arg, int modem, uint32_t *line, int *invert, int flag)
+{
+    if (arg == NULL) {
+        return -1;
+    }
+
+    if (*arg == '~') {
+        *invert |= flag;
+        arg++;
+    }
+
+    if (!modem) {
+        *line = strtoul(arg, NULL, 0);
+    } else if (strcmp(arg, "dtr") == 0) {
+        *line = TIOCM_DTR;
+    } else if (strcmp(arg, "rts") == 0) {
+        *line = TIOCM_RTS;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int bsl430_test_gpio(char *spec, bsl430_gpio_config_t *gpio)
+{
+    char *backend = strtok(spec, ":");
+    int status = 0;
+
+    if (backend == NULL) {
+        return -1;
+    }
+
+    /* Over the built-in lines, only the interval of -i is kept. */
+    gpio->device = NULL;
+    gpio->invert = 0;
+
+    if (strcmp(backend, "hisi") == 0) {
+        gpio->backend = BSL430_GPIO_HISI;
+    } else if (strcmp(backend, "chip") == 0) {
+        gpio->backend = BSL430_GPIO_CHIP;
+        gpio->device  = strtok(NULL, ":");
+        status |= (gpio->device == NULL)? -1: 0;
+        status |= bsl430_test_gpio_line(strtok(NULL, ":"), 0, &gpio->rst, &gpio->invert,
+                                        BSL430_GPIO_RST_INVERT);
+        status |= bsl430_test_gpio_line(strtok(NULL, ":"), 0, &gpio->tst, &gpio->invert,
+                                        BSL430_GPIO_TST_INVERT);
+    } else if (strcmp(backend, "modem") == 0) {
+        /* DTR drives RST and RTS drives TST by default. */
+        gpio->backend = BSL430_GPIO_MODEM;
+        gpio->rst = TIOCM_DTR;
+        gpio->tst = TIOCM_RTS;
+        if ((spec = strtok(NULL, ":")) != NULL) {
+            status |= bsl430_test_gpio_line(spec, 1, &gpio->rst, &gpio->invert,
+                                            BSL430_GPIO_RST_INVERT);
+            status |= bsl430_test_gpio_line(strtok(NULL, ":"), 1, &gpio->tst, &gpio->invert,
+                                            BSL430_GPIO_TST_INVERT);
+        }
     } else {
-        log("Parsing TI-TXT file error.\n");
+        status = -1;
+    }
+
+    return status;
+}
+
+/*
+ * Return the segments of the files parsed, merged if there are several, or
+ * NULL. Free it by free().
+ */
+static titxt_header_t *bsl430_test_load(char *const *files, int count)
+{
+    if (count == 1) {
+        return bsl430_ti_txt_load(files[0], BSL430_MAX_CODE_SIZE);
     }
 
-    close(fd);
+    return bsl430_merge_load((const char *const *)files, (uint32_t)count);
+}
+
+static int bsl430_test_read(const char *spec)
+{
+    int status = 0;
+    char *end = NULL;
+    uint32_t address, size, i;
+    uint32_t version = 0;
+    uint16_t crc = 0;
+    uint8_t buf[BSL430_MAX_DATA_SIZE];
+
+    address = strtoul(spec, &end, 16);
+    if (*end != ':' || (size = strtoul(end + 1, &end, 0)) == 0 || size > sizeof(buf)) {
+        log("** Bad read spec %s, ADDR:SIZE up to %u Bytes.\n", spec, (uint32_t)sizeof(buf));
+        return -1;
+    }
+
+    status = bsl430_session_read(address, buf, (uint16_t)size);
+    if (status == 0) {
+        status = bsl430_session_crc(address, (uint16_t)size, &crc);
+    }
+    if (status == 0) {
+        status = bsl430_session_version(&version);
+    }
+    if (status != 0) {
+        log("** Reading back failed! 0x%02X\n", (uint8_t)status);
+        return status;
+    }
+
+    printf("@%04X %u Bytes, Crc %04X (%s), BSL Version %08X\n", address, size, crc,
+           (crc == bsl430_crc16(buf, size, 0xFFFF))? "OK": "MISMATCH", version);
+    for (i = 0; i < size; i++) {
+        printf("%02X%c", buf[i], ((i & 15) == 15 || i == size - 1)? '\n': ' ');
+    }
+
+    return 0;
+}
+
+/*
+ * The CRC a device holding the image answers over the range, offline.
+ */
+static int bsl430_test_crc(char *const *files, int count, const char *spec)
+{
+    int status = 0;
+    char *end = NULL;
+    uint32_t address, size;
+    titxt_header_t *header = NULL;
+    bsl430_stream_t stream;
+    bsl430_patch_t patch;
+
+    address = strtoul(spec, &end, 16);
+    if (*end != ':' || (size = strtoul(end + 1, &end, 0)) == 0 || address + size > 0x10000) {
+        log("** Bad CRC spec %s, ADDR:SIZE up to 0xFFFF.\n", spec);
+        return -1;
+    }
+
+    header = bsl430_test_load(files, count);
+    if (header == NULL) {
+        return -1;
+    }
+
+    memset(&patch, 0, sizeof(patch));
+    status = bsl430_stream_encode(header, &stream);
+    if (status == 0 && test_edits > 0) {
+        status = bsl430_patch_apply(header, &stream, test_edit, test_edits, &patch);
+    }
+    if (status == 0) {
+        printf("@%04X %u Bytes, Crc %04X\n", address, size,
+               bsl430_stream_crc((test_edits > 0)? &patch.stream: &stream, address, size));
+    }
+
+    bsl430_patch_free(&patch);
+    bsl430_stream_free(&stream);
+
+    free(header);
 
     return status;
+}
+
+/*
+ * The update from the previous image, planned offline.
+ */
+static int bsl430_test_plan(char *const *files, int count, bsl430_program_config_t *config)
+{
+    int status = 0;
+    uint32_t i;
+    titxt_header_t *header = NULL;
+    bsl430_plan_t plan;
+    bsl430_strategy_t strategy;
+
+    if (config->previous == NULL) {
+        log("** The plan needs the previous image, -P.\n");
+        return -1;
+    }
+
+    header = bsl430_test_load(files, count);
+    if (header == NULL) {
+        return -1;
+    }
+
+    status = bsl430_plan_diff(config->previous, header, &plan);
+    if (status == 0) {
+        bsl430_plan_print(&plan);
+        for (i = 0; i < plan.writes; i++) {
+            printf("@%04X %u\n", plan.write[i].address, plan.write[i].size);
+        }
+        /* By the default cost model at 115200 baud, nothing is measured. */
+        if (config->optimize) {
+            bsl430_strategy_choose(header, &plan, 0, &strategy);
+            bsl430_strategy_print(&strategy);
+        }
+        bsl430_plan_free(&plan);
+    }
+
+    free(header);
+
+    return status;
+}
+
+/*
+ * Audit the devices on the ttys in parallel, a process each as the platform
+ * is process wide. Each enters the BSL by its own RST/TST, shared lines would
+ * reset the others. Return the number of devices which failed.
+ */
+static int bsl430_test_audit(char *const *files, int count, char *ttys, int flags)
+{
+    int status = 0;
+    int failed = 0;
+    int ports = 0;
+    pid_t pid;
+    char *name = NULL;
+    char report[512];
+    titxt_header_t *header = NULL;
+    bsl430_audit_t audit;
+
+    if (strchr(ttys, ',') && !bsl430_gpio_per_port()) {
+        log("** Auditing several TTYs needs RST/TST lines per TTY, -g modem.\n");
+        return -1;
+    }
+
+    header = bsl430_test_load(files, count);
+    if (header == NULL) {
+        return -1;
+    }
+
+    fflush(stdout);
+    for (name = strtok(ttys, ","); name; name = strtok(NULL, ",")) {
+        pid = fork();
+        if (pid < 0) {
+            log("Starting audit of %s failed! %s\n", name, strerror(errno));
+            failed++;
+            continue;
+        }
+
+        if (pid == 0) {
+            bsl430_uart_port(name);
+            status = bsl430_audit(header, flags, &audit);
+            bsl430_audit_report(name, &audit, report, sizeof(report));
+            printf("%s\n", report);
+            fflush(stdout);
+            _exit((status == 0)? 0: 1);
+        }
+        ports++;
+    }
+
+    while (ports > 0 && wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed++;
+        }
+        ports--;
+    }
+
+    free(header);
+
+    return failed;
+}
+
+/*
+ * Parse the edits, ADDR:HEX separated by ','. -x may be given more than once.
+ */
+static int bsl430_test_patch(char *spec)
+{
+    char *edit = NULL;
+
+    for (edit = strtok(spec, ","); edit; edit = strtok(NULL, ",")) {
+        if (test_edits >= BSL430_PATCH_MAX_EDITS ||
+            bsl430_patch_parse(edit, &test_edit[test_edits], test_edit_data[test_edits],
+                               BSL430_PATCH_MAX_SIZE) != 0) {
+            log("** Bad patch %s, ADDR:HEX up to %u Bytes, %u edits.\n", edit,
+                BSL430_PATCH_MAX_SIZE, BSL430_PATCH_MAX_EDITS);
+            return -1;
+        }
+        test_edits++;
+    }
+
+    return 0;
+}
+
+static uint32_t bsl430_test_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static int bsl430_test_realtime(char *spec, bsl430_rt_config_t *rt)
+{
+    char *end = NULL;
+
+    rt->priority = (int)strtol(spec, &end, 0);
+    rt->cpu = -1;
+    rt->lock = 1;
+    if (*end == ':') {
+        rt->cpu = (int)strtol(end + 1, &end, 0);
+    }
+
+    return (*end != '\0' || rt->priority < 1 || rt->priority > 99)? -1: 0;
+}
+
+static int bsl430_test_job(void *arg)
+{
+    bsl430_test_job_t *job = (bsl430_test_job_t *)arg;
 
-error0:
-    close(fd);
-    return -1;
+    return bsl430_test_program(job->files, job->count, job->config, job->repeat, job->streaming);
 }